@@ -1,8 +1,9 @@
 #pragma once
 
-#include <stack>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <vector>
-#include <memory>
 
 #include "base/memory/manual_constructor.h"
 
@@ -11,79 +12,167 @@
 namespace nq {
 struct EmptyBSS {
 };
-template <class E, class B> 
+template <class E, class B>
 struct BlockTrait {
   STATIC_ASSERT((sizeof(E) % 8) == 0, "allocator target type should have 8 byte alignment");
   STATIC_ASSERT((sizeof(B) % 8) == 0, "allocator bss type should have 8 byte alignment");
   typedef struct BlockTag {
     char p[sizeof(E)];
     base::ManualConstructor<B> bss;
+    void *next;
     inline void Init() { bss.Init(); }
     inline void Destroy() { bss.Destroy(); }
     static inline B *Bss(void *ptr) {
-      return reinterpret_cast<B *>(reinterpret_cast<char *>(ptr) + sizeof(E)); 
+      return reinterpret_cast<B *>(reinterpret_cast<char *>(ptr) + sizeof(E));
+    }
+    static inline void *&Next(void *ptr) {
+      return reinterpret_cast<BlockTag *>(ptr)->next;
     }
   } Block;
 };
 template <class E>
 struct BlockTrait<E, EmptyBSS> {
   STATIC_ASSERT((sizeof(E) % 8) == 0, "allocator target type should have 8 byte alignment");
-  typedef struct {
+  typedef struct BlockTag {
     char p[sizeof(E)];
+    void *next;
     inline void Init() {}
     inline void Destroy() {}
     static inline EmptyBSS *Bss(void *ptr) {
-      return nullptr;   
+      return nullptr;
     }
-  } Block;  
+    static inline void *&Next(void *ptr) {
+      return reinterpret_cast<BlockTag *>(ptr)->next;
+    }
+  } Block;
 };
+struct AllocatorStats {
+  size_t block_size, blocks_per_chunk;
+  size_t live, high_water;
+  size_t chunks, hugepage_chunks;
+};
+//fixed size block allocator which grows by chunk of blocks. chunks are mmap'ed,
+//and backed by huge page if use_hugepage is true (MAP_HUGETLB, or THP if hugetlb pages are not reserved).
+//each block is aligned to cache line, so that objects do not share cache line with others.
+//free blocks are linked intrusively with the word placed after object area (and B), so alloc/free never allocate memory.
+//
+//chunks are never unmapped nor released while allocator alive, because freed object is still read
+//by handle validation of other threads (eg. boxer pointer, stored serial, B (see core/nq_static_section.h)).
+//for the same reason, freeing block does not overwrite object area.
+//FYI(iyatomi): releasing physical memory of idle chunks (trim) is not supported. validated fields and
+//the object payload share the same page because every object is smaller than a page, and the owner thread
+//also reads vptr of freed object (SessionSerial), so there is no page which can be released safely.
+//it will need serials which are stored separately from objects, in the region never released.
 template <class E, class B = EmptyBSS>
 class Allocator {
   typedef typename BlockTrait<E, B>::Block Block;
-  //TODO(iyatoim): it may be more fast by custom allocator
-  std::vector<std::unique_ptr<Block[]>> chunks_;
-  size_t total_block_, chunk_size_;
-  std::stack<Block*> pool_;
+  static const size_t kCacheLineSize = 64;
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+  static const size_t kBlockSize = (sizeof(Block) + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+  struct Chunk {
+    char *base_;
+    bool huge_;
+  };
+  std::vector<Chunk> chunks_;
+  size_t chunk_size_, map_size_;
+  bool use_hugepage_;
+  void *free_list_;
+  size_t live_, high_water_;
  public:
-  Allocator(size_t chunk_size) : 
-    chunks_(), total_block_(chunk_size), chunk_size_(chunk_size), pool_() {
-    ASSERT(chunk_size_ > 0);
+  Allocator(size_t chunk_size, bool use_hugepage = false) :
+    chunks_(), chunk_size_(0), map_size_(0), use_hugepage_(use_hugepage),
+    free_list_(nullptr), live_(0), high_water_(0) {
+    ASSERT(chunk_size > 0);
+    //round up to page boundary and use the rest of the page for additional blocks
+    size_t align = use_hugepage ? kHugePageSize : (size_t)sysconf(_SC_PAGESIZE);
+    map_size_ = ((chunk_size * kBlockSize) + align - 1) & ~(align - 1);
+    chunk_size_ = map_size_ / kBlockSize;
     GrowChunk();
   }
   ~Allocator() {
     for (auto &c : chunks_) {
-      auto pb = c.get();
       for (size_t i = 0; i < chunk_size_; i++) {
-        pb[i].Destroy();
+        BlockAt(c, i)->Destroy();
       }
+      munmap(c.base_, map_size_);
     }
   }
   inline void *Alloc(std::size_t sz) {
     ASSERT(sz == sizeof(E));
-    Block *block;
-    if (pool_.size() <= 0) {
+    if (free_list_ == nullptr) {
       GrowChunk();
     }
-    ASSERT(pool_.size() > 0);
-    block = pool_.top();
-    pool_.pop();
-    return block->p;
+    ASSERT(free_list_ != nullptr);
+    auto block = free_list_;
+    free_list_ = Next(block);
+    if (++live_ > high_water_) {
+      high_water_ = live_;
+    }
+    return block;
   }
   inline void Free(void *a) {
-    pool_.push(reinterpret_cast<Block *>(a));
+    Next(a) = free_list_;
+    free_list_ = a;
+    live_--;
   }
   inline B *Bss(void *ptr) {
     return Block::Bss(ptr);
   }
+  AllocatorStats stats() const {
+    AllocatorStats st = { kBlockSize, chunk_size_, live_, high_water_, chunks_.size(), 0 };
+    for (auto &c : chunks_) {
+      if (c.huge_) { st.hugepage_chunks++; }
+    }
+    return st;
+  }
  protected:
+  static inline void *&Next(void *block) {
+    return Block::Next(block);
+  }
+  inline Block *BlockAt(const Chunk &c, size_t i) {
+    return reinterpret_cast<Block *>(c.base_ + (i * kBlockSize));
+  }
+  inline void PushChunk(const Chunk &c) {
+    //push in reverse order, so that blocks are allocated in address order
+    for (size_t i = chunk_size_; i > 0; i--) {
+      auto b = BlockAt(c, i - 1);
+      Next(b->p) = free_list_;
+      free_list_ = b->p;
+    }
+  }
   inline void GrowChunk() {
-    chunks_.emplace(chunks_.end(), new Block[chunk_size_]);
-    auto pb = chunks_[chunks_.size() - 1].get();
+    Chunk c = { nullptr, false };
+    c.base_ = MapChunk(c.huge_);
+    ASSERT(c.base_ != nullptr);
     for (size_t i = 0; i < chunk_size_; i++) {
-      auto ptr = pb + i;
-      ptr->Init();
-      pool_.push(ptr);
+      BlockAt(c, i)->Init();
+    }
+    chunks_.push_back(c);
+    PushChunk(c);
+  }
+  inline char *MapChunk(bool &huge) {
+    void *p;
+    huge = false;
+#if defined(MAP_HUGETLB)
+    if (use_hugepage_) {
+      p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED) {
+        huge = true;
+        return reinterpret_cast<char *>(p);
+      }
+    }
+#endif
+    p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      return nullptr;
+    }
+#if defined(MADV_HUGEPAGE)
+    //no huge page reserved. ask kernel to back the chunk by transparent huge page
+    if (use_hugepage_ && madvise(p, map_size_, MADV_HUGEPAGE) == 0) {
+      huge = true;
     }
+#endif
+    return reinterpret_cast<char *>(p);
   }
 };
 }
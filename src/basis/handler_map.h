@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <string>
 
 #include "nq.h"
 
@@ -20,6 +21,7 @@ class HandlerMap {
       nq_stream_handler_t stream;
       nq_rpc_handler_t rpc;
   	};
+    nq_on_stream_records_t stream_records; //only for STREAM. set by SetRecordsHandler
   } HandlerEntry;
  private:
   std::map<std::string, HandlerEntry> map_;
@@ -37,9 +39,18 @@ class HandlerMap {
     HandlerEntry he;
     he.type = STREAM;
     he.stream = stream;
+    he.stream_records = nq_closure_empty();
   	map_[name] = he;
     return true;
   }
+  inline bool SetRecordsHandler(const std::string &name, nq_on_stream_records_t stream_records) {
+    auto it = map_.find(name);
+    if (it == map_.end() || it->second.type != STREAM) {
+      return false;
+    }
+    it->second.stream_records = stream_records;
+    return true;
+  }
   inline bool AddEntry(const std::string &name, nq_rpc_handler_t rpc) {
     HandlerEntry he;
     he.type = RPC;
@@ -55,6 +66,7 @@ class HandlerMap {
   inline void SetRawHandler(nq_stream_handler_t stream) {
     raw_.type = STREAM;
     raw_.stream = stream;
+    raw_.stream_records = nq_closure_empty();
   }
 
   inline nq_hdmap_t ToHandle() { return (nq_hdmap_t)this; }
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "nq.h"
+#include "basis/defs.h"
+
+namespace nq {
+//HDR (high dynamic range) histogram of non negative integer value.
+//each power of 2 range of value is split into kSubBucketCount buckets, so relative error of
+//recorded value is less than 1/kSubBucketCount for any magnitude, with fixed size memory.
+//only one thread can call Record, but counts are atomic so that any thread can read
+//(or merge into other histogram) them without lock.
+class HdrHistogram {
+ public:
+  static const int kSubBucketBits = 5;
+  static const int kSubBucketCount = 1 << kSubBucketBits;
+  static const int kValueBits = 40; //larger value is clamped to 2^40 - 1
+  static const int kNumBuckets = (kValueBits - kSubBucketBits + 1) * kSubBucketCount;
+  static const uint64_t kMaxValue = (1ULL << kValueBits) - 1;
+ protected:
+  typedef std::atomic<uint64_t> Value;
+  Value counts_[kNumBuckets];
+  Value count_, sum_, min_, max_;
+ public:
+  HdrHistogram() { Clear(); }
+  //not thread safe. should not be called concurrently with Record.
+  void Clear() {
+    for (int i = 0; i < kNumBuckets; i++) {
+      counts_[i].store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    min_.store(kMaxValue, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+  //single writer. update is relaxed load/store instead of atomic RMW,
+  //so that recording costs same as non atomic histogram.
+  inline void Record(uint64_t v) {
+    if (v > kMaxValue) { v = kMaxValue; }
+    Inc(counts_[Index(v)], 1);
+    Inc(count_, 1);
+    Inc(sum_, v);
+    if (v < min_.load(std::memory_order_relaxed)) { min_.store(v, std::memory_order_relaxed); }
+    if (v > max_.load(std::memory_order_relaxed)) { max_.store(v, std::memory_order_relaxed); }
+  }
+  //add counts of other histogram. only the thread which writes this histogram can call.
+  void Merge(const HdrHistogram &o) {
+    for (int i = 0; i < kNumBuckets; i++) {
+      auto c = o.counts_[i].load(std::memory_order_relaxed);
+      if (c > 0) { Inc(counts_[i], c); }
+    }
+    Inc(count_, o.count_.load(std::memory_order_relaxed));
+    Inc(sum_, o.sum_.load(std::memory_order_relaxed));
+    auto mn = o.min_.load(std::memory_order_relaxed), mx = o.max_.load(std::memory_order_relaxed);
+    if (mn < min_.load(std::memory_order_relaxed)) { min_.store(mn, std::memory_order_relaxed); }
+    if (mx > max_.load(std::memory_order_relaxed)) { max_.store(mx, std::memory_order_relaxed); }
+  }
+  //make this difference of cur and prev, which is earlier copy of cur (eg. for per interval statistics).
+  //min and max are approximated by the bucket boundary. only the thread which writes this histogram can call.
+  void Diff(const HdrHistogram &cur, const HdrHistogram &prev) {
+    uint64_t mn = kMaxValue, mx = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+      auto c = cur.counts_[i].load(std::memory_order_relaxed) - prev.counts_[i].load(std::memory_order_relaxed);
+      counts_[i].store(c, std::memory_order_relaxed);
+      if (c > 0) {
+        if (mn == kMaxValue) { mn = LowestEquivalentValue(i); }
+        mx = HighestEquivalentValue(i);
+      }
+    }
+    count_.store(cur.count_.load(std::memory_order_relaxed) - prev.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sum_.store(cur.sum_.load(std::memory_order_relaxed) - prev.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    min_.store(mn, std::memory_order_relaxed);
+    max_.store(mx < cur.max() ? mx : cur.max(), std::memory_order_relaxed);
+  }
+  inline uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  inline uint64_t min() const { return count() > 0 ? min_.load(std::memory_order_relaxed) : 0; }
+  inline uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  inline uint64_t mean() const {
+    auto c = count();
+    return c > 0 ? (sum_.load(std::memory_order_relaxed) / c) : 0;
+  }
+  //returns highest value which is equivalent to the value at percentile (0.0 - 100.0).
+  //if histogram is updated concurrently, result may be slightly inaccurate.
+  uint64_t ValueAtPercentile(double percentile) const {
+    uint64_t total = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+      total += counts_[i].load(std::memory_order_relaxed);
+    }
+    if (total <= 0) {
+      return 0;
+    }
+    auto target = (uint64_t)((percentile / 100.0) * total + 0.5);
+    if (target <= 0) { target = 1; }
+    uint64_t acc = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+      acc += counts_[i].load(std::memory_order_relaxed);
+      if (acc >= target) {
+        auto v = HighestEquivalentValue(i);
+        return v < max() ? v : max();
+      }
+    }
+    return max();
+  }
+  //summarize histogram which records value in unit_ns nanoseconds
+  void Summarize(nq_histogram_t *out, uint64_t unit_ns) const {
+    out->count = count();
+    out->min = min() * unit_ns;
+    out->max = max() * unit_ns;
+    out->mean = mean() * unit_ns;
+    out->p50 = ValueAtPercentile(50.0) * unit_ns;
+    out->p90 = ValueAtPercentile(90.0) * unit_ns;
+    out->p99 = ValueAtPercentile(99.0) * unit_ns;
+    out->p999 = ValueAtPercentile(99.9) * unit_ns;
+  }
+
+ protected:
+  static inline void Inc(Value &v, uint64_t n) {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  //bucket group 0 holds [0, kSubBucketCount) as it is, and group g (>= 1) holds
+  //[2^(g + kSubBucketBits - 1), 2^(g + kSubBucketBits)) with kSubBucketCount buckets.
+  static inline int Index(uint64_t v) {
+    if (v < (uint64_t)kSubBucketCount) {
+      return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int group = msb - kSubBucketBits + 1;
+    int sub = (int)((v >> (msb - kSubBucketBits)) & (kSubBucketCount - 1));
+    return (group << kSubBucketBits) + sub;
+  }
+  static inline uint64_t LowestEquivalentValue(int idx) {
+    int group = idx >> kSubBucketBits, sub = idx & (kSubBucketCount - 1);
+    return group == 0 ? sub : ((uint64_t)(kSubBucketCount + sub) << (group - 1));
+  }
+  static inline uint64_t HighestEquivalentValue(int idx) {
+    int group = idx >> kSubBucketBits, sub = idx & (kSubBucketCount - 1);
+    if (group == 0) {
+      return sub;
+    }
+    uint64_t width = 1ULL << (group - 1);
+    return ((uint64_t)(kSubBucketCount + sub) << (group - 1)) + width - 1;
+  }
+};
+}
@@ -70,9 +70,17 @@ namespace nq {
       }
       return ofs;
     }
+    //returns 0 if bufsz is not enough to decode header
     static inline nq_size_t Decode(int16_t *type, nq_msgid_t *msgid, const char *buf, nq_size_t bufsz) {
+      if (bufsz <= 0) {
+        return 0;
+      }
       auto f = buf[0];
       nq_size_t ofs = 1;
+      if (bufsz < (nq_size_t)(1 + ((f & TYPE_1BYTE) ? 1 : 2) + 
+                  ((f & MSGID_4BYTE) ? 4 : ((f & MSGID_2BYTE) ? 2 : 0)))) {
+        return 0;
+      }
       if (f & TYPE_1BYTE) {
         *type = buf[1];
         ofs += 1;
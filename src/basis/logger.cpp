@@ -1,9 +1,11 @@
 #include "logger.h"
 #include <mutex>
-#include <MoodyCamel/concurrentqueue.h>
-#if defined(NO_LOG_WRITE_CALLBACK)
-#include <iostream>
-#endif
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
 
 namespace nq {
 namespace logger {
@@ -22,48 +24,430 @@ namespace logger {
   }
   static writer_cb_t writer_ = default_writer;
   static std::string id_ = "nq";
-  static std::mutex mtx_;
-  static bool manual_flush_ = false;
-    void configure(writer_cb_t cb, const std::string &id, bool manual_flush) {
-      if (cb != nullptr) {
+  static std::atomic<bool> manual_flush_(false);
+  static std::atomic<bool> exiting_(false);
+
+  //binary log event. followed by n_args_ of arguments, or message string (if kind_ == Message).
+  //each argument is [type 1byte][key length 2byte][key][value 8byte or [length 4byte][string]]
+  struct Record {
+    enum Kind : uint8_t {
+      Object,
+      Message,
+      Wrap, //padding at the end of ring buffer
+    };
+    typedef param::Type Type;
+    uint32_t size_;
+    uint8_t level_;
+    Kind kind_;
+    uint16_t n_args_;
+    int64_t sec_, nsec_;
+  };
+  //single producer (thread which owns it) single consumer (formatter) ring buffer of Records
+  class Ring {
+    static const size_t kSize = 256 * 1024;
+    static const size_t kMask = kSize - 1;
+    char buf_[kSize];
+    std::atomic<size_t> head_, tail_;
+   public:
+    std::atomic<uint64_t> dropped_;
+    std::atomic<bool> closed_; //owner thread exit
+    Ring() : head_(0), tail_(0), dropped_(0), closed_(false) {}
+    //record should be aligned to 8 byte, so that wrap marker always fits at the end of buffer
+    bool Write(const char *p, size_t len) {
+      ASSERT((len % 8) == 0);
+      auto h = head_.load(std::memory_order_relaxed);
+      auto ofs = h & kMask, contiguous = kSize - ofs;
+      auto need = contiguous < len ? (contiguous + len) : len;
+      if ((h + need - tail_.load(std::memory_order_acquire)) > kSize) {
+        dropped_++;
+        return false;
+      }
+      if (contiguous < len) {
+        auto marker = reinterpret_cast<Record *>(buf_ + ofs);
+        marker->size_ = contiguous;
+        marker->kind_ = Record::Wrap;
+        h += contiguous;
+        ofs = 0;
+      }
+      memcpy(buf_ + ofs, p, len);
+      head_.store(h + len, std::memory_order_release);
+      return true;
+    }
+    template <class F>
+    size_t Read(F f) {
+      size_t n = 0;
+      auto t = tail_.load(std::memory_order_relaxed);
+      auto h = head_.load(std::memory_order_acquire);
+      while (t < h) {
+        auto r = reinterpret_cast<const Record *>(buf_ + (t & kMask));
+        if (r->kind_ != Record::Wrap) {
+          f(r);
+          n++;
+        }
+        t += r->size_;
+      }
+      tail_.store(t, std::memory_order_release);
+      return n;
+    }
+    inline bool empty() const { return tail_.load() == head_.load(); }
+  };
+  //FYI(iyatomi): intentionally never destroyed, because threads may log during static destruction
+  struct State {
+    std::mutex registry_mtx_, drain_mtx_, wait_mtx_;
+    std::condition_variable cond_;
+    std::vector<Ring *> rings_;
+    std::thread formatter_;
+    std::atomic<bool> running_, sleeping_;
+    State() : registry_mtx_(), drain_mtx_(), wait_mtx_(), cond_(), rings_(), formatter_(), 
+              running_(false), sleeping_(false) {}
+  };
+  static State &state() {
+    static State *s = new State();
+    return *s;
+  }
+  struct RingHolder {
+    Ring *ring_;
+    RingHolder() : ring_(nullptr) {}
+    ~RingHolder() { if (ring_ != nullptr) { ring_->closed_ = true; } }
+  };
+  static thread_local RingHolder tls_ring_;
+  static void start_formatter();
+  static size_t drain();
+  //called by the thread which writes record. wake formatter up only if it sleeps, 
+  //so that no syscall happens while logs are written frequently.
+  static inline void wakeup_formatter() {
+    auto &st = state();
+    //write of record should not be reordered after load of sleeping_ (pairs with fence in formatter_loop)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (st.sleeping_.load(std::memory_order_relaxed) && st.sleeping_.exchange(false)) {
+      std::unique_lock<std::mutex> lock(st.wait_mtx_);
+      st.cond_.notify_one();
+    }
+  }
+  static inline Ring *ring() {
+    if (tls_ring_.ring_ == nullptr) {
+      auto r = new Ring();
+      {
+        std::unique_lock<std::mutex> lock(state().registry_mtx_);
+        state().rings_.push_back(r);
+      }
+      tls_ring_.ring_ = r;
+      start_formatter();
+    }
+    return tls_ring_.ring_;
+  }
+
+  //encoder. uses thread local buffer to avoid allocation after warming up
+  class Encoder {
+    std::string &buf_;
+   public:
+    Encoder(std::string &buf) : buf_(buf) {}
+    inline void Begin(level::def lv, Record::Kind kind) {
+      long sec, nsec;
+      clock::now(sec, nsec);
+      Record r;
+      r.size_ = 0;
+      r.level_ = lv;
+      r.kind_ = kind;
+      r.n_args_ = 0;
+      r.sec_ = sec;
+      r.nsec_ = nsec;
+      buf_.assign(reinterpret_cast<const char *>(&r), sizeof(r));
+    }
+    inline void Put(const void *p, size_t len) { buf_.append(reinterpret_cast<const char *>(p), len); }
+    inline void PutString(const char *s, size_t len) {
+      uint32_t l = len;
+      Put(&l, sizeof(l));
+      Put(s, len);
+    }
+    template <class T>
+    inline void PutArg(const std::string &key, Record::Type type, T value) {
+      PutKey(key.c_str(), key.length(), type);
+      Put(&value, sizeof(value));
+    }
+    inline void PutKey(const char *key, size_t len, Record::Type type) {
+      uint16_t kl = len;
+      Put(&type, sizeof(type));
+      Put(&kl, sizeof(kl));
+      Put(key, len);
+      reinterpret_cast<Record *>(&buf_[0])->n_args_++;
+    }
+    inline bool End() {
+      buf_.append((8 - (buf_.length() % 8)) % 8, '\0');
+      reinterpret_cast<Record *>(&buf_[0])->size_ = buf_.length();
+      return ring()->Write(buf_.c_str(), buf_.length());
+    }
+    inline bool Retry() { return ring()->Write(buf_.c_str(), buf_.length()); }
+  };
+  static inline std::string &encode_buffer() {
+    static thread_local std::string buf;
+    return buf;
+  }
+
+  //decoder and formatter
+  template <class T>
+  static inline T get(const char *&p) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return v;
+  }
+  static inline std::string get_string(const char *&p) {
+    auto len = get<uint32_t>(p);
+    std::string s(p, len);
+    p += len;
+    return s;
+  }
+  static inline std::string format_ts(long sec, long nsec) {
+    char tsbuff[32];
+    snprintf(tsbuff, sizeof(tsbuff), "%ld.%09ld", sec, nsec);
+    return tsbuff;
+  }
+  static void format(const Record *r) {
+    const char *p = reinterpret_cast<const char *>(r + 1);
+    json j;
+    if (r->kind_ == Record::Message) {
+      if (r->level_ >= level::debug) {
+        j = { {"msg", get_string(p)} };
+      } else {
+        j = get_string(p);
+      }
+    } else {
+      j = json::object();
+      for (uint16_t i = 0; i < r->n_args_; i++) {
+        auto type = get<Record::Type>(p);
+        auto kl = get<uint16_t>(p);
+        std::string key(p, kl);
+        p += kl;
+        switch (type) {
+        case param::Null: j[key] = nullptr; break;
+        case param::Int: j[key] = get<int64_t>(p); break;
+        case param::Uint: j[key] = get<uint64_t>(p); break;
+        case param::Float: j[key] = get<double>(p); break;
+        case param::Bool: j[key] = get<bool>(p); break;
+        case param::String: j[key] = get_string(p); break;
+        case param::RawJson: j[key] = json::parse(get_string(p)); break;
+        }
+      }
+    }
+    //fill default properties
+    if (r->level_ >= level::debug) {
+      j["_ts"] = format_ts(r->sec_, r->nsec_);
+      j["_id"] = id_;
+      j["_lv"] = log_level_[r->level_];
+    }
+    auto body = j.dump();
+    writer_(body.c_str(), body.length());
+  }
+  static size_t drain() {
+    auto &st = state();
+    std::unique_lock<std::mutex> dlock(st.drain_mtx_);
+    std::vector<Ring *> rings;
+    {
+      std::unique_lock<std::mutex> lock(st.registry_mtx_);
+      rings = st.rings_;
+    }
+    size_t n = 0;
+    for (auto r : rings) {
+      //check before read, so that all records written before thread exit, are read
+      bool closed = r->closed_;
+      n += r->Read(format);
+      uint64_t dropped = r->dropped_.exchange(0);
+      if (dropped > 0) {
+        long sec, nsec;
+        clock::now(sec, nsec);
+        auto body = json({
+          {"msg", "log dropped"}, {"count", dropped}, 
+          {"_ts", format_ts(sec, nsec)}, {"_id", id_}, {"_lv", log_level_[level::warn]}
+        }).dump();
+        writer_(body.c_str(), body.length());
+      }
+      if (closed && r->empty()) {
+        std::unique_lock<std::mutex> lock(st.registry_mtx_);
+        for (auto it = st.rings_.begin(); it != st.rings_.end(); it++) {
+          if (*it == r) { st.rings_.erase(it); break; }
+        }
+        delete r;
+      }
+    }
+    return n;
+  }
+  static bool all_empty() {
+    auto &st = state();
+    std::unique_lock<std::mutex> lock(st.registry_mtx_);
+    for (auto r : st.rings_) {
+      if (!r->empty()) {
+        return false;
+      }
+    }
+    return true;
+  }
+  static void formatter_loop() {
+    auto &st = state();
+    while (st.running_) {
+      if (!manual_flush_ && drain() > 0) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(st.wait_mtx_);
+      st.sleeping_.store(true, std::memory_order_relaxed);
+      //store of sleeping_ should not be reordered after the check of rings
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!manual_flush_ && !all_empty()) {
+        st.sleeping_ = false;
+        continue;
+      }
+      st.cond_.wait(lock, [&st]() { return !st.sleeping_.load() || !st.running_.load(); });
+    }
+  }
+  static void stop_formatter() {
+    auto &st = state();
+    exiting_ = true; //threads may still log after this. then records are written by flush or fatal log
+    if (st.running_.exchange(false)) {
+      {
+        std::unique_lock<std::mutex> lock(st.wait_mtx_);
+        st.cond_.notify_one();
+      }
+      st.formatter_.join();
+    }
+    if (!manual_flush_) {
+      drain();
+    }
+  }
+  //formatter thread is not started while manual_flush is set
+  static void start_formatter() {
+    static std::mutex mtx;
+    auto &st = state();
+    if (manual_flush_ || st.running_ || exiting_) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    if (st.running_ || exiting_) {
+      return;
+    }
+    st.running_ = true;
+    st.formatter_ = std::thread(formatter_loop);
+    std::atexit(stop_formatter);
+  }
+
+  void configure(writer_cb_t cb, const std::string &id, bool manual_flush) {
+    //output logs recorded with previous configuration
+    if (!manual_flush_) {
+      drain();
+    }
+    std::unique_lock<std::mutex> dlock(state().drain_mtx_);
+    if (cb != nullptr) {
       writer_ = cb;
     }
     if (id.length() > 0) {
       id_ = id;
     }
     manual_flush_ = manual_flush;
+    dlock.unlock();
+    if (!manual_flush) {
+      start_formatter();
+    }
   }
   const std::string &id() { return id_; }
-
-#if !defined(NO_LOG_WRITE_CALLBACK)
-  static moodycamel::ConcurrentQueue<std::string> s_logs;
   void flush() {
-//  printf("flush_from_main_thread");
     if (manual_flush_) {
-      std::string str;
-      while (s_logs.try_dequeue(str)) {
-        writer_(str.c_str(), str.length());
-      }
+      drain();
     }
   }
-#else
-  void flush() {
+  //important event is never dropped and written synchronously
+  static inline void commit(Encoder &e, level::def lv) {
+    bool written = e.End();
+    if (manual_flush_) {
+      return;
+    }
+    if (lv >= level::fatal) {
+      drain();
+      if (!written && e.Retry()) {
+        drain();
+      }
+    } else if (written) {
+      wakeup_formatter();
+    }
   }
-#endif
 
-  void write(const json &j) {
-    mtx_.lock();
-#if defined(NO_LOG_WRITE_CALLBACK)
-    std::err << j << std::endl;
-#else
-    auto body = j.dump();
-    if (manual_flush_) {
-      s_logs.enqueue(body);
+  void write(level::def lv, const json &j) {
+    Encoder e(encode_buffer());
+    if (j.is_string()) {
+      e.Begin(lv, Record::Message);
+      auto &s = j.get_ref<const std::string &>();
+      e.PutString(s.c_str(), s.length());
     } else {
-      writer_(body.c_str(), body.length());     
+      e.Begin(lv, Record::Object);
+      for (auto it = j.begin(); it != j.end(); ++it) {
+        auto &v = it.value();
+        if (v.is_number_unsigned()) {
+          e.PutArg(it.key(), param::Uint, v.get<uint64_t>());
+        } else if (v.is_number_integer()) {
+          e.PutArg(it.key(), param::Int, v.get<int64_t>());
+        } else if (v.is_number_float()) {
+          e.PutArg(it.key(), param::Float, v.get<double>());
+        } else if (v.is_boolean()) {
+          e.PutArg(it.key(), param::Bool, v.get<bool>());
+        } else if (v.is_string()) {
+          auto &s = v.get_ref<const std::string &>();
+          e.PutKey(it.key().c_str(), it.key().length(), param::String);
+          e.PutString(s.c_str(), s.length());
+        } else if (v.is_null()) {
+          e.PutKey(it.key().c_str(), it.key().length(), param::Null);
+        } else {
+          auto s = v.dump();
+          e.PutKey(it.key().c_str(), it.key().length(), param::RawJson);
+          e.PutString(s.c_str(), s.length());
+        }
+      }
+    }
+    commit(e, lv);
+  }
+  void write(level::def lv, const char *msg, std::initializer_list<param> params) {
+    Encoder e(encode_buffer());
+    e.Begin(lv, Record::Object);
+    e.PutKey("msg", 3, param::String);
+    e.PutString(msg, strlen(msg));
+    for (auto &p : params) {
+      e.PutKey(p.key_, strlen(p.key_), p.type_);
+      switch (p.type_) {
+      case param::Int: e.Put(&p.value_.i_, sizeof(p.value_.i_)); break;
+      case param::Uint: e.Put(&p.value_.u_, sizeof(p.value_.u_)); break;
+      case param::Float: e.Put(&p.value_.d_, sizeof(p.value_.d_)); break;
+      case param::Bool: e.Put(&p.value_.b_, sizeof(p.value_.b_)); break;
+      case param::String: e.PutString(p.value_.s_, p.len_); break;
+      default: break;
+      }
+    }
+    commit(e, lv);
+  }
+  void write(level::def lv, const char *msg, const nq_logparam_t *params, int n_params) {
+    Encoder e(encode_buffer());
+    e.Begin(lv, Record::Object);
+    e.PutKey("msg", 3, param::String);
+    e.PutString(msg, strlen(msg));
+    for (int i = 0; i < n_params; i++) {
+      auto &p = params[i];
+      auto kl = strlen(p.key);
+      switch (p.type) {
+      case NQ_LOG_INTEGER:
+        e.PutKey(p.key, kl, param::Uint);
+        e.Put(&p.value.n, sizeof(p.value.n));
+        break;
+      case NQ_LOG_STRING:
+        e.PutKey(p.key, kl, param::String);
+        e.PutString(p.value.s, strlen(p.value.s));
+        break;
+      case NQ_LOG_DECIMAL:
+        e.PutKey(p.key, kl, param::Float);
+        e.Put(&p.value.d, sizeof(p.value.d));
+        break;
+      case NQ_LOG_BOOLEAN:
+        e.PutKey(p.key, kl, param::Bool);
+        e.Put(&p.value.b, sizeof(p.value.b));
+        break;
+      }
     }
-#endif
-    mtx_.unlock();
+    commit(e, lv);
   }
 }
 }
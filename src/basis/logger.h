@@ -1,9 +1,18 @@
 #pragma once
 
 #include "assert.h"
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <type_traits>
 #include <json/src/json.hpp>
 #include "timespec.h"
 
+//logs which level is lower than NQ_LOG_MIN_LEVEL (value of nq::logger::level::def), are removed at compile time.
+#if !defined(NQ_LOG_MIN_LEVEL)
+#define NQ_LOG_MIN_LEVEL 0
+#endif
+
 namespace nq {
 using json = nlohmann::json;
 namespace logger {
@@ -21,34 +30,75 @@ namespace logger {
     };
   };
 
+  //key and value of log event for the binary encoding API (functions which take msg and params). 
+  //it does not copy or allocate, so string value should be alive until the log function returns.
+  class param {
+   public:
+    enum Type : uint8_t {
+      Null,
+      Int,
+      Uint,
+      Float,
+      Bool,
+      String,
+      RawJson, //only used by json API
+    };
+    template <class T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    param(const char *key, T v) : key_(key), type_(Int), len_(0) { value_.i_ = v; }
+    template <class T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && 
+                                               !std::is_same<T, bool>::value, int>::type = 0>
+    param(const char *key, T v) : key_(key), type_(Uint), len_(0) { value_.u_ = v; }
+    param(const char *key, double v) : key_(key), type_(Float), len_(0) { value_.d_ = v; }
+    param(const char *key, bool v) : key_(key), type_(Bool), len_(0) { value_.b_ = v; }
+    param(const char *key, const char *v) : key_(key), type_(v != nullptr ? String : Null), len_(v != nullptr ? strlen(v) : 0) { value_.s_ = v; }
+    param(const char *key, const std::string &v) : key_(key), type_(String), len_(v.length()) { value_.s_ = v.c_str(); }
+    param(const char *key, std::nullptr_t) : key_(key), type_(Null), len_(0) { value_.s_ = nullptr; }
+
+    const char *key_;
+    Type type_;
+    size_t len_; //for String
+    union {
+      int64_t i_;
+      uint64_t u_;
+      double d_;
+      bool b_;
+      const char *s_;
+    } value_;
+  };
+
   //non inline methods
   extern const std::string log_level_[level::max];
   typedef void (*writer_cb_t)(const char *, size_t);
   void configure(writer_cb_t cb, const std::string &id, bool manual_flush);
   const std::string &id();
-  void write(const json &j);
+  //record log event to per-thread ring buffer without lock. 
+  //events are formatted to JSON and passed to writer by background thread (or flush, if manual_flush).
+  //event which level is fatal or more, is written before these functions return.
+  void write(level::def lv, const json &j);
+  void write(level::def lv, const char *msg, const nq_logparam_t *params, int n_params);
+  void write(level::def lv, const char *msg, std::initializer_list<param> params);
   void flush();
 
   //log variadic funcs
   inline void log(level::def lv, const json &j) {
     ASSERT(j.is_object() || j.is_string());
-    if (lv >= level::debug) {
-      json &mj = const_cast<json &>(j);
-      if (j.is_string()) {
-        mj = {
-          {"msg", j},
-        };
-      }
-      //fill default properties
-      long sec, nsec;
-      clock::now(sec, nsec);
-      char tsbuff[32];
-      sprintf(tsbuff, "%ld.%09ld", sec, nsec);
-      mj["_ts"] = tsbuff; //((double)sec) + (((double)nsec) / (1000 * 1000 * 1000));
-      mj["_id"] = id();
-      mj["_lv"] = log_level_[lv];
+    if (lv < NQ_LOG_MIN_LEVEL) {
+      return;
+    }
+    write(lv, j);
+  }
+  inline void log(level::def lv, const char *msg, const nq_logparam_t *params, int n_params) {
+    if (lv < NQ_LOG_MIN_LEVEL) {
+      return;
+    }
+    write(lv, msg, params, n_params);
+  }
+  //binary encoding API. unlike json API, does not allocate memory, so use this in the library.
+  inline void log(level::def lv, const char *msg, std::initializer_list<param> params) {
+    if (lv < NQ_LOG_MIN_LEVEL) {
+      return;
     }
-    write(j);
+    write(lv, msg, params);
   }
   
   //short hands for each severity
@@ -59,12 +109,21 @@ namespace logger {
   inline void error(const json &j) { log(level::error, j); }
   inline void fatal(const json &j) { log(level::fatal, j); }
   inline void report(const json &j) { log(level::report, j); }
+  inline void trace(const char *msg, std::initializer_list<param> params = {}) { log(level::trace, msg, params); }
+  inline void debug(const char *msg, std::initializer_list<param> params = {}) { log(level::debug, msg, params); }
+  inline void info(const char *msg, std::initializer_list<param> params = {}) { log(level::info, msg, params); }
+  inline void warn(const char *msg, std::initializer_list<param> params = {}) { log(level::warn, msg, params); }
+  inline void error(const char *msg, std::initializer_list<param> params = {}) { log(level::error, msg, params); }
+  inline void fatal(const char *msg, std::initializer_list<param> params = {}) { log(level::fatal, msg, params); }
+  inline void report(const char *msg, std::initializer_list<param> params = {}) { log(level::report, msg, params); }
 }
 }
 
-#define NQ_LOG(level__, ...) { ::nq::logger::level__(__VA_ARGS__); } 
+#define NQ_LOG(level__, ...) { \
+  if (::nq::logger::level::level__ >= NQ_LOG_MIN_LEVEL) { ::nq::logger::level__(__VA_ARGS__); } \
+} 
 #if defined(VERBOSE) || !defined(NDEBUG)
-#define NQ_VLOG(level__, ...) { ::nq::logger::level__(__VA_ARGS__); } 
+#define NQ_VLOG(level__, ...) NQ_LOG(level__, __VA_ARGS__)
 #else
 #define NQ_VLOG(level__, ...)
 #endif
@@ -1,19 +1,76 @@
 #pragma once
 
 #include <cstdlib>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#include <unistd.h>
+#include <fcntl.h>
 
+#include "basis/atomic.h"
 #include "basis/loop_impl.h"
 #include "basis/io_processor.h"
 
 namespace nq {
+	//wake up the thread which blocks in Loop::Poll, from other threads.
+	//uses eventfd if available, otherwise pipe.
+	class Waker : public IoProcessor {
+		Fd rfd_, wfd_;
+	public:
+		Waker() : rfd_(INVALID_FD), wfd_(INVALID_FD) {}
+		inline Fd fd() const { return rfd_; }
+		inline int Open() {
+	#if defined(__linux__)
+			if ((rfd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+				return NQ_ESYSCALL;
+			}
+			wfd_ = rfd_;
+	#else
+			Fd fds[2];
+			if (::pipe(fds) != 0) {
+				return NQ_ESYSCALL;
+			}
+			for (auto fd : fds) {
+				::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+				::fcntl(fd, F_SETFD, FD_CLOEXEC);
+			}
+			rfd_ = fds[0];
+			wfd_ = fds[1];
+	#endif
+			return NQ_OK;
+		}
+		inline void Close() {
+			if (wfd_ != INVALID_FD && wfd_ != rfd_) {
+				Syscall::Close(wfd_);
+			}
+			if (rfd_ != INVALID_FD) {
+				Syscall::Close(rfd_);
+			}
+			rfd_ = wfd_ = INVALID_FD;
+		}
+		inline void Signal() {
+			uint64_t v = 1;
+			//EAGAIN means counter (or pipe) is already full, which is enough to wake up.
+			if (::write(wfd_, &v, sizeof(v)) < 0) {}
+		}
+	public: //IoProcessor
+		void OnEvent(Fd fd, const Event &e) override {
+			uint64_t buf[16];
+			while (::read(fd, buf, sizeof(buf)) > 0) {}
+		}
+		int OnOpen(Fd) override { return NQ_OK; }
+		void OnClose(Fd) override {}
+	};
 	class Loop : public LoopImpl, IoProcessor {
 		IoProcessor **processors_;
 		int max_nfd_;
 		LoopImpl::Timeout timeout_;
+		Waker waker_;
+		atomic<bool> waiting_;
 	public:
 		static const int kMinimumProcessorArraySize = 16;
 		typedef LoopImpl::Event Event;
-		Loop() : LoopImpl(), processors_(nullptr), max_nfd_(-1) {}
+		Loop() : LoopImpl(), processors_(nullptr), max_nfd_(-1), waker_(), waiting_(false) {}
 		~Loop() { Close(); }
 		template <class T> T *ProcessorAt(int fd) { return (T *)processors_[fd]; }
 		inline int Open(int max_nfd, uint64_t timeout_ns = 1000 * 1000) {
@@ -24,9 +81,17 @@ namespace nq {
 			ToTimeout(timeout_ns, timeout_);
 			processors_ = (IoProcessor**)std::malloc(sizeof(IoProcessor*) * max_nfd_);
 			memset(processors_, 0, sizeof(IoProcessor*) * max_nfd_);
-			return LoopImpl::Open(max_nfd_);
+			int r;
+			if ((r = LoopImpl::Open(max_nfd_)) < 0) {
+				return r;
+			}
+			if ((r = waker_.Open()) < 0) {
+				return r;
+			}
+			return Add(waker_.fd(), &waker_, EV_READ);
 		}
 		inline void Close() {
+			waker_.Close();
 			if (processors_ != nullptr) {
 				delete []processors_;
 		    processors_ = nullptr;
@@ -67,9 +132,37 @@ namespace nq {
 				return NQ_EGOAWAY; //already fd reused
 			}
 		}
-		inline void Poll() {
+		//thread safe. if loop thread is blocked in Poll after PrepareWait, wake it up.
+		//otherwise do nothing (no syscall), so it is cheap enough to call on every enqueue.
+		//should be called after the enqueue.
+		inline void Wakeup() {
+			//enqueue (release store to the queue) should not be reordered after load of waiting_.
+			//pairs with the fence in PrepareWait, so either this thread sees waiting_ == true, 
+			//or loop thread sees the enqueued item when it re-checks its queues.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiting_.load(std::memory_order_relaxed) && waiting_.exchange(false)) {
+				waker_.Signal();
+			}
+		}
+		//declare loop thread going to sleep. after calling this, loop thread should check 
+		//its cross thread queues are empty, then call Poll. 
+		//FYI(iyatomi): if queues are checked before calling this, wakeup by the thread which enqueues 
+		//just after the check, will be lost.
+		inline void PrepareWait() { 
+			waiting_.store(true, std::memory_order_relaxed); 
+			//store of waiting_ should not be reordered after loads of re-checking queues
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+		inline void Poll() { Poll(timeout_); }
+		inline void Poll(uint64_t timeout_ns) {
+			LoopImpl::Timeout to;
+			ToTimeout(timeout_ns, to);
+			Poll(to);
+		}
+		inline void Poll(LoopImpl::Timeout &to) {
 			Event list[max_nfd_];
-			int n_list = LoopImpl::Wait(list, max_nfd_, timeout_);
+			int n_list = LoopImpl::Wait(list, max_nfd_, to);
+			waiting_.store(false);
 			if (n_list <= 0) {
 				return;
 			}
@@ -70,7 +70,8 @@ namespace internal {
 		static inline bool Readable(const Event &e) { return e.events & EV_READ; }
 		static inline bool Writable(const Event &e) { return e.events & EV_WRITE; }
 		static inline bool Closed(const Event &e) { return e.events & EPOLLRDHUP; }
-		static inline void ToTimeout(uint64_t timeout_ns, Timeout &to) { to = (timeout_ns / (1000 * 1000)); }
+		//round up, not to wake up before given timeout and busy loop
+		static inline void ToTimeout(uint64_t timeout_ns, Timeout &to) { to = ((timeout_ns + (1000 * 1000) - 1) / (1000 * 1000)); }
 	private:
 		const Epoll &operator = (const Epoll &);
 	};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include "basis/defs.h"
+
+namespace nq {
+//single writer, multiple reader snapshot of trivially copyable value.
+//writer never blocks, reader retries while writer updates value.
+//used for publishing values which are updated by loop thread, to other threads.
+template <class T>
+class SeqLock {
+  STATIC_ASSERT(std::is_trivially_copyable<T>::value, "SeqLock value should be trivially copyable");
+  std::atomic<uint32_t> seq_;
+  T value_;
+ public:
+  SeqLock() : seq_(0) { memset(&value_, 0, sizeof(value_)); }
+  //only one thread can call Write at a time
+  inline void Write(const T &v) {
+    auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&value_, &v, sizeof(value_));
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+  //returns false if no value is written yet (v is filled with zero)
+  inline bool Read(T *v) const {
+    uint32_t seq;
+    do {
+      //odd sequence means writer is updating value
+      while ((seq = seq_.load(std::memory_order_acquire)) & 1) {}
+      memcpy(v, &value_, sizeof(value_));
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (seq != seq_.load(std::memory_order_relaxed));
+    return seq != 0;
+  }
+};
+}
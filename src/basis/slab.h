@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdlib>
+#include <mutex>
+
+#include "basis/defs.h"
+
+namespace nq {
+//fixed size block pool which can be allocated/freed from any thread without lock in most case.
+//each thread caches free blocks in its thread local list. when the list grows too long
+//(eg. thread which consumes cross-thread operation), blocks are moved to global depot by batch,
+//and thread which runs out its cache (eg. thread which produces cross-thread operation), takes a batch from depot.
+//memory once allocated is never returned to system.
+template <size_t kSize, size_t kBatchSize = 64>
+class SlabPool {
+  struct Block {
+    Block *next_;
+    //following are only valid for the head block of the batch in depot
+    Block *next_batch_;
+    size_t count_;
+  };
+  static const size_t kBlockSize = ((kSize < sizeof(Block) ? sizeof(Block) : kSize) + 15) & ~15;
+  struct Depot {
+    std::mutex mutex_;
+    Block *batches_;
+    Depot() : mutex_(), batches_(nullptr) {}
+    inline void Push(Block *head, size_t count) {
+      head->count_ = count;
+      std::unique_lock<std::mutex> lock(mutex_);
+      head->next_batch_ = batches_;
+      batches_ = head;
+    }
+    inline Block *Pop(size_t *count) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto head = batches_;
+      if (head != nullptr) {
+        batches_ = head->next_batch_;
+        *count = head->count_;
+      }
+      return head;
+    }
+  };
+  struct Cache {
+    Block *head_;
+    size_t count_;
+    Cache() : head_(nullptr), count_(0) {}
+    //return cached blocks to depot on thread exit
+    ~Cache() {
+      if (head_ != nullptr) {
+        depot().Push(head_, count_);
+      }
+    }
+    inline void Refill() {
+      head_ = depot().Pop(&count_);
+      if (head_ != nullptr) {
+        return;
+      }
+      auto slab = reinterpret_cast<char *>(std::malloc(kBlockSize * kBatchSize));
+      ASSERT(slab != nullptr);
+      for (size_t i = 0; i < kBatchSize; i++) {
+        auto b = reinterpret_cast<Block *>(slab + (i * kBlockSize));
+        b->next_ = head_;
+        head_ = b;
+      }
+      count_ = kBatchSize;
+    }
+    inline void Drain() {
+      //split first kBatchSize blocks and move them to depot
+      Block *head = head_, *tail = head_;
+      for (size_t i = 1; i < kBatchSize; i++) {
+        tail = tail->next_;
+      }
+      head_ = tail->next_;
+      count_ -= kBatchSize;
+      tail->next_ = nullptr;
+      depot().Push(head, kBatchSize);
+    }
+  };
+  static inline Depot &depot() {
+    //intentionally never destroyed, because thread local cache may be destroyed after static objects
+    static Depot *d = new Depot();
+    return *d;
+  }
+  static inline Cache &cache() {
+    static thread_local Cache c;
+    return c;
+  }
+ public:
+  static const size_t kMaxSize = kBlockSize;
+  static inline void *Alloc() {
+    auto &c = cache();
+    if (c.head_ == nullptr) {
+      c.Refill();
+    }
+    auto b = c.head_;
+    c.head_ = b->next_;
+    c.count_--;
+    return b;
+  }
+  static inline void Free(void *p) {
+    auto &c = cache();
+    auto b = reinterpret_cast<Block *>(p);
+    b->next_ = c.head_;
+    c.head_ = b;
+    c.count_++;
+    if (c.count_ >= (2 * kBatchSize)) {
+      c.Drain();
+    }
+  }
+};
+}
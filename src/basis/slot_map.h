@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "basis/defs.h"
+
+namespace nq {
+//dense generational slot map. values are stored in contiguous vector and indexed by slot index.
+//freed slot is reused by next Add (LIFO, for cache locality) with incremented generation, 
+//so pair of index and generation identifies value uniquely until generation of the slot wraps around (2^32 reuse).
+//add/find/remove are O(1) and never allocate memory unless the map grows. not thread safe.
+template <class V, typename INDEX = uint32_t>
+class SlotMap {
+  static const INDEX kEnd = (INDEX)-1;
+  struct Slot {
+    V value_;
+    uint32_t generation_; //never be 0, so that handle which has generation 0 is always invalid
+    INDEX next_free_;     //kEnd if slot is used or last free slot
+    bool used_;
+  };
+  std::vector<Slot> slots_;
+  INDEX free_head_;
+  size_t size_;
+ public:
+  SlotMap() : slots_(), free_head_(kEnd), size_(0) {}
+  inline size_t size() const { return size_; }
+  inline size_t capacity() const { return slots_.size(); }
+  //reserve slots for n values
+  inline void Reserve(size_t n) { slots_.reserve(n); }
+  inline INDEX Add(const V &v) {
+    INDEX idx;
+    if (free_head_ != kEnd) {
+      idx = free_head_;
+      free_head_ = slots_[idx].next_free_;
+    } else {
+      idx = (INDEX)slots_.size();
+      ASSERT(idx != kEnd);
+      slots_.push_back(Slot{V(), 1, kEnd, false});
+    }
+    auto &s = slots_[idx];
+    s.value_ = v;
+    s.next_free_ = kEnd;
+    s.used_ = true;
+    size_++;
+    return idx;
+  }
+  //returns false if idx is not used
+  inline bool Remove(INDEX idx) {
+    if (!Used(idx)) {
+      return false;
+    }
+    auto &s = slots_[idx];
+    s.value_ = V();
+    s.used_ = false;
+    if (++s.generation_ == 0) {
+      s.generation_ = 1;
+    }
+    s.next_free_ = free_head_;
+    free_head_ = idx;
+    size_--;
+    return true;
+  }
+  inline bool Used(INDEX idx) const {
+    return idx < slots_.size() && slots_[idx].used_;
+  }
+  //returns V() if idx is not used
+  inline V Find(INDEX idx) const {
+    return Used(idx) ? slots_[idx].value_ : V();
+  }
+  //returns V() if idx is not used or generation is different
+  inline V Find(INDEX idx, uint32_t generation) const {
+    return (Used(idx) && slots_[idx].generation_ == generation) ? slots_[idx].value_ : V();
+  }
+  //current generation of the slot. valid only while idx is used
+  inline uint32_t Generation(INDEX idx) const {
+    ASSERT(Used(idx));
+    return slots_[idx].generation_;
+  }
+  //f(INDEX, V) is called for each used slot. f can add/remove any value.
+  template <class F>
+  inline void Iter(F f) {
+    for (size_t i = 0; i < slots_.size(); i++) {
+      if (slots_[i].used_) {
+        V v = slots_[i].value_;
+        f((INDEX)i, v);
+      }
+    }
+  }
+  //remove all values. generations are kept, so handles issued before, are still detected as invalid.
+  inline void Clear() {
+    for (size_t i = 0; i < slots_.size(); i++) {
+      Remove((INDEX)i);
+    }
+  }
+};
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "basis/defs.h"
+
+namespace nq {
+//hierarchical timing wheel with intrusive node.
+//set/cancel/update are O(1) and never allocate memory.
+//resolution is 1 tick (1024us). deadline is never fired before it passes,
+//and node which is due but within current tick, is checked one by one.
+class TimerWheel {
+ public:
+  static const int kTickShift = 10; //1 tick = 1024 usec
+  static const int kSlotBits = 8;
+  static const int kSlotSize = 1 << kSlotBits;
+  static const int kSlotMask = kSlotSize - 1;
+  static const int kLevel = 4; //covers 2^32 tick (about 50 days). more far deadline is cascaded again
+  static const uint16_t kFireList = kLevel * kSlotSize;
+  static const uint64_t kNoDeadline = (uint64_t)-1;
+
+  class Node {
+   protected:
+    friend class TimerWheel;
+    Node *next_, **pprev_;
+    uint64_t deadline_us_;
+    uint16_t slot_;
+   public:
+    Node() : next_(nullptr), pprev_(nullptr), deadline_us_(0), slot_(0) {}
+    inline bool linked() const { return pprev_ != nullptr; }
+    inline uint64_t deadline_us() const { return deadline_us_; }
+  };
+
+ public:
+  TimerWheel() : current_tick_(0), count_(0), fire_list_(nullptr) {
+    memset(slots_, 0, sizeof(slots_));
+    memset(bitmap_, 0, sizeof(bitmap_));
+  }
+  inline void Init(uint64_t now_us) { current_tick_ = now_us >> kTickShift; }
+  inline size_t size() const { return count_; }
+
+  //register node to fire at deadline_us. if already registered, just change deadline.
+  inline void Set(Node *n, uint64_t deadline_us) {
+    if (n->linked()) {
+      Unlink(n);
+    } else {
+      count_++;
+    }
+    n->deadline_us_ = deadline_us;
+    Insert(n);
+  }
+  //unregister node. no effect for the node not registered.
+  inline void Cancel(Node *n) {
+    if (n->linked()) {
+      Unlink(n);
+      count_--;
+    }
+  }
+  //call f(Node *) for each node which deadline passed.
+  //node is unregistered before f is called, so f can freely set/cancel/delete any node
+  //including itself. node which is newly set in f, is checked no earlier than processing of next tick, 
+  //so f which keeps on re-setting node to passed deadline, never causes infinite loop.
+  template <class F>
+  void Expire(uint64_t now_us, F f) {
+    uint64_t now_tick = now_us >> kTickShift;
+    if (count_ == 0) {
+      if (now_tick > current_tick_) {
+        current_tick_ = now_tick;
+      }
+      return;
+    }
+    //nodes are moved to fire list before calling f, because f may change the wheel.
+    //FYI(iyatomi): drain after current_tick_ is advanced, otherwise the node which is set 
+    //to already passed deadline in f, is put into the slot already processed and fires 1 round later.
+    while (current_tick_ < now_tick) {
+      if (count_ == 0) {
+        current_tick_ = now_tick;
+        return;
+      }
+      //skip empty slots until next non-empty slot or next cascade
+      int cur = current_tick_ & kSlotMask;
+      int idx = FindSlot(0, cur);
+      uint64_t next_tick;
+      if (idx < 0) {
+        //level 0 is empty. jump to the tick when next upper level cascade happens
+        next_tick = NextDeadline() >> kTickShift;
+      } else {
+        next_tick = (idx >= cur) ? (current_tick_ + (idx - cur)) : ((current_tick_ | kSlotMask) + 1);
+      }
+      if (next_tick > now_tick) {
+        next_tick = now_tick;
+      }
+      if (next_tick > current_tick_) {
+        current_tick_ = next_tick;
+        Cascade();
+        continue;
+      }
+      MoveToFireList(cur, kNoDeadline);
+      current_tick_++;
+      Cascade();
+      DrainFireList(f);
+    }
+    MoveToFireList(current_tick_ & kSlotMask, now_us);
+    DrainFireList(f);
+  }
+  //returns earliest deadline or kNoDeadline if no node is registered.
+  //if some node is in upper level wheel, may return earlier value than actual deadline
+  //(the time when the node is cascaded), but never returns later value.
+  uint64_t NextDeadline() const {
+    if (fire_list_ != nullptr) {
+      return 0;
+    }
+    if (count_ == 0) {
+      return kNoDeadline;
+    }
+    uint64_t next = kNoDeadline;
+    for (int lv = 0; lv < kLevel; lv++) {
+      int shift = lv * kSlotBits;
+      int cur = (current_tick_ >> shift) & kSlotMask;
+      //upper level slot of current index holds nodes for next round. so search it at last
+      int idx = FindSlot(lv, lv == 0 ? cur : ((cur + 1) & kSlotMask));
+      if (idx < 0) {
+        continue;
+      }
+      uint64_t candidate;
+      if (lv == 0) {
+        candidate = kNoDeadline;
+        for (Node *n = slots_[lv][idx]; n != nullptr; n = n->next_) {
+          if (n->deadline_us_ < candidate) { candidate = n->deadline_us_; }
+        }
+      } else {
+        //time when the slot is cascaded
+        uint64_t diff = (idx > cur) ? (idx - cur) : (idx + kSlotSize - cur);
+        candidate = (((current_tick_ >> shift) + diff) << shift) << kTickShift;
+      }
+      if (candidate < next) {
+        next = candidate;
+      }
+    }
+    return next;
+  }
+
+ protected:
+  inline void Insert(Node *n) {
+    uint64_t tick = n->deadline_us_ >> kTickShift;
+    if (tick < current_tick_) {
+      tick = current_tick_;
+    }
+    uint64_t diff = tick - current_tick_;
+    int lv = 0;
+    while (lv < (kLevel - 1) && diff >= (1ULL << ((lv + 1) * kSlotBits))) {
+      lv++;
+    }
+    int idx;
+    if (lv == (kLevel - 1) && diff >= (1ULL << (kLevel * kSlotBits))) {
+      //too far. put the slot cascaded last, then re-inserted
+      idx = ((current_tick_ >> (lv * kSlotBits)) - 1) & kSlotMask;
+    } else {
+      idx = (tick >> (lv * kSlotBits)) & kSlotMask;
+    }
+    Link(n, lv * kSlotSize + idx);
+  }
+  inline Node **Head(uint16_t slot) {
+    return slot == kFireList ? &fire_list_ : &slots_[slot >> kSlotBits][slot & kSlotMask];
+  }
+  inline void Link(Node *n, uint16_t slot) {
+    auto head = Head(slot);
+    n->slot_ = slot;
+    n->next_ = *head;
+    if (n->next_ != nullptr) {
+      n->next_->pprev_ = &n->next_;
+    }
+    *head = n;
+    n->pprev_ = head;
+    if (slot != kFireList) {
+      bitmap_[slot >> kSlotBits][(slot & kSlotMask) >> 6] |= (1ULL << (slot & 63));
+    }
+  }
+  inline void Unlink(Node *n) {
+    *(n->pprev_) = n->next_;
+    if (n->next_ != nullptr) {
+      n->next_->pprev_ = n->pprev_;
+    }
+    n->next_ = nullptr;
+    n->pprev_ = nullptr;
+    auto slot = n->slot_;
+    if (slot != kFireList && *Head(slot) == nullptr) {
+      bitmap_[slot >> kSlotBits][(slot & kSlotMask) >> 6] &= ~(1ULL << (slot & 63));
+    }
+  }
+  template <class F>
+  inline void DrainFireList(F &f) {
+    Node *n;
+    while ((n = fire_list_) != nullptr) {
+      Unlink(n);
+      count_--;
+      f(n);
+    }
+  }
+  //move nodes which deadline <= limit_us, in the slot of level 0 to fire list
+  inline void MoveToFireList(int idx, uint64_t limit_us) {
+    Node *n = slots_[0][idx], *next;
+    for (; n != nullptr; n = next) {
+      next = n->next_;
+      if (n->deadline_us_ <= limit_us) {
+        Unlink(n);
+        Link(n, kFireList);
+      }
+    }
+  }
+  //called when current_tick_ is advanced.
+  //if lower level wheel goes around, re-insert nodes in corresponding upper level slot.
+  inline void Cascade() {
+    for (int lv = 1; lv < kLevel; lv++) {
+      int shift = lv * kSlotBits;
+      if ((current_tick_ & ((1ULL << shift) - 1)) != 0) {
+        break;
+      }
+      int idx = (current_tick_ >> shift) & kSlotMask;
+      Node *n = slots_[lv][idx], *next;
+      for (; n != nullptr; n = next) {
+        next = n->next_;
+        Unlink(n);
+        Insert(n);
+      }
+    }
+  }
+  //find first non-empty slot of level lv, from index start (inclusive, wrapped around)
+  inline int FindSlot(int lv, int start) const {
+    const int kWords = kSlotSize / 64;
+    int w0 = start >> 6;
+    uint64_t bits = bitmap_[lv][w0] & (~0ULL << (start & 63));
+    if (bits != 0) {
+      return (w0 << 6) + __builtin_ctzll(bits);
+    }
+    for (int k = 1; k < kWords; k++) {
+      int w = (w0 + k) % kWords;
+      if (bitmap_[lv][w] != 0) {
+        return (w << 6) + __builtin_ctzll(bitmap_[lv][w]);
+      }
+    }
+    bits = bitmap_[lv][w0] & ~(~0ULL << (start & 63));
+    if (bits != 0) {
+      return (w0 << 6) + __builtin_ctzll(bits);
+    }
+    return -1;
+  }
+
+ protected:
+  uint64_t current_tick_; //every tick before current_tick_ is already processed
+  size_t count_;
+  Node *slots_[kLevel][kSlotSize];
+  uint64_t bitmap_[kLevel][kSlotSize / 64];
+  Node *fire_list_;
+};
+}
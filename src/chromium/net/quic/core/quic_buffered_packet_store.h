@@ -132,6 +132,9 @@ class QUIC_EXPORT_PRIVATE QuicBufferedPacketStore {
   // Is there any CHLO buffered in the store?
   bool HasChlosBuffered() const;
 
+  // number of connections which CHLO is buffered
+  inline size_t NumChlosBuffered() const { return connections_with_chlo_.size(); }
+
   // set connection life span
   inline void SetConnectionLifeSpan(const QuicTime::Delta &span) { connection_life_span_ = span; }
 
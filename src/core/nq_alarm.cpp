@@ -38,7 +38,7 @@ void NqAlarm::OnFire(NqLoop *loop) {
   //ClearInvocationTS();
 }
 void NqAlarm::Exec() {
-  //here, alarm is already unregistered from NqLoop::alarm_map_
+  //here, alarm is already unregistered from NqLoop::timer_wheel_
   NqLoop *loop = boxer_->Loop();
   nq_time_t invoke = invocation_ts_;
   nq_time_t next = invoke;
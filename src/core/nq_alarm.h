@@ -10,16 +10,12 @@
 
 namespace net {
 class NqBoxer;
-class NqAlarmInterface {
+class NqAlarmInterface : public nq::TimerWheel::Node {
  public:
   virtual ~NqAlarmInterface() {}
-  //return false if it calls NqLoop::CancelAlarm internally, 
-  //true otherwise, then system automatically remove this interface from NqLoop::alarm_map_
-
-  //CAUTION: its generally unsafe that call NqLoop::CancelAlarm directly in OnFire callback,
-  //because it may change ieterator state of NqLoop::alarm_map_ unpredictable way, as you can see at NqLoop::Poll
-  //but operation to nq_alarm_t is safe because it does such operation by queueing it to NqBoxer::Processor. 
-  //so if you want to operate alarm directly in OnFire, please add similar task to NqBoxer's Operation and InvokeXXXX function, then use it.
+  //called after this alarm is unregistered from NqLoop's timer wheel.
+  //so it is safe to call NqLoop::SetAlarm/CancelAlarm for any alarm (including this) in OnFire.
+  //alarm which is set in OnFire, fires no earlier than next tick of the wheel.
   virtual void OnFire(NqLoop *) = 0;
   virtual bool IsNonQuicAlarm() const = 0;
 };
@@ -27,8 +23,10 @@ class NqQuicAlarm : public QuicAlarm,
                     public NqAlarmInterface {
  public:
   NqQuicAlarm(NqLoop *loop, QuicArenaScopedPtr<Delegate> delegate)
-      : QuicAlarm(std::move(delegate)), loop_(loop), timeout_in_us_(0) {}
-  ~NqQuicAlarm() override {}
+      : QuicAlarm(std::move(delegate)), loop_(loop) {}
+  ~NqQuicAlarm() override {
+    if (linked()) { loop_->CancelAlarm(this); }
+  }
 
   //implements NqAlarmInterface
   void OnFire(NqLoop *) override { Fire(); }
@@ -38,22 +36,20 @@ class NqQuicAlarm : public QuicAlarm,
   //implements QuicAlarm
   void SetImpl() override {
     DCHECK(deadline().IsInitialized());
-    timeout_in_us_ = (deadline() - QuicTime::Zero()).ToMicroseconds();
-    loop_->SetAlarm(this, timeout_in_us_);
+    loop_->SetAlarm(this, (deadline() - QuicTime::Zero()).ToMicroseconds());
   }
 
   void CancelImpl() override {
     DCHECK(!deadline().IsInitialized());
-    if (timeout_in_us_ <= 0) {
-      return; //not registered
-    }
-    loop_->CancelAlarm(this, timeout_in_us_);
+    loop_->CancelAlarm(this);
+  }
+  //re-link in the wheel directly, instead of default Cancel + Set
+  void UpdateImpl() override {
+    DCHECK(deadline().IsInitialized());
+    loop_->SetAlarm(this, (deadline() - QuicTime::Zero()).ToMicroseconds());
   }
-  //TODO(iyatomi): there is a way to optimize update?
-  //void UpdateImpl() override;
 
   NqLoop* loop_;
-  uint64_t timeout_in_us_;
 };
 class NqAlarmBase : public NqAlarmInterface {
  protected:
@@ -73,10 +69,8 @@ class NqAlarmBase : public NqAlarmInterface {
     loop->SetAlarm(this, nq::clock::to_us(invocation_ts_));
   }
   void Stop(NqLoop *loop) {
-    if (invocation_ts_ != 0) {
-      loop->CancelAlarm(this, nq::clock::to_us(invocation_ts_));
-      invocation_ts_ = 0;
-    }
+    loop->CancelAlarm(this);
+    invocation_ts_ = 0;
   }
   void Destroy(NqLoop *loop) {
     Stop(loop);
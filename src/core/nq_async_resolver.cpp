@@ -65,8 +65,7 @@ bool NqAsyncResolver::Initialize(const Config &config) {
   int status = ares_init_options(&channel_, 
     const_cast<ares_options *>(config.options()), config.optmask);
   if(status != ARES_SUCCESS) {
-    nq::logger::error({
-      {"msg", "fail ares_init_options"},
+    nq::logger::error("fail ares_init_options", {
       {"error", ares_strerror(status)}
     });
     return false;
@@ -80,6 +80,8 @@ class NqAsyncResolver {
   NqAsyncResolver() : channel_(nullptr), io_requests_() {}
   bool Initialize(const Config &config);
   void StartResolve(Query *q) { q->resolver_ = this; queries_.push_back(q); }
+  //true if no query is waiting or in flight
+  inline bool idle() const { return queries_.empty() && io_requests_.empty(); }
   void Resolve(const char *host, int family, Callback cb, void *arg);
   void Poll(NqLoop *l);
   static inline int PtoN(const std::string &host, int *af, void *buff) {
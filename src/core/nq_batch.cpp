@@ -0,0 +1,27 @@
+#include "core/nq_batch.h"
+
+namespace net {
+void NqBatch::Submit() {
+  for (auto &q : queues_) {
+    auto &ops = q.second;
+    if (ops.size() <= 0) {
+      continue;
+    }
+    if (q.first->MainThread()) {
+      //on the thread which owns the loop, process immediately as non-batched API does
+      NqBoxer::Processor::Process(q.first, ops.data(), ops.size());
+    } else {
+      q.first->EnqueueBulk(ops.data(), ops.size());
+    }
+    ops.clear();
+  }
+}
+void NqBatch::Clear() {
+  for (auto &q : queues_) {
+    for (auto op : q.second) {
+      delete op;
+    }
+    q.second.clear();
+  }
+}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "nq.h"
+#include "core/nq_boxer.h"
+
+namespace net {
+//accumulates cross-thread operations and submits them to each loop with single bulk enqueue.
+//not thread safe. should be used from only one thread at a time.
+class NqBatch {
+  //almost case, batch only targets a few loops. so linear scan of vector should be enough
+  std::vector<std::pair<NqBoxer*, std::vector<NqBoxer::Op*>>> queues_;
+ public:
+  NqBatch() : queues_() {}
+  ~NqBatch() { Clear(); }
+  void Add(NqBoxer *b, NqBoxer::Op *op) {
+    for (auto &q : queues_) {
+      if (q.first == b) {
+        q.second.push_back(op);
+        return;
+      }
+    }
+    queues_.emplace_back(b, std::vector<NqBoxer::Op*>());
+    queues_.back().second.push_back(op);
+  }
+  //submit all operations. batch is reusable after submit, and keeps its buffer for next use.
+  void Submit();
+  //discard all operations which are not submitted yet
+  void Clear();
+
+  inline nq_batch_t ToHandle() { return (nq_batch_t)this; }
+  static inline NqBatch *FromHandle(nq_batch_t b) { return (NqBatch *)b; }
+};
+}
@@ -1,18 +1,132 @@
 #include "core/nq_boxer.h"
+
+#include "basis/slab.h"
+#include "core/nq_client_loop.h"
+#include "core/nq_group.h"
 #include "core/nq_unwrapper.h"
 
 namespace net {
-void NqBoxer::Processor::Poll(NqBoxer *p) {
-  Op *op;
-  while (try_dequeue(op)) {
+typedef nq::SlabPool<sizeof(NqBoxer::Op)> OpPool;
+typedef nq::SlabPool<128> SmallPayloadPool;
+typedef nq::SlabPool<1024> MediumPayloadPool;
+typedef nq::SlabPool<8192, 16> LargePayloadPool;
+
+NqBoxer::Op::~Op() {
+  if (target_ == OpTarget::Group) {
+    multicast_.shard_->Unref();
+    multicast_.frame_->Unref();
+  }
+}
+void *NqBoxer::Op::operator new(std::size_t sz) {
+  ASSERT(sz == sizeof(Op));
+  return OpPool::Alloc();
+}
+void NqBoxer::Op::operator delete(void *p) noexcept {
+  OpPool::Free(p);
+}
+/* static */
+void *NqBoxer::Op::Data::Alloc(nq_size_t len) {
+  if (len <= SmallPayloadPool::kMaxSize) {
+    return SmallPayloadPool::Alloc();
+  } else if (len <= MediumPayloadPool::kMaxSize) {
+    return MediumPayloadPool::Alloc();
+  } else if (len <= LargePayloadPool::kMaxSize) {
+    return LargePayloadPool::Alloc();
+  } else {
+    return nq::Syscall::MemAlloc(len);
+  }
+}
+/* static */
+void NqBoxer::Op::Data::Free(void *p, nq_size_t len) {
+  if (len <= SmallPayloadPool::kMaxSize) {
+    SmallPayloadPool::Free(p);
+  } else if (len <= MediumPayloadPool::kMaxSize) {
+    MediumPayloadPool::Free(p);
+  } else if (len <= LargePayloadPool::kMaxSize) {
+    LargePayloadPool::Free(p);
+  } else {
+    nq::Syscall::MemFree(p);
+  }
+}
+//keeps ScopedPacketBundler while consecutive ops send data to the same connection
+class OpBundler {
+  QuicConnection *connection_;
+  base::ManualConstructor<QuicConnection::ScopedPacketBundler> bundler_;
+ public:
+  OpBundler() : connection_(nullptr) {}
+  ~OpBundler() { Reset(); }
+  inline void Switch(QuicConnection *c) {
+    if (connection_ != c) {
+      Reset();
+      bundler_.Init(c, QuicConnection::SEND_ACK_IF_QUEUED);
+      connection_ = c;
+    }
+  }
+  inline void Reset() {
+    if (connection_ != nullptr) {
+      bundler_.Destroy();
+      connection_ = nullptr;
+    }
+  }
+};
+static inline bool IsSendOp(const NqBoxer::Op *op) {
+  if (op->target_ != NqBoxer::OpTarget::Stream) {
+    return false;
+  }
+  switch (op->code_) {
+  case NqBoxer::Send:
+  case NqBoxer::SendEx:
+  case NqBoxer::Call:
+  case NqBoxer::CallEx:
+  case NqBoxer::Notify:
+  case NqBoxer::Reply:
+    return true;
+  default:
+    return false;
+  }
+}
+
+size_t NqBoxer::Processor::Poll(NqBoxer *p) {
+  Op *ops[kDequeueBatchSize];
+  size_t n_ops, n_processed = 0;
+  while ((n_ops = try_dequeue_bulk(ops, kDequeueBatchSize)) > 0) {
+    Process(p, ops, n_ops);
+    n_processed += n_ops;
+  }
+  return n_processed;
+}
+size_t NqBoxer::Processor::Discard() {
+  Op *ops[kDequeueBatchSize];
+  size_t n_ops, n_discarded = 0;
+  while ((n_ops = try_dequeue_bulk(ops, kDequeueBatchSize)) > 0) {
+    for (size_t i = 0; i < n_ops; i++) {
+      //query is owned by op until it is passed to resolver. other targets are owned by loop
+      if (ops[i]->target_ == Query) {
+        delete reinterpret_cast<NqAsyncResolver::Query *>(ops[i]->target_ptr_);
+      }
+      delete ops[i];
+    }
+    n_discarded += n_ops;
+  }
+  return n_discarded;
+}
+/* static */
+void NqBoxer::Processor::Process(NqBoxer *p, Op **ops, size_t n_ops) {
+  OpBundler bundler;
+  for (size_t i = 0; i < n_ops; i++) {
+    Op *op = ops[i];
+    if (IsSendOp(op)) {
+      auto s = reinterpret_cast<NqStream *>(op->target_ptr_);
+      if (s->stream_serial() == op->serial_) {
+        bundler.Switch(s->nq_session()->connection());
+      }
+    } else {
+      //other ops may close connection, so flush bundled packets before
+      bundler.Reset();
+    }
     switch (op->target_) {
     case Conn: {
       auto c = reinterpret_cast<NqSession::Delegate *>(op->target_ptr_);
-#if defined(USE_DIRECT_WRITE)
-      auto m = NqUnwrapper::UnsafeUnwrapMutex(NqConnSerialCodec::IsClient(op->serial_), c);
-      std::unique_lock<std::mutex> lock(*m);
-      p->LockSession(c->SessionIndex());
-#endif
       switch (op->code_) {
       case OpenStream:
         p->InvokeConn(op->serial_, c, op->code_, op->stream_.name_, op->stream_.ctx_, true);
@@ -27,17 +141,8 @@ void NqBoxer::Processor::Poll(NqBoxer *p) {
         p->InvokeConn(op->serial_, c, op->code_, true);
         break;
       }
-#if defined(USE_DIRECT_WRITE)
-      p->UnlockSession();
-#endif
     } break;
     case Stream: {
-#if defined(USE_DIRECT_WRITE)
-      auto c = reinterpret_cast<NqSession::Delegate *>(op->target_ptr_);
-      auto m = NqUnwrapper::UnsafeUnwrapMutex(NqStreamSerialCodec::IsClient(op->serial_), c);
-      std::unique_lock<std::mutex> lock(*m);
-      p->LockSession(c->SessionIndex());
-#endif
       auto s = reinterpret_cast<NqStream *>(op->target_ptr_);
       switch (op->code_) {
       case Disconnect:
@@ -56,11 +161,11 @@ void NqBoxer::Processor::Poll(NqBoxer *p) {
         break;
       case Call:
         p->InvokeStream(op->serial_, s, op->code_, op->call_.type_, 
-                        op->data_.ptr(), op->data_.length(), op->call_.on_reply_, true);
+                        op->data_.ptr(), op->data_.length(), op->call_.on_reply_, true, op->call_.call_ts_);
         break;
       case CallEx:
         p->InvokeStream(op->serial_, s, op->code_, op->call_ex_.type_, 
-                        op->data_.ptr(), op->data_.length(), op->call_ex_.rpc_opt_, true);
+                        op->data_.ptr(), op->data_.length(), op->call_ex_.rpc_opt_, true, op->call_ex_.call_ts_);
         break;
       case Notify:
         p->InvokeStream(op->serial_, s, op->code_, op->notify_.type_, 
@@ -74,9 +179,16 @@ void NqBoxer::Processor::Poll(NqBoxer *p) {
         ASSERT(false);
         break;
       }
-#if defined(USE_WRITE_OP)
-      p->UnlockSession();
-#endif
+    } break;
+    case Group: {
+      ASSERT(op->code_ == Multicast);
+      op->multicast_.shard_->Deliver(*op->multicast_.frame_);
+    } break;
+    case Query: {
+      //only client loop resolves host for connecting
+      ASSERT(op->code_ == Connect && p->IsClient());
+      auto q = reinterpret_cast<NqAsyncResolver::Query *>(op->target_ptr_);
+      static_cast<NqClientLoop *>(p)->async_resolver().StartResolve(q);
     } break;
     case Alarm: {
       auto a = reinterpret_cast<NqAlarm *>(op->target_ptr_);
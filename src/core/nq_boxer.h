@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include <string>
 
 #include "MoodyCamel/concurrentqueue.h"
@@ -12,10 +13,9 @@
 #include "core/nq_alarm.h"
 #include "core/nq_serial_codec.h"
 
-//#define USE_DIRECT_WRITE (1)
-
 namespace net {
 class NqLoop;
+class NqGroupShard;
 class NqBoxer {
  public:
   enum UnboxResult {
@@ -42,12 +42,17 @@ class NqBoxer {
     Exec,
     Reachability,
     ModifyHandlerMap,
+    Multicast,
+    Connect,
+    PublishStats,
   };
   enum OpTarget : uint8_t {
     Invalid = 0,
     Conn = 1,
     Stream = 2,
     Alarm = 3,
+    Group = 4,
+    Query = 5,  //target_ptr_ is NqAsyncResolver::Query
   };
   struct Op {
     nq_serial_t serial_;
@@ -58,28 +63,47 @@ class NqBoxer {
     struct Data {
       const void *p_;
       nq_size_t len_;
-      Data() { len_ = 0; }
+      nq_on_buffer_free_t on_free_; //not empty if p_ is owned by caller
+      Data() : p_(nullptr), len_(0) { on_free_ = nq_closure_empty(); }
       Data(const void *p, nq_size_t len) {
+        on_free_ = nq_closure_empty();
         if (len <= 0) {
           p_ = p; len_ = len; //if p is not byte array, assume memory is managed by caller
         } else {
-          ASSERT(len <= 10000);
-          //TODO(iyatomi): allocation from some pool
-          p_ = nq::Syscall::Memdup(p, len); len_ = len;
+          void *copy = Alloc(len);
+          memcpy(copy, p, len);
+          p_ = copy; len_ = len;
+        }
+      }
+      //take over p without copy. on_free is called when op is processed or discarded
+      Data(void *p, nq_size_t len, nq_on_buffer_free_t on_free) : p_(p), len_(len), on_free_(on_free) {}
+      Data(Data &&d) : p_(d.p_), len_(d.len_), on_free_(d.on_free_) {
+        d.len_ = 0;
+        d.on_free_ = nq_closure_empty();
+      }
+      ~Data() {
+        if (!nq_closure_is_empty(on_free_)) {
+          nq_closure_call(on_free_, const_cast<void *>(p_), len_);
+        } else if (len_ > 0) { 
+          Free(const_cast<void *>(p_), len_);
         }
       }
-      ~Data() { if (len_ > 0) { nq::Syscall::MemFree(const_cast<void *>(p_)); } }
       inline const void *ptr() const { return p_; }
       inline nq_size_t length() const { return len_; } 
+      //payload buffer is taken from size classed pool, or malloc'ed if its larger than biggest class
+      static void *Alloc(nq_size_t len);
+      static void Free(void *p, nq_size_t len);
     } data_;
     union {
       struct {
         nq_on_rpc_reply_t on_reply_;
         uint16_t type_;
+        nq_time_t call_ts_; //for measuring rpc latency including queueing
       } call_;
       struct {
         nq_rpc_opt_t rpc_opt_;
         uint16_t type_;
+        nq_time_t call_ts_;
       } call_ex_;
       struct {
         nq_stream_opt_t stream_opt_;
@@ -105,6 +129,10 @@ class NqBoxer {
       struct {
         nq_reachability_t state_;
       } reachability_;
+      struct {
+        NqGroupShard *shard_;
+        NqSharedFrame *frame_;
+      } multicast_;
     };
     Op(const nq_serial_t &serial, void *target_ptr, OpCode code, OpTarget target) : 
       serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_() {}
@@ -136,54 +164,74 @@ class NqBoxer {
       reachability_.state_ = state;
     }
 
-    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, const void *data, nq_size_t datalen, 
+    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, Data &&data, 
        OpTarget target = OpTarget::Stream) : 
-      serial_(serial), code_(code), target_(target), data_(data, datalen) {}
+      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(std::move(data)) {}
     
-    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, const void *data, nq_size_t datalen,
+    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, Data &&data,
        const nq_stream_opt_t &opt, OpTarget target = OpTarget::Stream) : 
-      serial_(serial), code_(code), target_(target), data_(data, datalen) {
+      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(std::move(data)) {
       send_ex_.stream_opt_ = opt;
     }
     
-    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, uint16_t type, const void *data, 
-       nq_size_t datalen, nq_on_rpc_reply_t on_reply, 
+    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, uint16_t type, Data &&data, 
+       nq_on_rpc_reply_t on_reply, 
        OpTarget target = OpTarget::Stream) :
-      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(data, datalen) {
+      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(std::move(data)) {
       call_.type_ = type;
       call_.on_reply_ = on_reply;
+      call_.call_ts_ = nq_time_now();
     }
     
-    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, uint16_t type, const void *data, 
-       nq_size_t datalen, const nq_rpc_opt_t &rpc_opt, 
+    Op(const nq_serial_t &serial, void *target_ptr, OpCode code, uint16_t type, Data &&data, 
+       const nq_rpc_opt_t &rpc_opt, 
        OpTarget target = OpTarget::Stream) :
-      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(data, datalen) {
+      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(std::move(data)) {
       call_ex_.type_ = type;
       call_ex_.rpc_opt_ = rpc_opt;
+      call_ex_.call_ts_ = nq_time_now();
     }
     
     Op(const nq_serial_t &serial, void *target_ptr, OpCode code, uint16_t type, 
-       const void *data, nq_size_t datalen, OpTarget target = OpTarget::Stream) : 
-      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(data, datalen) {
+       Data &&data, OpTarget target = OpTarget::Stream) : 
+      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(std::move(data)) {
       notify_.type_ = type;
     }
     
     Op(const nq_serial_t &serial, void *target_ptr, OpCode code, 
        nq_error_t result, nq_msgid_t msgid, 
-       const void *data, nq_size_t datalen, OpTarget target = OpTarget::Stream) :
-      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(data, datalen) {
+       Data &&data, OpTarget target = OpTarget::Stream) :
+      serial_(serial), target_ptr_(target_ptr), code_(code), target_(target), data_(std::move(data)) {
       reply_.result_ = result;
       reply_.msgid_ = msgid;
     }
-    ~Op() {}
+    //references of shard and frame are moved to op
+    Op(NqGroupShard *shard, NqSharedFrame *frame) : 
+      serial_(), target_ptr_(nullptr), code_(Multicast), target_(OpTarget::Group), data_() {
+      multicast_.shard_ = shard;
+      multicast_.frame_ = frame;
+    }
+    ~Op();
+
+    //ops are allocated by user thread and freed by loop thread, so use thread cached pool
+    void* operator new(std::size_t sz);
+    void operator delete(void *p) noexcept;
   };
   class Processor : public moodycamel::ConcurrentQueue<Op*> {
   public:
-    void Poll(NqBoxer *p);
+    //max number of ops dequeued at once
+    static const size_t kDequeueBatchSize = 64;
+    //returns number of processed ops
+    size_t Poll(NqBoxer *p);
+    //process ops and delete them. consecutive sends to the same connection are bundled into packets at once.
+    static void Process(NqBoxer *p, Op **ops, size_t n_ops);
+    //delete queued ops without processing them, on closing owner. returns number of deleted ops
+    size_t Discard();
   };
 
   //interfaces
   virtual void Enqueue(Op *op) = 0;
+  virtual void EnqueueBulk(Op **ops, size_t n_ops) = 0;
   virtual bool MainThread() const = 0;
   virtual NqLoop *Loop() = 0;
   virtual NqAlarm *NewAlarm() = 0;
@@ -216,6 +264,9 @@ class NqBoxer {
         case Flush: {
           QuicConnection::ScopedPacketBundler bundler(unboxed->Connection(), QuicConnection::SEND_ACK_IF_QUEUED);
         } break;
+        case PublishStats:
+          unboxed->PublishStats();
+          break;
         default:
           ASSERT(false);
           return;
@@ -336,7 +387,7 @@ class NqBoxer {
         unboxed->Handler<NqStreamHandler>()->Send(data, datalen);
       }
     } else {
-      Enqueue(new Op(serial, unboxed, code, data, datalen));
+      Enqueue(new Op(serial, unboxed, code, Op::Data(data, datalen)));
     }
   }
   inline void InvokeStream(const nq_serial_t &serial, NqStream *unboxed, OpCode code, 
@@ -348,31 +399,33 @@ class NqBoxer {
         unboxed->Handler<NqStreamHandler>()->SendEx(data, datalen, stream_opt);
       }
     } else {
-      Enqueue(new Op(serial, unboxed, code, data, datalen, stream_opt));
+      Enqueue(new Op(serial, unboxed, code, Op::Data(data, datalen), stream_opt));
     }
   }
   inline void InvokeStream(const nq_serial_t &serial, NqStream *unboxed, OpCode code,
                            uint16_t type, const void *data, 
-                           nq_size_t datalen, nq_on_rpc_reply_t on_reply, bool from_queue = false) {
+                           nq_size_t datalen, nq_on_rpc_reply_t on_reply, bool from_queue = false,
+                           nq_time_t call_ts = 0) {
     if (from_queue) {
       if (unboxed->stream_serial() == serial) {
         ASSERT(code == Call);
-        unboxed->Handler<NqSimpleRPCStreamHandler>()->Call(type, data, datalen, on_reply);
+        unboxed->Handler<NqSimpleRPCStreamHandler>()->Call(type, data, datalen, on_reply, call_ts);
       }
     } else {
-      Enqueue(new Op(serial, unboxed, code, type, data, datalen, on_reply));
+      Enqueue(new Op(serial, unboxed, code, type, Op::Data(data, datalen), on_reply));
     }
   }
   inline void InvokeStream(const nq_serial_t &serial, NqStream *unboxed, OpCode code, 
                            uint16_t type, const void *data, 
-                           nq_size_t datalen, nq_rpc_opt_t &rpc_opt, bool from_queue = false) {
+                           nq_size_t datalen, nq_rpc_opt_t &rpc_opt, bool from_queue = false,
+                           nq_time_t call_ts = 0) {
     if (from_queue) {
       if (unboxed->stream_serial() == serial) {
         ASSERT(code == CallEx);
-        unboxed->Handler<NqSimpleRPCStreamHandler>()->CallEx(type, data, datalen, rpc_opt);
+        unboxed->Handler<NqSimpleRPCStreamHandler>()->CallEx(type, data, datalen, rpc_opt, call_ts);
       }
     } else {
-      Enqueue(new Op(serial, unboxed, code, type, data, datalen, rpc_opt));
+      Enqueue(new Op(serial, unboxed, code, type, Op::Data(data, datalen), rpc_opt));
     }
   }
   inline void InvokeStream(const nq_serial_t &serial, NqStream *unboxed, OpCode code, 
@@ -383,7 +436,7 @@ class NqBoxer {
         unboxed->Handler<NqSimpleRPCStreamHandler>()->Notify(type, data, datalen);
       }
     } else {
-      Enqueue(new Op(serial, unboxed, code, type, data, datalen));
+      Enqueue(new Op(serial, unboxed, code, type, Op::Data(data, datalen)));
     }
   }
   inline void InvokeStream(const nq_serial_t &serial, NqStream *unboxed, OpCode code, 
@@ -395,7 +448,7 @@ class NqBoxer {
         unboxed->Handler<NqSimpleRPCStreamHandler>()->Reply(result, msgid, data, datalen);
       }
     } else {
-      Enqueue(new Op(serial, unboxed, code, result, msgid, data, datalen));
+      Enqueue(new Op(serial, unboxed, code, result, msgid, Op::Data(data, datalen)));
     }
   }
 
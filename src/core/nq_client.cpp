@@ -4,6 +4,8 @@
 #include <sys/socket.h>
 #include <netdb.h>
 
+#include <algorithm>
+
 #include "net/quic/platform/api/quic_ptr_util.h"
 #include "net/quic/core/quic_crypto_client_stream.h"
 
@@ -36,7 +38,9 @@ NqClient::NqClient(QuicSocketAddress server_address,
           on_open_(config.client().on_open), 
           on_finalize_(config.client().on_finalize),
           stream_manager_(), connect_state_(DISCONNECT),
-          context_(nullptr), reachability_(nullptr) {
+          context_(nullptr), reachability_(nullptr),
+          use_batch_write_(config.client().use_batch_write),
+          use_shared_socket_(config.client().use_shared_socket) {
   set_server_address(server_address);
 }
 NqClient::~NqClient() {
@@ -69,7 +73,7 @@ void NqClient::operator delete(void *p, NqClientLoop *l) noexcept {
 
 void NqClient::InitSerial() {
   auto session_index = loop_->client_map().Add(this);
-  NqConnSerialCodec::ClientEncode(session_serial_, session_index);
+  NqConnSerialCodec::ClientEncode(session_serial_, session_index, loop_->client_map().Generation(session_index));
 }
 NqStreamIndex NqClient::NewStreamIndex() {
   return client_loop()->stream_index_factory().New(); 
@@ -149,8 +153,8 @@ void NqClient::Destroy() {
 nq_conn_t NqClient::ToHandle() { 
   return MakeHandle<nq_conn_t, NqSession::Delegate>(static_cast<NqSession::Delegate *>(this), session_serial_);
 }
-std::mutex &NqClient::static_mutex() {
-  return loop_->client_allocator().Bss(this)->mutex();
+NqStaticSection &NqClient::static_section() {
+  return *(loop_->client_allocator().Bss(this));
 }
 NqBoxer *NqClient::boxer() { 
   return static_cast<NqBoxer *>(loop_); 
@@ -160,6 +164,7 @@ NqBoxer *NqClient::boxer() {
 
 // implements QuicClientBase
 std::unique_ptr<QuicSession> NqClient::CreateQuicClientSession(QuicConnection* connection) {
+  static_cast<NqNetworkHelper *>(network_helper())->SetConnectionId(connection->connection_id());
   return QuicWrapUnique(new NqClientSession(connection, loop_, this, *config()));
 }
 void NqClient::InitializeSession() {
@@ -299,14 +304,25 @@ NqClient::StreamManager::FindEntry(NqStreamIndex index) {
 #endif
 }
 void NqClient::StreamManager::RecoverOutgoingStreams(NqClientSession *session) {
-for (auto &kv : entries_) {
-    auto &e = kv.second; 
-    TRACE("RecoverOutgoingStreams: %u %s %p", kv.first, e.name_.c_str(), e.handle_);
+  //recover in the order of creation. also OpenHandler may add entry and invalidate iterator of entries_
+  std::vector<NqStreamIndex> indexes;
+  indexes.reserve(entries_.size());
+  for (auto &kv : entries_) {
+    indexes.push_back(kv.first);
+  }
+  std::sort(indexes.begin(), indexes.end());
+  for (auto idx : indexes) {
+    auto pe = FindEntry(idx);
+    if (pe == nullptr) {
+      continue;
+    }
+    auto &e = *pe; 
+    TRACE("RecoverOutgoingStreams: %u %s %p", idx, e.name_.c_str(), e.handle_);
     if (e.name_.length() > 0) {
       auto s = e.Stream();
       if (s == nullptr) {
         s = static_cast<NqClientStream *>(session->CreateOutgoingDynamicStream());
-        s->InitSerial(kv.first);
+        s->InitSerial(idx);
         TRACE("RecoverOutgoingStreams: serial %llx", s->stream_serial());
       }
       ASSERT(s != nullptr);
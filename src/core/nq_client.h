@@ -5,6 +5,8 @@
 #include <string>
 #include <mutex>
 #include <stack>
+#include <vector>
+#include <unordered_map>
 #include <functional>
 
 #include <arpa/inet.h>
@@ -55,7 +57,8 @@ class NqClient : public QuicClientBase,
       inline const std::string &Name() const { return name_; }
     };
 
-    using StreamMap = QuicSmallMap<NqStreamIndex, Entry, 10>;
+    //stream index => entry, for both of opened streams and outgoing streams waiting for (re)connection
+    using StreamMap = std::unordered_map<NqStreamIndex, Entry>;
 
     StreamMap entries_;
    public:
@@ -119,7 +122,9 @@ class NqClient : public QuicClientBase,
   inline NqPacketWriter *packet_writer() { return static_cast<NqPacketWriter *>(writer()); }
   
   inline bool IsReachabilityTracked() const { return reachability_ != nullptr; }
-  std::mutex &static_mutex();
+  inline bool UseBatchWrite() const { return use_batch_write_; }
+  inline bool UseSharedSocket() const { return use_shared_socket_; }
+  NqStaticSection &static_section();
   NqBoxer *boxer();
   
   nq_conn_t ToHandle();
@@ -133,8 +138,8 @@ class NqClient : public QuicClientBase,
   bool TrackReachability(const std::string &host);
   
   inline void InvalidateSerial() { 
-    std::unique_lock<std::mutex> lk(static_mutex());
-    session_serial_.Clear(); 
+    session_serial_.ClearAtomic(); 
+    static_section().WaitUnpinned();
   }
   
 
@@ -206,6 +211,7 @@ class NqClient : public QuicClientBase,
   nq::atomic<ConnectState> connect_state_;
   void *context_;
   NqReachability *reachability_;
+  bool use_batch_write_, use_shared_socket_;
 
   DISALLOW_COPY_AND_ASSIGN(NqClient);
 };
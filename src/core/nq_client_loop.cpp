@@ -99,7 +99,11 @@ bool NqClientLoop::Resolve(int family_pref, const std::string &host, int port, c
   q->loop_ = this;
   q->family_ = family_pref;
   q->port_ = port;
-  async_resolver_.StartResolve(q);  
+  if (main_thread()) {
+    async_resolver_.StartResolve(q);
+  } else {
+    Enqueue(new Op(nq_serial_t(), q, Connect, OpTarget::Query));
+  }
   return true;
 }
 bool NqClientLoop::Resolve(int family_pref, const std::string &host, nq_on_resolve_host_t cb) {
@@ -119,22 +123,53 @@ int NqClientLoop::Open(int max_nfd, const nq_dns_conf_t *dns_conf) {
 void NqClientLoop::Poll() {
   processor_.Poll(this);
   async_resolver_.Poll(this);
+  //send packets written by processing queued invocations
+  FlushWriters();
   NqLoop::Poll();
 }
+void NqClientLoop::Poll(nq_time_t max_wait_ns) {
+  processor_.Poll(this);
+  async_resolver_.Poll(this);
+  FlushWriters();
+  PrepareWait();
+  if (processor_.size_approx() > 0) {
+    max_wait_ns = 0;
+  } else if (!async_resolver_.idle() && max_wait_ns > CLIENT_LOOP_WAIT_NS) {
+    //resolver io is driven by polling
+    max_wait_ns = CLIENT_LOOP_WAIT_NS;
+  }
+  NqLoop::Poll(max_wait_ns);
+}
 void NqClientLoop::Close() {
+  //ops enqueued after last Poll (eg. connect from other thread) are never processed
+  processor_.Discard();
   client_map_.Iter([](NqSessionIndex idx, NqClient *cl) {
     TRACE("NqClientLoop::Close %u %p", idx, cl);
     cl->Destroy();
   });
   client_map_.Clear();
+  for (auto &ss : shared_sockets_) {
+    ss.reset();
+  }
   NqLoop::Close();
 }
+NqSharedSocket *NqClientLoop::SharedSocket(const QuicSocketAddress &server_address) {
+  auto &ss = shared_sockets_[server_address.host().address_family() == IpAddressFamily::IP_V4 ? 0 : 1];
+  if (ss == nullptr) {
+    std::unique_ptr<NqSharedSocket> s(new NqSharedSocket(this));
+    if (!s->Open(server_address)) {
+      return nullptr;
+    }
+    ss = std::move(s);
+  }
+  return ss.get();
+}
 //implements NqBoxer
 NqAlarm *NqClientLoop::NewAlarm() {
   auto a = new(this) NqAlarm();
   auto idx = alarm_map_.Add(a);
   nq_serial_t s;
-  NqAlarmSerialCodec::ClientEncode(s, idx);
+  NqAlarmSerialCodec::ClientEncode(s, idx, alarm_map_.Generation(idx));
   a->InitSerial(s);
   return a;
 }
@@ -13,7 +13,9 @@
 #include "core/nq_config.h"
 #include "core/nq_boxer.h"
 #include "core/nq_client.h"
+#include "core/nq_shared_socket.h"
 #include "core/nq_stream.h"
+#include "core/nq_rpc_latency.h"
 
 namespace net {
 class NqClientLoop : public NqLoop,
@@ -28,6 +30,8 @@ class NqClientLoop : public NqLoop,
   static constexpr nq_time_t CLIENT_LOOP_WAIT_NS = 1000 * 1000; 
   static constexpr const char *DEFAULT_DNS = "8.8.8.8";
   static nq::IdFactory<uint32_t> client_worker_index_factory_;
+  //declared first so that it outlives streams which record to it
+  NqRPCLatency rpc_latency_;
   nq::HandlerMap handler_map_;
   ClientMap client_map_;
   AlarmMap alarm_map_;
@@ -40,30 +44,40 @@ class NqClientLoop : public NqLoop,
   NqAsyncResolver async_resolver_;
   nq::IdFactory<uint32_t> stream_index_factory_;
   uint32_t worker_index_;
+  //lazily created for ipv4 and ipv6 respectively
+  std::unique_ptr<NqSharedSocket> shared_sockets_[2];
 
  public:
-  NqClientLoop(int max_client_hint, int max_stream_hint) : handler_map_(), client_map_(), alarm_map_(), 
+  NqClientLoop(int max_client_hint, int max_stream_hint) : rpc_latency_(), handler_map_(), client_map_(), alarm_map_(), 
     processor_(), versions_(net::AllSupportedVersions()),
     client_allocator_(max_client_hint), stream_allocator_(max_stream_hint), alarm_allocator_(max_client_hint),
-    async_resolver_(), stream_index_factory_(0x7FFFFFFF) {
+    async_resolver_(), stream_index_factory_(0x7FFFFFFF), shared_sockets_() {
     worker_index_ = client_worker_index_factory_.New();
     set_main_thread();
   }
   ~NqClientLoop() {}
 
   void Poll();
+  //block until io event, alarm, cross thread invocation or max_wait_ns passed. 
+  //used by the thread dedicated to poll this loop (eg. NqClientPool)
+  void Poll(nq_time_t max_wait_ns);
   int Open(int max_nfd, const nq_dns_conf_t *dns_conf);
   void Close();
   void RemoveClient(NqClient *cl);
-  //af_first specifies first lookup address family
+  //af_first specifies first lookup address family. thread safe. 
+  //if called from other than main thread, resolving is started in main thread.
   bool Resolve(int family_pref, const std::string &host, int port, const nq_clconf_t *conf);
   bool Resolve(int family_pref, const std::string &host, nq_on_resolve_host_t cb);
   NqClient *Create(const std::string &host, 
                    const QuicServerId server_id,
                    const QuicSocketAddress server_address,  
                    NqClientConfig &config);
+  //returns socket shared by connections to the server which has same address family as server_address.
+  //nullptr if fails to create socket.
+  NqSharedSocket *SharedSocket(const QuicSocketAddress &server_address);
 
   inline nq::HandlerMap *mutable_handler_map() { return &handler_map_; }
+  inline NqRPCLatency &rpc_latency() { return rpc_latency_; }
   inline const nq::HandlerMap *handler_map() const { return &handler_map_; }
   inline nq_client_t ToHandle() { return (nq_client_t)this; }
   inline bool main_thread() const { return thread_id_ == std::this_thread::get_id(); }
@@ -89,7 +103,14 @@ class NqClientLoop : public NqLoop,
   void Free(void *p) override { return stream_allocator_.Free(p); }
 
   //implements NqBoxer
-  void Enqueue(NqBoxer::Op *op) override { processor_.enqueue(op); }
+  void Enqueue(NqBoxer::Op *op) override { 
+    processor_.enqueue(op); 
+    Wakeup();
+  }
+  void EnqueueBulk(NqBoxer::Op **ops, size_t n_ops) override { 
+    processor_.enqueue_bulk(ops, n_ops); 
+    Wakeup();
+  }
   bool MainThread() const override { return main_thread(); }
   NqLoop *Loop() override { return this; }
   NqAlarm *NewAlarm() override;
@@ -0,0 +1,71 @@
+#include "core/nq_client_pool.h"
+
+namespace net {
+int NqClientPool::Open(int n_thread, int max_nfd, int max_stream_hint, const nq_dns_conf_t *dns_conf) {
+  if (n_thread <= 0) {
+    n_thread = 1;
+  }
+  for (int i = 0; i < n_thread; i++) {
+    auto l = new NqClientLoop(max_nfd, max_stream_hint);
+    int r;
+    if ((r = l->Open(max_nfd, dns_conf)) < 0) {
+      delete l;
+      return r;
+    }
+    loops_.push_back(l);
+  }
+  return NQ_OK;
+}
+bool NqClientPool::Start() {
+  if (alive_.load() || loops_.size() <= 0) {
+    return false;
+  }
+  alive_.store(true);
+  std::atomic<size_t> n_started(0);
+  for (auto l : loops_) {
+    *(l->mutable_handler_map()) = handler_map_;
+    threads_.emplace_back([this, l, &n_started]() {
+      l->set_main_thread();
+      n_started++;
+      Run(l);
+    });
+  }
+  //FYI(iyatomi): wait for all loops to know their thread, 
+  //otherwise Connect just after Start may touch loop from caller thread, as if it is main thread.
+  while (n_started.load() < loops_.size()) {
+    std::this_thread::yield();
+  }
+  return true;
+}
+void NqClientPool::Run(NqClientLoop *l) {
+  while (alive_.load()) {
+    l->Poll(kMaxIdleWait);
+  }
+}
+void NqClientPool::Close() {
+  alive_.store(false);
+  for (auto l : loops_) {
+    l->Wakeup();
+  }
+  for (auto &t : threads_) {
+    if (t.joinable()) {
+      t.join();
+    }
+  }
+  threads_.clear();
+  for (auto l : loops_) {
+    l->set_main_thread();
+    l->Close();
+    delete l;
+  }
+  loops_.clear();
+}
+bool NqClientPool::Connect(const nq_addr_t *addr, const nq_clconf_t *conf) {
+  if (loops_.size() <= 0) {
+    return false;
+  }
+  auto l = loops_[next_loop_.fetch_add(1) % loops_.size()];
+  //we are not smart aleck and wanna use ipv4 if possible 
+  return l->Resolve(AF_INET, addr->host, addr->port, conf);
+}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "nq.h"
+#include "basis/handler_map.h"
+#include "core/nq_client_loop.h"
+
+namespace net {
+//owns N NqClientLoop and the threads which poll each of them, like NqServer does with NqWorker.
+//connections are distributed to loops by round robin, and afterwards handled only by that loop thread.
+class NqClientPool {
+  std::vector<NqClientLoop*> loops_;
+  std::vector<std::thread> threads_;
+  //copied to each loop at Start, so that all loops have same handler setting
+  nq::HandlerMap handler_map_;
+  std::atomic<bool> alive_;
+  std::atomic<uint32_t> next_loop_;
+ public:
+  NqClientPool() : loops_(), threads_(), handler_map_(), alive_(false), next_loop_(0) {}
+  ~NqClientPool() { Close(); }
+  int Open(int n_thread, int max_nfd, int max_stream_hint, const nq_dns_conf_t *dns_conf);
+  //start polling threads. returns after all loops are bound to their threads.
+  bool Start();
+  //stop and join polling threads, then close all connections.
+  void Close();
+  //thread safe. 
+  bool Connect(const nq_addr_t *addr, const nq_clconf_t *conf);
+
+  inline nq::HandlerMap *mutable_handler_map() { return &handler_map_; }
+  inline int size() const { return (int)loops_.size(); }
+  inline nq_client_pool_t ToHandle() { return (nq_client_pool_t)this; }
+  static inline NqClientPool *FromHandle(nq_client_pool_t p) { return (NqClientPool *)p; }
+
+ protected:
+  //max sleep duration when there is no io event and alarm. 
+  //sleep is interrupted by Wakeup, so this only is for safety. 
+  static const nq_time_t kMaxIdleWait = 100 * 1000 * 1000;
+  void Run(NqClientLoop *l);
+};
+}
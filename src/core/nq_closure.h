@@ -7,9 +7,11 @@ typedef union {
   nq_on_client_conn_open_t on_client_conn_open;
   nq_on_client_conn_close_t on_client_conn_close;
   nq_on_client_conn_finalize_t on_client_conn_finalize;
+  nq_on_client_rpc_latency_t on_client_rpc_latency;
 
   nq_on_server_conn_open_t on_server_conn_open;
   nq_on_server_conn_close_t on_server_conn_close;
+  nq_on_server_conn_stats_t on_server_conn_stats;
 
   nq_on_conn_validate_t on_conn_validate;
   nq_on_conn_modify_hdmap_t on_conn_modify_hdmap;
@@ -19,6 +21,7 @@ typedef union {
   nq_stream_reader_t stream_reader;
   nq_stream_writer_t stream_writer;
   nq_on_stream_record_t on_stream_record;
+  nq_on_stream_records_t on_stream_records;
   nq_on_stream_task_t on_stream_task;
   nq_on_stream_ack_t on_stream_ack;
   nq_on_stream_retransmit_t on_stream_retransmit;
@@ -6,6 +6,10 @@
 namespace net {
 void NqClientConfig::Setup() { //init other variables from client_
   ConfigureSelf(client_);
+  if (client_.use_shared_socket) {
+    //shared socket routes incoming packets by connection id, so ask server never to omit it
+    SetBytesForConnectionIdToSend(PACKET_8BYTE_CONNECTION_ID);
+  }
 }
 std::unique_ptr<ProofVerifier> NqClientConfig::NewProofVerifier() const { 
   if (client_.insecure) {
@@ -1,5 +1,7 @@
 #include "core/nq_dispatcher.h"
 
+#include <algorithm>
+
 #include "net/tools/quic/quic_default_packet_writer.h"
 
 #include "core/nq_client_loop.h"
@@ -24,15 +26,27 @@ NqDispatcher::NqDispatcher(int port, const NqServerConfig& config,
                 ), 
 	port_(port), 
   accept_per_loop_(config.server().accept_per_loop <= 0 ? kNumSessionsToCreatePerSocketEvent : config.server().accept_per_loop),
+  rebalance_threshold_(config.server().rebalance_threshold),
+  trace_sample_rate_(config.server().trace_sample_rate), trace_countdown_(config.server().trace_sample_rate),
   index_(worker.index()), n_worker_(worker.server().n_worker()), 
-  session_limit_(config.server().use_max_session_hint_as_limit ? config.server().max_session_hint : 0), 
+  session_limit_(config.server().use_max_session_hint_as_limit ? config.server().max_session_hint : 0), n_processed_(0), 
+  route_ttl_(std::max((nq_time_t)kMinRouteTTL, std::max(config.server().handshake_timeout, config.server().idle_timeout))), 
   server_(worker.server()), config_(config), crypto_config_(std::move(crypto_config)), loop_(worker.loop()), reader_(worker.reader()), 
-  cert_cache_(config.server().quic_cert_cache_size <= 0 ? kDefaultCertCacheSize : config.server().quic_cert_cache_size), 
+  metrics_(worker.metrics()), tracer_(worker.tracer()), gro_enabled_(false), cert_cache_(config.server().quic_cert_cache_size <= 0 ? kDefaultCertCacheSize : config.server().quic_cert_cache_size), 
   thread_id_(worker.thread_id()), server_map_(), alarm_map_(), 
-  session_allocator_(config.server().max_session_hint), stream_allocator_(config.server().max_stream_hint),
+  session_allocator_(config.server().max_session_hint, config.server().use_hugepage), 
+  stream_allocator_(config.server().max_stream_hint, config.server().use_hugepage),
   alarm_allocator_(config.server().max_session_hint) {
   invoke_queues_ = server_.InvokeQueuesFromPort(port);
   ASSERT(invoke_queues_ != nullptr);
+  if (rebalance_threshold_ > 0 && config.server().use_reuseport_steering && n_worker_ > 1) {
+    //kernel always delivers packets of the connection to the worker of conn_id % n_worker, 
+    //so placing it to other worker makes every its packet forwarded during its lifetime.
+    if (index_ == 0) {
+      QUIC_LOG(WARNING) << "rebalance_threshold is ignored because use_reuseport_steering is enabled";
+    }
+    rebalance_threshold_ = 0;
+  }
   SetFromConfig(config);
 }
 void NqDispatcher::SetFromConfig(const NqServerConfig &config) {
@@ -41,8 +55,7 @@ void NqDispatcher::SetFromConfig(const NqServerConfig &config) {
   }
 }
 void NqDispatcher::Shutdown() {
-  nq::logger::info({
-    {"msg", "shutdown start"},
+  nq::logger::info("shutdown start", {
     {"worker_index", index_},
     {"port", port_},
     {"session_remain", session_map().size()},
@@ -56,16 +69,14 @@ void NqDispatcher::Shutdown() {
 }
 bool NqDispatcher::ShutdownFinished(nq_time_t shutdown_start) const { 
   if (session_map().size() <= 0) {
-    nq::logger::info({
-      {"msg", "shutdown finished"},
+    nq::logger::info("shutdown finished", {
       {"reason", "all session closed"},
       {"worker_index", index_},
       {"port", port_},
     });
     return true;
   } else if ((shutdown_start + config_.server().shutdown_timeout) < nq_time_now()) {
-    nq::logger::error({
-      {"msg", "shutdown finished"},
+    nq::logger::error("shutdown finished", {
       {"reason", "timeout"},
       {"worker_index", index_},
       {"port", port_},
@@ -91,6 +102,13 @@ void NqDispatcher::OnConnectionClosed(QuicConnectionId connection_id,
   }
   QuicDispatcher::OnConnectionClosed(connection_id, error, error_details);  
 }
+void NqDispatcher::OnConnectionAddedToTimeWaitList(QuicConnectionId connection_id) {
+  //connection closed or rejected. if it is placed by PlaceNewConnection, route to this worker no more needed.
+  //FYI(iyatomi): packets arrive after this, are processed by the worker of conn_id % n_worker, 
+  //and it just resets the connection as unknown.
+  server_.route_table().Remove(connection_id);
+  QuicDispatcher::OnConnectionAddedToTimeWaitList(connection_id);
+}
 
 //implements nq::IoProcessor
 void NqDispatcher::OnEvent(nq::Fd fd, const Event &e) {
@@ -98,26 +116,88 @@ void NqDispatcher::OnEvent(nq::Fd fd, const Event &e) {
     writer()->SetWritable(); //indicate fd become writable
   }
   if (NqLoop::Readable(e)) {
-    while (reader_.Read(fd, port_, *(loop_.GetClock()), this, nullptr)) {}
+    do {
+      NqWorkerMetrics::Add(metrics_.recv_calls_, 1);
+    } while (reader_.Read(fd, port_, *(loop_.GetClock()), this, nullptr, gro_enabled_));
   } 
 }
 int NqDispatcher::OnOpen(nq::Fd fd) {
-  InitializeWithWriter(new NqPacketWriter(fd));
+  auto w = new NqPacketWriter(fd);
+  if (config_.server().use_batch_write) {
+    w->EnableBatchMode(&loop_);
+  }
+  if (config_.server().use_gro) {
+    gro_enabled_ = NqPacketReader::EnableGRO(fd);
+    if (!gro_enabled_) {
+      QUIC_LOG(WARNING) << "UDP_GRO not supported: " << strerror(errno);
+    }
+  }
+  InitializeWithWriter(w);
   return NQ_OK;
 }
 void NqDispatcher::OnRecv(NqPacket *packet) {
   auto conn_id = packet->ConnectionId();
+  NqWorkerMetrics::Add(metrics_.packets_received_, 1);
   if (conn_id == 0) { 
     return; 
   }
-  auto idx = conn_id % n_worker_;
+  //connection which is placed to other than the worker of conn_id % n_worker
+  int idx = server_.route_table().Find(conn_id);
+  if (idx < 0) {
+    idx = conn_id % n_worker_;
+    if (index_ == (uint32_t)idx && packet->HasVersion()) {
+      idx = PlaceNewConnection(conn_id);
+    }
+  }
   //TRACE("conn_id = %llu @ %d %llu\n", conn_id, index_, idx);
-  if (index_ == idx) {
-    //TODO(iyatomi): if idx is same as current index, directly process packet here
+  Dispatch(idx, packet);
+}
+void NqDispatcher::OnForwarded(NqPacket *packet) {
+  //route may be added or removed while packet is queued (eg. the worker of conn_id % n_worker places
+  //the connection to other worker), so look up again not to create duplicated session or time wait entry.
+  //FYI(iyatomi): new connection is placed only on receiving from socket, not to bounce packet between workers.
+  auto conn_id = packet->ConnectionId();
+  int idx = server_.route_table().Find(conn_id);
+  if (idx < 0) {
+    idx = conn_id % n_worker_;
+  }
+  Dispatch(idx, packet);
+}
+void NqDispatcher::Dispatch(int idx, NqPacket *packet) {
+  if (index_ == (uint32_t)idx) {
     Process(packet);
   } else {
-    server_.Q4(idx).enqueue(packet);
+    //if reuseport steering is enabled, only reached when kernel could not steer packet 
+    //(eg. packet arrives before steering program attached)
+    NqWorkerMetrics::Add(metrics_.packets_forwarded_, 1);
+    //forwarding also costs this worker, so counted as its load
+    n_processed_++;
+    if (trace_sample_rate_ > 0) {
+      packet->set_forwarded_us(NqTracer::NowInUsec());
+    }
+    server_.Forward(idx, packet);
+  }
+}
+
+int NqDispatcher::PlaceNewConnection(QuicConnectionId conn_id) {
+  if (rebalance_threshold_ <= 0 || n_worker_ <= 1) {
+    return index_;
+  }
+  auto target = server_.LeastLoadedWorker();
+  auto own_load = server_.load(index_), target_load = server_.load(target);
+  if (target == (int)index_ || own_load < kMinRebalanceLoad || 
+    (((uint64_t)own_load) * 100) <= (((uint64_t)target_load) * (100 + rebalance_threshold_))) {
+    return index_;
   }
+  //only new connection can be placed to other worker. 
+  //FYI(iyatomi): established session cannot be moved, because its QuicConnection is bound to 
+  //helper, alarm factory and writer of this worker, and its handles refer memory of this dispatcher.
+  if (FindByConnectionId(conn_id) != nullptr || HasBufferedPackets(conn_id) ||
+    time_wait_list_manager()->IsConnectionIdInTimeWait(conn_id)) {
+    return index_;
+  }
+  server_.route_table().Add(conn_id, target, nq_time_now() + route_ttl_);
+  return target;
 }
 
 //implements QuicCryptoServerStream::Helper
@@ -152,6 +232,8 @@ QuicSession* NqDispatcher::CreateQuicSession(QuicConnectionId connection_id,
     CreatePerConnectionWriter(),
     /* owns_writer= */ true, Perspective::IS_SERVER, GetSupportedVersions());
 
+  //this connection might be placed by PlaceNewConnection of other worker. keep its route while session alive
+  server_.route_table().Confirm(connection_id);
   auto s = new(this) NqServerSession(connection, it->second);
   s->Initialize();
   s->InitSerial();
@@ -162,12 +244,17 @@ QuicSession* NqDispatcher::CreateQuicSession(QuicConnectionId connection_id,
 void NqDispatcher::Enqueue(Op *op) {
   //TODO(iyatomi): NqDispatcher owns invoke_queue
   invoke_queues_[index_].enqueue(op);
+  loop_.Wakeup();
+}
+void NqDispatcher::EnqueueBulk(Op **ops, size_t n_ops) {
+  invoke_queues_[index_].enqueue_bulk(ops, n_ops);
+  loop_.Wakeup();
 }
 NqAlarm *NqDispatcher::NewAlarm() {
   auto a = new(this) NqAlarm();
   auto idx = alarm_map_.Add(a);
   nq_serial_t s;
-  NqAlarmSerialCodec::ServerEncode(s, idx);
+  NqAlarmSerialCodec::ServerEncode(s, idx, alarm_map_.Generation(idx));
   a->InitSerial(s);
   return a;
 }
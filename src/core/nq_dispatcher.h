@@ -27,6 +27,10 @@ class NqDispatcher : public QuicDispatcher,
                      public QuicSessionAllocator {
   static const int kNumSessionsToCreatePerSocketEvent = 1024;
   static const int kDefaultCertCacheSize = 16; 
+  //worker which load (packets/sec) is lower than this, never places new connection to other worker
+  static const uint32_t kMinRebalanceLoad = 1000;
+  //minimum lifetime of route table entry which is not confirmed by session creation
+  static const nq_time_t kMinRouteTTL = 10LL * 1000 * 1000 * 1000;
   typedef NqWorker::InvokeQueue InvokeQueue;
   typedef NqSessiontMap<NqServerSession, NqSessionIndex> ServerMap;
   typedef NqSessiontMap<NqAlarm, NqAlarmIndex> AlarmMap;
@@ -34,14 +38,18 @@ class NqDispatcher : public QuicDispatcher,
   typedef nq::Allocator<NqServerStream, NqStaticSection> StreamAllocator;
   typedef NqAlarm::Allocator AlarmAllocator;
   
-  int port_, accept_per_loop_; 
-  uint32_t index_, n_worker_, session_limit_;
+  int port_, accept_per_loop_, rebalance_threshold_, trace_sample_rate_, trace_countdown_; 
+  uint32_t index_, n_worker_, session_limit_, n_processed_;
+  nq_time_t route_ttl_;
   NqServer &server_;
   const NqServerConfig &config_;
   std::unique_ptr<QuicCryptoServerConfig> crypto_config_;
   InvokeQueue *invoke_queues_; //only owns index_ th index. 
   NqServerLoop &loop_;
   NqPacketReader &reader_;
+  NqWorkerMetrics &metrics_;
+  NqTracer &tracer_;
+  bool gro_enabled_;
   QuicCompressedCertsCache cert_cache_;
   std::thread::id thread_id_;
   ServerMap server_map_;
@@ -57,26 +65,27 @@ class NqDispatcher : public QuicDispatcher,
   void Shutdown();
   bool ShutdownFinished(nq_time_t shutdown_start) const;
   inline void Accept() { ProcessBufferedChlos(accept_per_loop_); }
+  inline size_t NumChlosBuffered() { return buffered_packets().NumChlosBuffered(); }
   inline void Process(NqPacket *p) {
-    {
-      //get NqServerSession's mutex, which is corresponding to this packet's connection id
-#if !defined(USE_DIRECT_WRITE)
-      //TRACE("packet from %s(%u=>%u)%u", p->client_address().ToString().c_str(), p->reader_index(), index_, p->length());
-      ProcessPacket(p->server_address(), p->client_address(), *p);        
-#else
-      auto cid = p->ConnectionId();
-      auto s = FindByConnectionId(cid);
-      if (s != nullptr) {
-        std::unique_lock<std::mutex> session_lock(s->static_mutex());
-        loop_.LockSession(s->session_index());
-        ProcessPacket(p->server_address(), p->client_address(), *p);
-        loop_.UnlockSession();
-      } else {
-        ProcessPacket(p->server_address(), p->client_address(), *p);        
-      }
-#endif
+    //TRACE("packet from %s(%u=>%u)%u", p->client_address().ToString().c_str(), p->reader_index(), index_, p->length());
+    bool traced = trace_sample_rate_ > 0 && (--trace_countdown_) <= 0;
+    if (traced) {
+      trace_countdown_ = trace_sample_rate_;
+      tracer_.Begin((p->receipt_time() - QuicTime::Zero()).ToMicroseconds(), p->forwarded_us());
     }
-    reader_.Pool(const_cast<char *>(p->data()), p);
+    ProcessPacket(p->server_address(), p->client_address(), *p);        
+    if (traced) {
+      tracer_.End();
+    }
+    reader_.Pool(p);
+    n_processed_++;
+    NqWorkerMetrics::Add(metrics_.packets_processed_, 1);
+  }
+  //returns number of packets processed or forwarded since last call
+  inline uint32_t TakeProcessedCount() {
+    auto n = n_processed_;
+    n_processed_ = 0;
+    return n;
   }
 
   inline QuicCompressedCertsCache *cert_cache() { return &cert_cache_; }
@@ -108,6 +117,8 @@ class NqDispatcher : public QuicDispatcher,
 
   //implements NqPacketReader::Delegate
   void OnRecv(NqPacket *packet) override;
+  //called for the packet forwarded from other worker
+  void OnForwarded(NqPacket *packet);
 
   //implements QuicCryptoServerStream::Helper
   QuicConnectionId GenerateConnectionIdForReject(
@@ -123,6 +134,7 @@ class NqDispatcher : public QuicDispatcher,
 
   //implements NqBoxer
   void Enqueue(Op *op) override;
+  void EnqueueBulk(Op **ops, size_t n_ops) override;
   bool MainThread() const override { return main_thread(); }
   NqLoop *Loop() override { return &loop_; }
   NqAlarm *NewAlarm() override;
@@ -135,6 +147,10 @@ class NqDispatcher : public QuicDispatcher,
 
  protected:
   void SetFromConfig(const NqServerConfig &conf);
+  //returns worker index which new connection of conn_id is placed to. only initial placement, 
+  //established session is never moved to other worker.
+  int PlaceNewConnection(QuicConnectionId conn_id);
+  void Dispatch(int idx, NqPacket *packet);
   void AddAlarm(NqAlarm *a);
 
   inline NqServerSession *FindByConnectionId(QuicConnectionId cid) {
@@ -153,5 +169,7 @@ class NqDispatcher : public QuicDispatcher,
   void OnConnectionClosed(QuicConnectionId connection_id,
                           QuicErrorCode error,
                           const std::string& error_details) override;
+  //implements QuicTimeWaitListManager::Visitor
+  void OnConnectionAddedToTimeWaitList(QuicConnectionId connection_id) override;
 };
 }
\ No newline at end of file
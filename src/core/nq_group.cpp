@@ -0,0 +1,90 @@
+#include "core/nq_group.h"
+
+#include "core/nq_session.h"
+
+namespace net {
+void NqGroupShard::Deliver(const NqSharedFrame &f) const {
+  for (auto &m : members_) {
+    auto st = m.stream_;
+    if (st->stream_serial() != m.serial_) {
+      continue; //already closed. will be removed by nq_group_remove_*
+    }
+    QuicConnection::ScopedPacketBundler bundler(
+      st->nq_session()->connection(), QuicConnection::SEND_ACK_IF_QUEUED);
+    st->Handler<NqStreamHandler>()->SendFrame(f);
+  }
+}
+
+NqGroupShard *NqGroup::MutableShard(NqBoxer *b, bool create) {
+  for (auto &s : shards_) {
+    if (s->boxer() == b) {
+      if (s->Shared()) {
+        //copy on write
+        auto copy = new NqGroupShard(*s);
+        s->Unref();
+        s = copy;
+      }
+      return s;
+    }
+  }
+  if (!create) {
+    return nullptr;
+  }
+  auto s = new NqGroupShard(b);
+  shards_.push_back(s);
+  return s;
+}
+bool NqGroup::Add(NqBoxer *b, const nq_serial_t &serial, NqStream *st) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto s = MutableShard(b, true);
+  for (auto &m : s->members()) {
+    if (m.stream_ == st && NqSerial::IsSame(m.serial_, serial)) {
+      return false;
+    }
+  }
+  s->members().push_back({serial, st});
+  size_++;
+  return true;
+}
+bool NqGroup::Remove(NqBoxer *b, const nq_serial_t &serial, NqStream *st) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto s = MutableShard(b, false);
+  if (s == nullptr) {
+    return false;
+  }
+  auto &members = s->members();
+  for (size_t i = 0; i < members.size(); i++) {
+    if (members[i].stream_ == st && NqSerial::IsSame(members[i].serial_, serial)) {
+      members[i] = members.back();
+      members.pop_back();
+      size_--;
+      return true;
+    }
+  }
+  return false;
+}
+void NqGroup::Broadcast(NqSharedFrame *f) {
+  std::vector<NqGroupShard*> local;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto s : shards_) {
+      if (s->members().size() <= 0) {
+        continue;
+      }
+      s->Ref();
+      if (s->boxer()->MainThread()) {
+        //deliver after unlock, because delivery may call user callback which touches this group
+        local.push_back(s);
+      } else {
+        f->Ref();
+        s->boxer()->Enqueue(new NqBoxer::Op(s, f));
+      }
+    }
+  }
+  for (auto s : local) {
+    s->Deliver(*f);
+    s->Unref();
+  }
+  f->Unref();
+}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "nq.h"
+#include "core/nq_boxer.h"
+
+namespace net {
+//members of a group which are owned by the same loop.
+//shard is immutable while it is referred from in-flight multicast operation, 
+//so NqGroup copies shard before modifying it, if it is shared.
+class NqGroupShard {
+ public:
+  struct Member {
+    nq_serial_t serial_;
+    NqStream *stream_;
+  };
+ private:
+  std::atomic<int> refcnt_;
+  NqBoxer *boxer_;
+  std::vector<Member> members_;
+ public:
+  NqGroupShard(NqBoxer *boxer) : refcnt_(1), boxer_(boxer), members_() {}
+  NqGroupShard(const NqGroupShard &s) : refcnt_(1), boxer_(s.boxer_), members_(s.members_) {}
+  inline void Ref() { refcnt_.fetch_add(1); }
+  inline void Unref() { if (refcnt_.fetch_sub(1) == 1) { delete this; } }
+  inline bool Shared() const { return refcnt_.load() > 1; }
+  inline NqBoxer *boxer() { return boxer_; }
+  inline std::vector<Member> &members() { return members_; }
+  inline const std::vector<Member> &members() const { return members_; }
+  //write frame to all members which is still valid. should be called from the thread which owns boxer_.
+  void Deliver(const NqSharedFrame &f) const;
+};
+
+//set of rpc/stream which receives the same data at once. members can be owned by different loops. 
+//frame is encoded only once per broadcast, and sent to each loop with single operation.
+class NqGroup {
+  std::mutex mutex_;
+  //almost case, number of loops are small. so linear scan of vector should be enough
+  std::vector<NqGroupShard*> shards_;
+  nq_size_t size_;
+ public:
+  NqGroup() : mutex_(), shards_(), size_(0) {}
+  ~NqGroup() {
+    for (auto s : shards_) {
+      s->Unref();
+    }
+  }
+  bool Add(NqBoxer *b, const nq_serial_t &serial, NqStream *st);
+  bool Remove(NqBoxer *b, const nq_serial_t &serial, NqStream *st);
+  //frame is unref'ed inside
+  void Broadcast(NqSharedFrame *f);
+  inline nq_size_t size() { 
+    std::unique_lock<std::mutex> lock(mutex_);
+    return size_; 
+  }
+
+  inline nq_group_t ToHandle() { return (nq_group_t)this; }
+  static inline NqGroup *FromHandle(nq_group_t g) { return (NqGroup *)g; }
+ protected:
+  //returns shard which can be modified
+  NqGroupShard *MutableShard(NqBoxer *b, bool create);
+};
+}
@@ -3,6 +3,7 @@
 #include <sys/time.h>
 
 #include "core/nq_alarm.h"
+#include "core/nq_packet_writer.h"
 
 namespace net {
 //implements QuicTime
@@ -42,25 +43,10 @@ QuicTime NqLoop::ToQuicTime(uint64_t from_us) {
 
 
 void NqLoop::SetAlarm(NqAlarmInterface *a, uint64_t timeout_in_us) {
-  alarm_map_.emplace(std::piecewise_construct, 
-                    std::forward_as_tuple(timeout_in_us), 
-                    std::forward_as_tuple(a));
+  timer_wheel_.Set(a, timeout_in_us);
 }
-void NqLoop::CancelAlarm(NqAlarmInterface *a, uint64_t timeout_in_us) {
-  auto p = alarm_map_.equal_range(timeout_in_us);
-  auto it = p.first;
-  for (; it != p.second; ++it) {
-    if (it->second.ptr_ == a) {
-      if (alarm_process_us_ts_ == 0 || alarm_process_us_ts_ < timeout_in_us) {
-        alarm_map_.erase(it);
-      } else {
-        TRACE("mark erased: %p %llu", it->second.ptr_, timeout_in_us);
-        it->second.erased_ = true;
-      }
-      return;
-    }
-  }
-  ASSERT(false);
+void NqLoop::CancelAlarm(NqAlarmInterface *a) {
+  timer_wheel_.Cancel(a);
 }
 
 //implements QuicAlarmFactory
@@ -80,37 +66,53 @@ QuicArenaScopedPtr<QuicAlarm> NqLoop::CreateAlarm(
 
 
 
+//batched write
+void NqLoop::UnscheduleFlush(NqPacketWriter *w) {
+  for (auto it = flush_writers_.begin(); it != flush_writers_.end(); ++it) {
+    if (*it == w) {
+      flush_writers_.erase(it);
+      return;
+    }
+  }
+}
+void NqLoop::FlushWriters() {
+  //FYI(iyatomi): writer which is blocked keeps its packets, and flushes them by itself 
+  //when fd become writable (NqPacketWriter::SetWritable)
+  for (auto w : flush_writers_) {
+    w->OnFlushUnscheduled();
+    w->Flush();
+  }
+  flush_writers_.clear();
+}
+
+
+
 // polling
 void NqLoop::Poll() {
   nq::Loop::Poll();
-  approx_now_in_usec_ = NowInUsec();
-  alarm_process_us_ts_ = approx_now_in_usec_;
-  auto it = alarm_map_.begin();
-  while (true) {
-    //TRACE("try invoke alarm %p at %llu %llu %lld", it->second, it->first, current, current - it->first);
-    //prevent infinite looping when OnAlarm keep on re-assigning alarm to the alarm_map_.
-    if (it == alarm_map_.end()) {
-      alarm_map_.clear();
-      break;
-    }
-    if (it->first > alarm_process_us_ts_) { //multimap key should be ordered
-      alarm_map_.erase(alarm_map_.begin(), it);
-      break;
-    }
-    if (it->second.erased_) {
-      TRACE("erased alarm: %p %llu", it->second.ptr_, it->first);
-      it++;
-      continue;
+  ProcessAlarms();
+}
+void NqLoop::Poll(uint64_t max_wait_ns) {
+  auto next = timer_wheel_.NextDeadline();
+  if (next != nq::TimerWheel::kNoDeadline) {
+    auto now = NowInUsec();
+    uint64_t until_next_ns = next > now ? ((next - now) * 1000) : 0;
+    if (until_next_ns < max_wait_ns) {
+      max_wait_ns = until_next_ns;
     }
-    NqAlarmInterface* cb = static_cast<NqAlarmInterface*>(it->second.ptr_);
-    //TRACE("invoke alarm %p(%s) at %llu", cb, cb->IsNonQuicAlarm() ? "reconn" : "",it->first);
-    cb->OnFire(this);
-    it++;
-    //add small duration to avoid infinite loop 
-    //(eg. OnAlarm adds new alarm that adds new alarm on OnAlarm again)
-    approx_now_in_usec_++; 
   }
-  alarm_process_us_ts_ = 0;
-  //TRACE("------------ end -------------------");
+  nq::Loop::Poll(max_wait_ns);
+  ProcessAlarms();
+}
+void NqLoop::ProcessAlarms() {
+  approx_now_in_usec_ = NowInUsec();
+  //FYI(iyatomi): alarm is unregistered before OnFire called, 
+  //so OnFire can set/cancel/delete any alarm including itself.
+  timer_wheel_.Expire(approx_now_in_usec_, [this](nq::TimerWheel::Node *n) {
+    n_alarms_fired_++;
+    static_cast<NqAlarmInterface *>(n)->OnFire(this);
+  });
+  //packets written in alarm callbacks
+  FlushWriters();
 }
 }  // namespace net
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <map>
+#include <vector>
 
 #include "net/quic/core/quic_connection.h"
 #include "net/quic/core/quic_time.h"
@@ -11,10 +11,12 @@
 
 #include "basis/loop.h"
 #include "basis/handler_map.h"
+#include "basis/timer_wheel.h"
 #include "core/nq_serial_codec.h"
 
 namespace net {
 class NqAlarmInterface;
+class NqPacketWriter;
 class NqLoop : public nq::Loop,
                public QuicConnectionHelperInterface,
                public QuicAlarmFactory,
@@ -22,9 +24,9 @@ class NqLoop : public nq::Loop,
  public:
   NqLoop() : nq::Loop(), 
              approx_now_in_usec_(0),
-             alarm_map_(), 
-             alarm_process_us_ts_(0),
-             current_locked_session_id(0) {}
+             timer_wheel_(), 
+             current_locked_session_id(0),
+             flush_writers_(), n_alarms_fired_(0) { timer_wheel_.Init(NowInUsec()); }
 
   inline void LockSession(NqSessionIndex idx) { current_locked_session_id = idx + 1; }
   inline void UnlockSession() { current_locked_session_id = 0; }
@@ -52,28 +54,35 @@ class NqLoop : public nq::Loop,
       const QuicWallTime& walltime) const override;
 
  public:
-  //inline std::multimap<uint64_t, NqAlarmInterface*> &AlarmMap() { return alarm_map_; }
   void Poll();
+  //block until next alarm deadline, io event, Wakeup call or max_wait_ns passed, 
+  //then process io event and alarms.
+  void Poll(uint64_t max_wait_ns);
   uint64_t NowInUsec() const;
+  //send packets buffered by batch mode NqPacketWriter. 
+  //should be called before blocking in Poll, not to delay outgoing packets.
+  void FlushWriters();
+  //number of alarms fired since loop created
+  inline uint64_t alarms_fired() const { return n_alarms_fired_; }
 
  protected:
   friend class NqQuicAlarm;
   friend class NqAlarmBase;
+  //set alarm to fire at timeout_in_us. if a is already set, its timeout is updated.
   void SetAlarm(NqAlarmInterface *a, uint64_t timeout_in_us);
-  void CancelAlarm(NqAlarmInterface *a, uint64_t timeout_in_us);
+  //no effect if a is not set.
+  void CancelAlarm(NqAlarmInterface *a);
+  friend class NqPacketWriter;
+  void ScheduleFlush(NqPacketWriter *w) { flush_writers_.push_back(w); }
+  void UnscheduleFlush(NqPacketWriter *w);
+  void ProcessAlarms();
 
  private:
-  class AlarmEntry {
-   public:
-    NqAlarmInterface *ptr_;
-    bool erased_;
-   public:
-    AlarmEntry(NqAlarmInterface *ptr) : ptr_(ptr), erased_(false) {}
-  };
   uint64_t approx_now_in_usec_;
   SimpleBufferAllocator buffer_allocator_;
-  std::multimap<uint64_t, AlarmEntry> alarm_map_;
-  nq_time_t alarm_process_us_ts_;
+  nq::TimerWheel timer_wheel_;
   nq::atomic<NqSessionIndex> current_locked_session_id;
+  std::vector<NqPacketWriter*> flush_writers_;
+  uint64_t n_alarms_fired_;
 };
 }
\ No newline at end of file
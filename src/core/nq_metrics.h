@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+
+#include "nq.h"
+
+namespace net {
+//counters and gauges of one worker. only the worker thread updates them, so update is 
+//relaxed load/store instead of atomic RMW, and any thread can read them without lock.
+//padded so that metrics of different workers never share cache line.
+class NqWorkerMetrics {
+  static const size_t kCacheLineSize = 64;
+  typedef std::atomic<uint64_t> Value;
+  char padd_head_[kCacheLineSize];
+ public:
+  //counters
+  Value recv_calls_, packets_received_, packets_forwarded_, packets_processed_;
+  Value ops_processed_, alarms_fired_, loop_polls_;
+  //gauges
+  Value sessions_, chlos_buffered_;
+ private:
+  char padd_tail_[kCacheLineSize - ((9 * sizeof(Value)) % kCacheLineSize)];
+ public:
+  NqWorkerMetrics() : recv_calls_(0), packets_received_(0), packets_forwarded_(0), packets_processed_(0),
+    ops_processed_(0), alarms_fired_(0), loop_polls_(0), sessions_(0), chlos_buffered_(0) {}
+  //only called from the worker thread
+  static inline void Add(Value &v, uint64_t n) {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  static inline void Set(Value &v, uint64_t n) {
+    v.store(n, std::memory_order_relaxed);
+  }
+  //thread safe. queue depths are not filled, because queues are owned by NqServer
+  inline void Read(nq_worker_metrics_t *m) const {
+    m->recv_calls = recv_calls_.load(std::memory_order_relaxed);
+    m->packets_received = packets_received_.load(std::memory_order_relaxed);
+    m->packets_forwarded = packets_forwarded_.load(std::memory_order_relaxed);
+    m->packets_processed = packets_processed_.load(std::memory_order_relaxed);
+    m->ops_processed = ops_processed_.load(std::memory_order_relaxed);
+    m->alarms_fired = alarms_fired_.load(std::memory_order_relaxed);
+    m->loop_polls = loop_polls_.load(std::memory_order_relaxed);
+    m->sessions = sessions_.load(std::memory_order_relaxed);
+    m->chlos_buffered = chlos_buffered_.load(std::memory_order_relaxed);
+  }
+};
+}
@@ -10,6 +10,8 @@ namespace net {
 
 namespace {
 const int kLoopFlags = NqLoop::EV_READ | NqLoop::EV_WRITE;
+//client writer is created per connection, so keep buffer small
+const int kClientBatchSize = 16;
 }  // namespace
 
 NqNetworkHelper::NqNetworkHelper(
@@ -17,9 +19,11 @@ NqNetworkHelper::NqNetworkHelper(
     NqClient* client)
     : loop_(loop),
       fd_(-1),
+      shared_socket_(nullptr),
+      connection_id_(0),
       packets_dropped_(0),
       overflow_supported_(false),
-      packet_reader_(new NqPacketReader()),
+      packet_reader_(nullptr),
       client_(client) {}
 
 NqNetworkHelper::~NqNetworkHelper() {
@@ -35,10 +39,28 @@ bool NqNetworkHelper::CreateUDPSocketAndBind(
     CleanUpAllUDPSockets();
     ASSERT(fd_ == -1);
   }
+  if (client_->UseSharedSocket()) {
+    auto ss = client_->client_loop()->SharedSocket(server_address);
+    if (ss == nullptr) {
+      return false;
+    }
+    shared_socket_ = ss;
+    fd_ = ss->fd();
+    address_ = ss->address();
+    //on migration, connection id is not changed
+    if (connection_id_ != 0) {
+      ss->Register(connection_id_, this);
+    }
+    return true;
+  }
   auto fd = QuicSocketUtils::CreateUDPSocket(server_address, &overflow_supported_);
   if (fd < 0) {
     return false;
   }
+  //shared socket has its own reader, so only allocated for per connection socket
+  if (packet_reader_ == nullptr) {
+    packet_reader_.reset(new NqPacketReader());
+  }
 
   if (bind_to_address.IsInitialized()) {
     address_ = QuicSocketAddress(bind_to_address, client_->local_port());
@@ -83,6 +105,18 @@ void NqNetworkHelper::CleanUpAllUDPSockets() {
 void NqNetworkHelper::CleanUpUDPSocketImpl(Fd fd) {
   DCHECK_EQ(fd, fd_);
   if (fd > -1) {
+    //send packets buffered in batch mode (eg. connection close) before closing fd
+    auto w = client_->packet_writer();
+    if (w != nullptr && w->IsBatchMode()) {
+      w->Detach();
+    }
+    if (shared_socket_ != nullptr) {
+      //shared socket is closed by NqClientLoop
+      shared_socket_->Unregister(connection_id_, this);
+      shared_socket_ = nullptr;
+      fd_ = -1;
+      return;
+    }
     loop_->Del(fd);
     TRACE("close fd: %d", fd);
     int rc = nq::Syscall::Close(fd);
@@ -108,8 +142,7 @@ void NqNetworkHelper::OnEvent(Fd fd, const Event& event) {
     }
   }
   if (client_->connected() && NqLoop::Writable(event)) {
-    client_->writer()->SetWritable();
-    client_->session()->connection()->OnCanWrite();
+    OnWritable();
   }
   if (NqLoop::Closed(event)) {
     TRACE("closed %d", fd);
@@ -122,6 +155,9 @@ QuicPacketWriter* NqNetworkHelper::CreateQuicPacketWriter() {
   if (client_->IsReachabilityTracked()) {
     w->SetReachabilityTracked(true);
   }
+  if (client_->UseBatchWrite()) {
+    w->EnableBatchMode(loop_, kClientBatchSize);
+  }
   return w;
 }
 
@@ -129,18 +165,27 @@ QuicSocketAddress NqNetworkHelper::GetLatestClientAddress() const {
   return address_;
 }
 
+void NqNetworkHelper::SetConnectionId(QuicConnectionId connection_id) {
+  if (shared_socket_ != nullptr) {
+    shared_socket_->Unregister(connection_id_, this);
+    shared_socket_->Register(connection_id, this);
+  }
+  connection_id_ = connection_id;
+}
+
+void NqNetworkHelper::OnWritable() {
+  client_->writer()->SetWritable();
+  client_->session()->connection()->OnCanWrite();
+}
+
 void NqNetworkHelper::OnRecv(NqPacketReader::Packet *p) {
+  ProcessPacket(p);
+  packet_reader_->Pool(p);
+}
+
+void NqNetworkHelper::ProcessPacket(NqPacketReader::Packet *p) {
   //self == server, peer == client
-#if !defined(USE_DIRECT_WRITE)
-  client_->session()->ProcessUdpPacket(p->server_address(), p->client_address(), *p);
-#else
-  auto m = &(client_->static_mutex());
-  std::unique_lock<std::mutex> session_lock(*m);
-  loop_->LockSession(client_->session_index());
-  //TRACE("NqNetworkHelper try get static mutex success %p", m);
   client_->session()->ProcessUdpPacket(p->server_address(), p->client_address(), *p);
-  loop_->UnlockSession();
-#endif
 }
 
 }  // namespace net
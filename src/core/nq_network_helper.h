@@ -11,6 +11,7 @@
 #include "basis/io_processor.h"
 #include "core/nq_loop.h"
 #include "core/nq_packet_reader.h"
+#include "core/nq_shared_socket.h"
 
 namespace net {
 // An implementation of the QuicClientBase::NetworkHelper based off
@@ -51,6 +52,16 @@ class NqNetworkHelper : public QuicClientBase::NetworkHelper,
 
   Fd fd() { return fd_; }
 
+  // called when connection (re)created. if socket is shared, incoming packets 
+  // which have |connection_id| are routed to this helper.
+  void SetConnectionId(QuicConnectionId connection_id);
+
+  // pass received packet to the session. caller owns the packet.
+  void ProcessPacket(NqPacketReader::Packet *p);
+
+  // resume writing packets blocked by socket
+  void OnWritable();
+
  private:
   // If |fd| is an open UDP socket, unregister and close it. Otherwise, do
   // nothing.
@@ -65,6 +76,12 @@ class NqNetworkHelper : public QuicClientBase::NetworkHelper,
   // single file descriptor for client connection
   Fd fd_;
 
+  // not null if fd_ is shared with other connections. owned by NqClientLoop
+  NqSharedSocket *shared_socket_;
+
+  // current connection id. used as routing key of shared socket
+  QuicConnectionId connection_id_;
+
   // socket address
   QuicSocketAddress address_;
 
@@ -77,7 +94,7 @@ class NqNetworkHelper : public QuicClientBase::NetworkHelper,
   bool overflow_supported_;
 
   // Point to a QuicPacketReader object on the heap. The reader allocates more
-  // space than allowed on the stack.
+  // space than allowed on the stack. null if socket is shared.
   std::unique_ptr<NqPacketReader> packet_reader_;
 
   NqClient* client_;
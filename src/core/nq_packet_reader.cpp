@@ -26,6 +26,16 @@
 #define SO_RXQ_OVFL 40
 #endif
 
+#if MMSG_MORE
+#include <netinet/udp.h>
+#if !defined(SOL_UDP)
+#define SOL_UDP 17
+#endif
+#if !defined(UDP_GRO)
+#define UDP_GRO 104
+#endif
+#endif
+
 namespace net {
 
 NqPacketReader::Packet::Packet(const char* buffer,
@@ -36,24 +46,52 @@ NqPacketReader::Packet::Packet(const char* buffer,
                                    struct sockaddr_storage client_sockaddr, 
                                    QuicIpAddress &server_ip, int server_port) : 
                                   QuicReceivedPacket(buffer, length, receipt_time, false, ttl, ttl_valid), 
-                                  client_address_(client_sockaddr), server_address_(server_ip, server_port) {
+                                  client_address_(client_sockaddr), server_address_(server_ip, server_port), 
+                                  port_(server_port), buffer_(nullptr), forwarded_us_(0) {
 
 }
 
 NqPacketReader::NqPacketReader() {
   Initialize();
 }
-NqPacketReader::~NqPacketReader() {}
+NqPacketReader::~NqPacketReader() {
+#if MMSG_MORE
+  for (int i = 0; i < batch_size_; ++i) {
+    if (packets_[i].buf != nullptr) {
+      Release(packets_[i].buf);
+    }
+  }
+#endif
+}
 
 void NqPacketReader::Initialize() {
 #if MMSG_MORE
+  batch_size_ = 0;
+  Configure(kNumPacketsPerReadMmsgCall);
+#endif
+}
+void NqPacketReader::Configure(int batch_size) {
+#if MMSG_MORE
+  if (batch_size <= 0 || batch_size > kMaxPacketsPerReadMmsgCall) {
+    batch_size = kNumPacketsPerReadMmsgCall;
+  }
+  if (batch_size == batch_size_) {
+    return;
+  }
+  for (int i = 0; i < batch_size_; ++i) {
+    if (packets_[i].buf != nullptr) {
+      Release(packets_[i].buf);
+    }
+  }
+  batch_size_ = batch_size;
+  packets_.reset(new PacketData[batch_size]);
+  mmsg_hdr_.reset(new mmsghdr[batch_size]);
   // Zero initialize uninitialized memory.
-  memset(mmsg_hdr_, 0, sizeof(mmsg_hdr_));
+  memset(mmsg_hdr_.get(), 0, sizeof(mmsghdr) * batch_size);
 
-  for (int i = 0; i < kNumPacketsPerReadMmsgCall; ++i) {
-    packets_[i].buf = NewBuffer();
-    packets_[i].iov.iov_base = packets_[i].buf;
-    packets_[i].iov.iov_len = kMaxPacketSize;
+  for (int i = 0; i < batch_size; ++i) {
+    //buffer is allocated on first Read, because its size depends on gro is used or not
+    packets_[i].buf = nullptr;
     
     msghdr* hdr = &mmsg_hdr_[i].msg_hdr;
     hdr->msg_name = &packets_[i].raw_address;
@@ -62,9 +100,17 @@ void NqPacketReader::Initialize() {
     hdr->msg_iovlen = 1;
 
     hdr->msg_control = packets_[i].cbuf;
-    hdr->msg_controllen = QuicSocketUtils::kSpaceForCmsg;
+    hdr->msg_controllen = kSpaceForCmsg;
   }
-  last_packets_read_ = 0;
+#endif
+}
+/* static */
+bool NqPacketReader::EnableGRO(int fd) {
+#if MMSG_MORE
+  int on = 1;
+  return setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+#else
+  return false;
 #endif
 }
 bool NqPacketReader::Read(
@@ -72,49 +118,75 @@ bool NqPacketReader::Read(
     int port,
     const QuicClock& clock,
     Delegate *delegate,
-    QuicPacketCount* packets_dropped) {
+    QuicPacketCount* packets_dropped, 
+    bool gro) {
 #if MMSG_MORE
-  return ReadPacketsMulti(fd, port, clock, delegate, packets_dropped);
+  return ReadPacketsMulti(fd, port, clock, delegate, packets_dropped, gro);
 #else
   return ReadPackets(fd, port, clock, delegate,
                                      packets_dropped);
 #endif
 }
+#if MMSG_MORE
+namespace {
+// returns segment size of coalesced packets, or 0 if packets are not coalesced.
+int GetGROSegmentSize(msghdr *hdr) {
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int gso_size;
+      memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+      return gso_size;
+    }
+  }
+  return 0;
+}
+}
+#endif
 bool NqPacketReader::ReadPacketsMulti(
     int fd,
     int port,
     const QuicClock& clock,
     Delegate *delegate,
-    QuicPacketCount* packets_dropped) {
+    QuicPacketCount* packets_dropped,
+    bool gro) {
 #if MMSG_MORE
   // Re-set the length fields in case recvmmsg has changed them.
-  for (int i = 0; i < last_packets_read_; ++i) {
-    DCHECK_EQ(kMaxPacketSize, packets_[i].iov.iov_len);
-    auto buf = NewBuffer();
-    packets_[i].buf = buf;
-    packets_[i].iov.iov_base = buf;
+  // and supply buffers for the slots which buffer is passed to packets. 
+  for (int i = 0; i < batch_size_; ++i) {
+    auto buf = packets_[i].buf;
+    if (buf != nullptr && (buf->capacity() > kMaxPacketSize) != gro) {
+      Release(buf);
+      buf = nullptr;
+    }
+    if (buf == nullptr) {
+      buf = NewBuffer(gro);
+      packets_[i].buf = buf;
+    }
+    packets_[i].iov.iov_base = buf->data();
+    packets_[i].iov.iov_len = buf->capacity();
     msghdr* hdr = &mmsg_hdr_[i].msg_hdr;
     hdr->msg_namelen = sizeof(sockaddr_storage);
     DCHECK_EQ(static_cast<size_t>(1), hdr->msg_iovlen);
-    hdr->msg_controllen = QuicSocketUtils::kSpaceForCmsg;
+    hdr->msg_controllen = kSpaceForCmsg;
   }
 
-  last_packets_read_ = recvmmsg(fd, mmsg_hdr_, kNumPacketsPerReadMmsgCall, 0, nullptr);
-  if (last_packets_read_ <= 0) {
+  int packets_read = recvmmsg(fd, mmsg_hdr_.get(), batch_size_, 0, nullptr);
+  if (packets_read <= 0) {
     return false;  // recvmmsg failed
   }
-  //printf("last_packets_read_ %d\n", last_packets_read_);
+  //printf("packets_read %d\n", packets_read);
 
   QuicWallTime fallback_walltimestamp = QuicWallTime::Zero();
-  for (int i = 0; i < last_packets_read_; ++i) {
+  for (int i = 0; i < packets_read; ++i) {
     if (mmsg_hdr_[i].msg_len == 0) {
       continue;
     }
 
-    if (mmsg_hdr_[i].msg_hdr.msg_controllen >= QuicSocketUtils::kSpaceForCmsg) {
+    if (mmsg_hdr_[i].msg_hdr.msg_controllen >= kSpaceForCmsg) {
       QUIC_BUG << "Incorrectly set control length: "
                << mmsg_hdr_[i].msg_hdr.msg_controllen << ", expected "
-               << QuicSocketUtils::kSpaceForCmsg;
+               << kSpaceForCmsg;
       continue;
     }
 
@@ -138,11 +210,25 @@ bool NqPacketReader::ReadPacketsMulti(
     QuicTime timestamp = clock.ConvertWallTimeToQuicTime(packet_walltimestamp);
     int ttl = 0;
     bool has_ttl = QuicSocketUtils::GetTtlFromMsghdr(&mmsg_hdr_[i].msg_hdr, &ttl);
-    auto packet = NewPacket(packets_[i].buf,
-                              mmsg_hdr_[i].msg_len, timestamp, ttl,
+    auto buf = packets_[i].buf;
+    size_t len = mmsg_hdr_[i].msg_len;
+    size_t segment_size = gro ? GetGROSegmentSize(&mmsg_hdr_[i].msg_hdr) : 0;
+    if (segment_size <= 0) {
+      segment_size = len;
+    }
+    //slice coalesced packets without copy. each packet holds reference of buf. 
+    //initial reference of buf is moved to first packet.
+    packets_[i].buf = nullptr;
+    for (size_t ofs = 0; ofs < len; ofs += segment_size) {
+      if (ofs > 0) {
+        buf->Ref();
+      }
+      auto packet = NewPacket(buf, buf->data() + ofs,
+                              std::min(segment_size, len - ofs), timestamp, ttl,
                               has_ttl, packets_[i].raw_address, server_ip, port);
-    packet->set_port(port);
-    delegate->OnRecv(packet);
+      packet->set_port(port);
+      delegate->OnRecv(packet);
+    }
   }
 
   if (packets_dropped != nullptr) {
@@ -151,7 +237,7 @@ bool NqPacketReader::ReadPacketsMulti(
   }
 
   // We may not have read all of the packets available on the socket.
-  return last_packets_read_ == kNumPacketsPerReadMmsgCall;
+  return packets_read == batch_size_;
 #else
   QUIC_LOG(FATAL) << "Unsupported";
   return false;
@@ -163,16 +249,16 @@ bool NqPacketReader::ReadPackets(
     const QuicClock& clock,
     Delegate *delegate, 
     QuicPacketCount* packets_dropped) {
-  char *buf = NewBuffer();
+  auto buf = NewBuffer();
 
   QuicSocketAddress client_address;
   QuicIpAddress server_ip;
   QuicWallTime walltimestamp = QuicWallTime::Zero();
   int bytes_read =
-      QuicSocketUtils::ReadPacket(fd, buf, kMaxPacketSize, packets_dropped,
+      QuicSocketUtils::ReadPacket(fd, buf->data(), buf->capacity(), packets_dropped,
                                   &server_ip, &walltimestamp, &client_address);
   if (bytes_read < 0) {
-    buffer_pool_.push(buf);
+    Release(buf);
     return false;  // ReadPacket failed.
   }
 
@@ -180,7 +266,7 @@ bool NqPacketReader::ReadPackets(
 
   if (!server_ip.IsInitialized()) {
     QUIC_BUG << "Unable to get server address.";
-    buffer_pool_.push(buf);
+    Release(buf);
     return false;
   }
   // This isn't particularly desirable, but not all platforms support socket
@@ -189,7 +275,7 @@ bool NqPacketReader::ReadPackets(
     walltimestamp = QuicWallTime::FromUNIXMicroseconds((clock.Now() - QuicTime::Zero()).ToMicroseconds());
   }
   QuicTime timestamp = clock.ConvertWallTimeToQuicTime(walltimestamp);
-  auto packet = NewPacket(buf, bytes_read, timestamp, 0, false,
+  auto packet = NewPacket(buf, buf->data(), bytes_read, timestamp, 0, false,
                           client_address.generic_address(), server_ip, port);
 
   packet->set_port(port);
@@ -5,6 +5,8 @@
 // regardless of how the below transitive header include set may change.
 #include <sys/socket.h>
 
+#include <atomic>
+#include <memory>
 #include <stack>
 
 #include "base/macros.h"
@@ -26,13 +28,34 @@ namespace net {
 #if MMSG_MORE
 // Read in larger batches to minimize recvmmsg overhead.
 const int kNumPacketsPerReadMmsgCall = 16;
+// Upper limit of configured batch size. buffers are allocated for each packet of batch
+const int kMaxPacketsPerReadMmsgCall = 1024;
 #endif
+// Buffer size to receive coalesced packets with UDP_GRO (max udp payload)
+const int kMaxGROBufferSize = 65535;
 
 class NqPacketReader {
  public:
+  // Reference counted receive buffer. with UDP_GRO, one buffer holds multiple packets
+  // and each packet refers some part of it. because packets can be processed by 
+  // other worker thread, reference count is atomic.
+  class Buffer {
+    std::atomic<int> refcnt_;
+    size_t capacity_;
+   public:
+    Buffer(size_t capacity) : refcnt_(1), capacity_(capacity) {}
+    inline char *data() { return reinterpret_cast<char *>(this + 1); }
+    inline size_t capacity() const { return capacity_; }
+    inline void Ref() { refcnt_.fetch_add(1); }
+    //returns true if this is last reference
+    inline bool Unref() { return refcnt_.fetch_sub(1) == 1; }
+    inline void Reset() { refcnt_.store(1); }
+  };
   class Packet : public QuicReceivedPacket {
     QuicSocketAddress client_address_, server_address_;
     int port_;
+    Buffer *buffer_;
+    uint64_t forwarded_us_; //time when packet is forwarded to other worker. only set if tracing enabled
    public:
     Packet(const char* buffer,
            size_t length,
@@ -45,6 +68,10 @@ class NqPacketReader {
     inline QuicSocketAddress &client_address() { return client_address_; }
     inline void set_port(int port) { port_ = port; }
     inline int port() const { return port_; }
+    inline void set_buffer(Buffer *b) { buffer_ = b; }
+    inline Buffer *buffer() { return buffer_; }
+    inline void set_forwarded_us(uint64_t ts) { forwarded_us_ = ts; }
+    inline uint64_t forwarded_us() const { return forwarded_us_; }
     inline uint64_t ConnectionId() const {
       switch (data()[0] & 0x08) {
         case 0x08:
@@ -54,6 +81,8 @@ class NqPacketReader {
           return 0;
       }
     } 
+    //client sets version flag until it receives first packet from server
+    inline bool HasVersion() const { return (data()[0] & 0x01) != 0; }
   };
   class Delegate {
    public:
@@ -64,6 +93,10 @@ class NqPacketReader {
 
   ~NqPacketReader();
 
+  // change number of packets read by one recvmmsg call. 
+  // should be called before first Read call.
+  void Configure(int batch_size);
+
   // Reads a number of packets from the given fd, and then passes them off to
   // the PacketProcessInterface.  Returns true if there may be additional
   // packets available on the socket.
@@ -71,24 +104,40 @@ class NqPacketReader {
   // to track dropped packets and some packets are read.
   // If the socket has timestamping enabled, the per packet timestamps will be
   // passed to the processor. Otherwise, |clock| will be used.
+  // if |gro| is true, fd should be enabled UDP_GRO by EnableGRO, and coalesced packets
+  // are passed to delegate as the slices of one large buffer.
   bool Read(int fd, int port, const QuicClock& clock, 
-            Delegate *delegate, QuicPacketCount* packets_dropped);
+            Delegate *delegate, QuicPacketCount* packets_dropped, bool gro = false);
+
+  // enable UDP_GRO for fd. returns false if kernel does not support.
+  static bool EnableGRO(int fd);
 
   // memory pool
-  inline void Pool(char *buffer, Packet *packet) { 
-    buffer_pool_.push(buffer);
+  inline void Pool(Packet *packet) { 
+    auto b = packet->buffer();
+    packet->~Packet();
     packet_pool_.push(reinterpret_cast<char*>(packet));
+    Release(b);
+  }
+  inline void Release(Buffer *b) {
+    if (b->Unref()) {
+      b->Reset();
+      (b->capacity() > kMaxPacketSize ? gro_buffer_pool_ : buffer_pool_).push(b);
+    }
   }
-  inline char *NewBuffer() { 
-    if (buffer_pool_.size() > 0) {
-      auto p = buffer_pool_.top();
-      buffer_pool_.pop();
+  inline Buffer *NewBuffer(bool gro = false) { 
+    auto &pool = gro ? gro_buffer_pool_ : buffer_pool_;
+    if (pool.size() > 0) {
+      auto p = pool.top();
+      pool.pop();
       return p;
     } else {
-      return new char[kMaxPacketSize];
+      size_t capacity = gro ? kMaxGROBufferSize : kMaxPacketSize;
+      return new(new char[sizeof(Buffer) + capacity]) Buffer(capacity);
     }
   }
-  inline Packet *NewPacket(const char* buffer,
+  inline Packet *NewPacket(Buffer *buffer,
+           const char *data,
            size_t length,
            QuicTime receipt_time,
            int ttl,
@@ -102,7 +151,9 @@ class NqPacketReader {
     } else {
       p =new char[sizeof(Packet)];
     }
-    return new(p) Packet(buffer, length, receipt_time, ttl, ttl_valid, client_sockaddr, server_ip, server_port);
+    auto pkt = new(p) Packet(data, length, receipt_time, ttl, ttl_valid, client_sockaddr, server_ip, server_port);
+    pkt->set_buffer(buffer);
+    return pkt;
   }
 
  private:
@@ -114,7 +165,8 @@ class NqPacketReader {
                         int port,
                         const QuicClock& clock,
                         Delegate *delegate,
-                        QuicPacketCount* packets_dropped);
+                        QuicPacketCount* packets_dropped,
+                        bool gro);
 
   // Reads and dispatches a single packet using recvmsg.
   bool ReadPackets(int fd,
@@ -123,27 +175,29 @@ class NqPacketReader {
                           Delegate *delegate,
                           QuicPacketCount* packets_dropped);
  private:
-  std::stack<char *> buffer_pool_;
+  std::stack<Buffer *> buffer_pool_;
+  std::stack<Buffer *> gro_buffer_pool_;
   std::stack<char *> packet_pool_;
   // Storage only used when recvmmsg is available.
 #if MMSG_MORE
+  // cmsg space for kSpaceForCmsg + UDP_GRO segment size
+  static const int kSpaceForCmsg = QuicSocketUtils::kSpaceForCmsg + CMSG_SPACE(sizeof(int));
   struct PacketData {
     iovec iov;
     // raw_address is used for address information provided by the recvmmsg
     // call on the packets.
     struct sockaddr_storage raw_address;
     // cbuf is used for ancillary data from the kernel on recvmmsg.
-    char cbuf[QuicSocketUtils::kSpaceForCmsg];
-    // buf is used for the data read from the kernel on recvmmsg.
-    char *buf;
+    char cbuf[kSpaceForCmsg];
+    // buf is used for the data read from the kernel on recvmmsg. 
+    // nullptr after its ownership moved to received packets
+    Buffer *buf;
   };
-  // TODO(danzh): change it to be a pointer to avoid the allocation on the stack
-  // from exceeding maximum allowed frame size.
   // packets_ and mmsg_hdr_ are used to supply cbuf and buf to the recvmmsg
-  // call.
-  PacketData packets_[kNumPacketsPerReadMmsgCall];
-  mmsghdr mmsg_hdr_[kNumPacketsPerReadMmsgCall];
-  int last_packets_read_;
+  // call. allocated on heap because number of packets is configurable.
+  int batch_size_;
+  std::unique_ptr<PacketData[]> packets_;
+  std::unique_ptr<mmsghdr[]> mmsg_hdr_;
 #endif
 
   DISALLOW_COPY_AND_ASSIGN(NqPacketReader);
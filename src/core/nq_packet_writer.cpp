@@ -1,4 +1,5 @@
 #include "core/nq_packet_writer.h"
+#include "core/nq_trace.h"
 
 #include <errno.h>
 #include <netinet/in.h>
@@ -15,6 +16,18 @@
 #include "net/quic/platform/api/quic_socket_address.h"
 #include "net/tools/quic/platform/impl/quic_socket_utils.h"
 
+#include "core/nq_loop.h"
+
+#if MMSG_SEND
+#include <netinet/udp.h>
+#if !defined(SOL_UDP)
+#define SOL_UDP 17
+#endif
+#if !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103
+#endif
+#endif
+
 extern bool chaos_write();
 
 namespace net {
@@ -96,6 +109,43 @@ WriteResult NqPacketWriter::WritePacket(
 #endif
 }
 
+NqPacketWriter::~NqPacketWriter() {
+  if (n_batched_ > 0) {
+    Flush();
+  }
+  if (flush_scheduled_) {
+    loop_->UnscheduleFlush(this);
+  }
+  reachability_tracked_ = false;
+}
+
+void NqPacketWriter::Detach() {
+  if (n_batched_ > 0) {
+    Flush();
+    n_batched_ = 0;
+  }
+  if (flush_scheduled_) {
+    loop_->UnscheduleFlush(this);
+    flush_scheduled_ = false;
+  }
+  set_fd(-1);
+}
+
+void NqPacketWriter::EnableBatchMode(NqLoop *loop, int batch_size) {
+#if MMSG_SEND
+  ASSERT(batch_size > 0 && n_batched_ == 0);
+  loop_ = loop;
+  batch_size_ = batch_size;
+  batch_.reset(new BatchEntry[batch_size]);
+  hdrs_.reset(new mmsghdr[batch_size]);
+  iovs_.reset(new iovec[batch_size]);
+  peers_.reset(new sockaddr_storage[batch_size]);
+  cbufs_.reset(new MsgControl[batch_size]);
+  first_packet_.reset(new int[batch_size + 1]);
+  gso_supported_ = DetectGSO(fd());
+#endif
+}
+
 WriteResult NqPacketWriter::WritePacket(
     const char* buffer,
     size_t buf_len,
@@ -105,11 +155,195 @@ WriteResult NqPacketWriter::WritePacket(
   DCHECK(!IsWriteBlocked());
   DCHECK(nullptr == options)
       << "QuicDefaultPacketWriter does not accept any options.";
+  //first packet written after app callback of traced packet (see NqTracer)
+  auto t = NqTracer::Current();
+  bool traced = t != nullptr && t->WaitWrite();
+  if (traced) {
+    t->OnWrite();
+  }
+  if (IsBatchMode()) {
+    if (buf_len <= kMaxPacketSize) {
+      if (n_batched_ >= batch_size_ && Flush() > 0) {
+        //still no room. socket should be blocked
+        return WriteResult(WRITE_STATUS_BLOCKED, EAGAIN);
+      }
+      auto &e = batch_[n_batched_++];
+      memcpy(e.buf_, buffer, buf_len);
+      e.len_ = buf_len;
+      e.self_address_ = self_address;
+      e.peer_address_ = peer_address;
+      traced_ = traced_ || traced;
+      if (!flush_scheduled_) {
+        flush_scheduled_ = true;
+        loop_->ScheduleFlush(this);
+      }
+      return WriteResult(WRITE_STATUS_OK, buf_len);
+    }
+    //too large to buffer. send buffered packets first, not to overtake them
+    if (n_batched_ > 0 && Flush() > 0) {
+      return WriteResult(WRITE_STATUS_BLOCKED, EAGAIN);
+    }
+  }
   WriteResult result = WritePacket(fd(), buffer, buf_len,
                                    self_address, peer_address, reachability_tracked_);
+  if (traced) {
+    t->OnSent();
+  }
   if (result.status == WRITE_STATUS_BLOCKED) {
     set_write_blocked(true);
   }
   return result;
 }
+
+void NqPacketWriter::SetWritable() {
+  QuicDefaultPacketWriter::SetWritable();
+  if (n_batched_ > 0) {
+    Flush();
+  }
+}
+
+#if MMSG_SEND
+/* static */
+bool NqPacketWriter::DetectGSO(int fd) {
+  int gso_size = 0;
+  socklen_t optlen = sizeof(gso_size);
+  return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso_size, &optlen) == 0;
+}
+
+size_t NqPacketWriter::SetupControl(const QuicIpAddress &self_address, uint16_t gso_size, char *cbuf) {
+  size_t len = 0;
+  if (self_address.IsInitialized()) {
+    if (!(cached_self_address_ == self_address)) {
+      msghdr hdr;
+      hdr.msg_control = cached_cmsg_;
+      hdr.msg_controllen = sizeof(cached_cmsg_);
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+      QuicSocketUtils::SetIpInfoInCmsg(self_address, cmsg);
+      cached_cmsg_len_ = CMSG_SPACE(cmsg->cmsg_len - CMSG_LEN(0));
+      cached_self_address_ = self_address;
+    }
+    memcpy(cbuf, cached_cmsg_, cached_cmsg_len_);
+    len = cached_cmsg_len_;
+  }
+  if (gso_size > 0) {
+    auto cmsg = reinterpret_cast<cmsghdr *>(cbuf + len);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(uint16_t));
+    len += CMSG_SPACE(sizeof(uint16_t));
+  }
+  return len;
+}
+
+int NqPacketWriter::Flush() {
+  if (n_batched_ <= 0 || IsWriteBlocked()) {
+    return n_batched_;
+  }
+  auto hdrs = hdrs_.get();
+  auto iovs = iovs_.get();
+  auto peers = peers_.get();
+  auto cbufs = cbufs_.get();
+  auto first_packet = first_packet_.get();
+  int n_sent = 0;
+  while (n_sent < n_batched_) {
+    //build messages. consecutive packets to the same peer are sent as one gso message,
+    //if all but last segments have same size.
+    int n_msg = 0, i = n_sent;
+    while (i < n_batched_) {
+      auto &head = batch_[i];
+      int j = i + 1;
+      if (gso_supported_) {
+        size_t total = head.len_;
+        while (j < n_batched_ && (j - i) < kDefaultBatchSize) {
+          auto &e = batch_[j];
+          if (batch_[j - 1].len_ != head.len_ || e.len_ > head.len_ ||
+              (total + e.len_) > 65000 ||
+              !(e.peer_address_ == head.peer_address_) ||
+              !(e.self_address_ == head.self_address_)) {
+            break;
+          }
+          total += e.len_;
+          j++;
+        }
+      }
+      for (int k = i; k < j; k++) {
+        iovs[k].iov_base = batch_[k].buf_;
+        iovs[k].iov_len = batch_[k].len_;
+      }
+      auto &h = hdrs[n_msg].msg_hdr;
+      peers[n_msg] = head.peer_address_.generic_address();
+      h.msg_name = &peers[n_msg];
+      h.msg_namelen = nq::Syscall::GetSockAddrLen(peers[n_msg].ss_family);
+      h.msg_iov = iovs + i;
+      h.msg_iovlen = j - i;
+      h.msg_flags = 0;
+      auto clen = SetupControl(head.self_address_, (j - i) > 1 ? head.len_ : 0, cbufs[n_msg].buf_);
+      h.msg_control = clen > 0 ? cbufs[n_msg].buf_ : nullptr;
+      h.msg_controllen = clen;
+      hdrs[n_msg].msg_len = 0;
+      first_packet[n_msg++] = i;
+      i = j;
+    }
+    first_packet[n_msg] = i;
+    //send built messages
+    int n_msg_sent = 0;
+    while (n_msg_sent < n_msg) {
+      int rc = sendmmsg(fd(), hdrs + n_msg_sent, n_msg - n_msg_sent, 0);
+      if (rc > 0) {
+        n_msg_sent += rc;
+        continue;
+      } else if (rc == 0) {
+        //nothing sent and errno is not set. retry when socket become writable
+        set_write_blocked(true);
+        break;
+      }
+      int eno = errno;
+      if (rc < 0 && eno == EINTR) {
+        continue;
+      } else if (rc < 0 && nq::Syscall::WriteMayBlocked(eno, reachability_tracked_)) {
+        set_write_blocked(true);
+        break;
+      } else if (rc < 0 && eno == EIO && gso_supported_ && hdrs[n_msg_sent].msg_hdr.msg_iovlen > 1) {
+        //NIC cannot offload segmentation (eg. checksum offload disabled). fallback to normal send
+        QUIC_LOG(WARNING) << "UDP_SEGMENT not usable on fd " << fd() << ", disable it";
+        gso_supported_ = false;
+        break;
+      }
+      //give up the message and continue
+      QUIC_LOG(ERROR) << "sendmmsg failed: " << strerror(eno) << "(" << eno << ")"; 
+      n_msg_sent++;
+    }
+    n_sent = first_packet[n_msg_sent];
+    if (IsWriteBlocked() || n_msg_sent < n_msg) {
+      if (IsWriteBlocked()) {
+        break;
+      }
+      continue; //rebuild messages without gso
+    }
+  }
+  //keep unsent packets for next flush
+  int n_remain = n_batched_ - n_sent;
+  for (int k = 0; k < n_remain; k++) {
+    auto &to = batch_[k], &from = batch_[n_sent + k];
+    memcpy(to.buf_, from.buf_, from.len_);
+    to.len_ = from.len_;
+    to.self_address_ = from.self_address_;
+    to.peer_address_ = from.peer_address_;
+  }
+  n_batched_ = n_remain;
+  if (traced_) {
+    traced_ = false;
+    auto t = NqTracer::Current();
+    if (t != nullptr && t->WaitSent()) {
+      t->OnSent();
+    }
+  }
+  return n_remain;
+}
+#else
+int NqPacketWriter::Flush() {
+  return 0;
+}
+#endif
 }
@@ -1,29 +1,98 @@
 #pragma once
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <memory>
+
 #include "net/tools/quic/quic_default_packet_writer.h"
 #include "net/quic/platform/api/quic_logging.h"
 
 #include "basis/defs.h"
 #include "basis/syscall.h"
 
+#if defined(__linux__)
+#define MMSG_SEND 1
+#else
+#define MMSG_SEND 0
+#endif
+
 namespace net {
+class NqLoop;
 class NqPacketWriter : public QuicDefaultPacketWriter {
+ public:
+  //max packets buffered in batch mode before forced flush.
+  //also upper bound of UDP_SEGMENT segments per single gso send (kernel limit is 64)
+  static const int kDefaultBatchSize = 64;
  protected:
+  //packet buffered in batch mode.
+  struct BatchEntry {
+    QuicIpAddress self_address_;
+    QuicSocketAddress peer_address_;
+    size_t len_;
+    char buf_[kMaxPacketSize];
+  };
   bool reachability_tracked_;
+  //batch mode state. enabled only when loop_ != nullptr
+  NqLoop *loop_;
+  int batch_size_, n_batched_;
+  bool flush_scheduled_, gso_supported_, traced_;
+  std::unique_ptr<BatchEntry[]> batch_;
+  //last encoded IP_PKTINFO/IPV6_PKTINFO cmsg, because self address rarely changes
+  QuicIpAddress cached_self_address_;
+  size_t cached_cmsg_len_;
+  char cached_cmsg_[CMSG_SPACE(sizeof(in6_pktinfo))];
+#if MMSG_SEND
+  //buffers to build sendmmsg arguments on Flush. allocated with batch_size_ entries by EnableBatchMode
+  struct MsgControl {
+    char buf_[CMSG_SPACE(sizeof(in6_pktinfo)) + CMSG_SPACE(sizeof(uint16_t))];
+  };
+  std::unique_ptr<mmsghdr[]> hdrs_;
+  std::unique_ptr<iovec[]> iovs_;
+  std::unique_ptr<sockaddr_storage[]> peers_;
+  std::unique_ptr<MsgControl[]> cbufs_;
+  std::unique_ptr<int[]> first_packet_;
+#endif
+
   static WriteResult WritePacket(int fd,
                                  const char* buffer,
                                  size_t buf_len,
                                  const QuicIpAddress& self_address,
-                                 const QuicSocketAddress& peer_address, 
+                                 const QuicSocketAddress& peer_address,
                                  bool reachability_tracked);
  public:
-  NqPacketWriter(nq::Fd fd) : QuicDefaultPacketWriter(fd), reachability_tracked_(false) {}
-  ~NqPacketWriter() override { reachability_tracked_ = false; }
+  NqPacketWriter(nq::Fd fd) : QuicDefaultPacketWriter(fd), reachability_tracked_(false),
+    loop_(nullptr), batch_size_(0), n_batched_(0), flush_scheduled_(false), gso_supported_(false),
+    traced_(false), batch_(), cached_self_address_(), cached_cmsg_len_(0) {}
+  ~NqPacketWriter() override;
   void SetReachabilityTracked(bool on) { reachability_tracked_ = on; }
+  //enable batch mode. written packets are buffered and actually sent by Flush,
+  //which is called by loop when it finishes processing current events.
+  //if kernel supports, consecutive packets to same peer are coalesced with UDP_SEGMENT (GSO).
+  //no effect on the platform which does not support sendmmsg.
+  void EnableBatchMode(NqLoop *loop, int batch_size = kDefaultBatchSize);
+  inline bool IsBatchMode() const { return loop_ != nullptr; }
+  inline bool HasPendingPackets() const { return n_batched_ > 0; }
+  //send all buffered packets. returns number of packets which still remain in buffer
+  //(because socket is blocked). remains are sent when socket become writable again.
+  int Flush();
+  //called before fd is closed. try to send buffered packets and discard remains, 
+  //because fd number may be reused by other socket after closed.
+  void Detach();
+
+  // implements QuicPacketWriter
   WriteResult WritePacket(const char* buffer,
                           size_t buf_len,
                           const QuicIpAddress& self_address,
                           const QuicSocketAddress& peer_address,
                           PerPacketOptions* options) override;
+  void SetWritable() override;
+ protected:
+  friend class NqLoop;
+  inline void OnFlushUnscheduled() { flush_scheduled_ = false; }
+#if MMSG_SEND
+  size_t SetupControl(const QuicIpAddress &self_address, uint16_t gso_size, char *cbuf);
+  static bool DetectGSO(int fd);
+#endif
 };
 }
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+
+#include "net/quic/core/quic_constants.h"
+
+#include "nq.h"
+#include "basis/header_codec.h"
+
+namespace net {
+//record = length encoded by nq::LengthCodec + payload. used by NqSimpleStreamHandler
+struct NqLengthFrame {
+  struct Header {};
+  static const nq_size_t kMaxHeaderLength = 8;
+  //returns length of header or 0 if more bytes needed
+  static inline nq_size_t Decode(const char *p, nq_size_t len, Header *h, nq_size_t *reclen) {
+    return nq::LengthCodec::Decode(reclen, p, len);
+  }
+};
+//record = header encoded by nq::HeaderCodec + length + payload. used by NqSimpleRPCStreamHandler
+struct NqRPCFrame {
+  struct Header {
+    int16_t type_;
+    nq_msgid_t msgid_;
+  };
+  static const nq_size_t kMaxHeaderLength = 16;
+  static inline nq_size_t Decode(const char *p, nq_size_t len, Header *h, nq_size_t *reclen) {
+    auto ofs = nq::HeaderCodec::Decode(&h->type_, &h->msgid_, p, len);
+    if (ofs == 0) {
+      return 0;
+    }
+    auto lofs = nq::LengthCodec::Decode(reclen, p + ofs, len - ofs);
+    return lofs == 0 ? 0 : (ofs + lofs);
+  }
+};
+
+//decodes records directly from the regions which QuicStreamSequencer returns, without copy.
+//only the bytes of the record which straddles regions, are kept in pending_.
+//record longer than max_record_len is treated as broken stream data, so that corrupted or 
+//hostile length does not make pending_ grow unlimitedly. default is the limit of stream receive window.
+template <class FRAME>
+class NqRecordParser {
+ public:
+  typedef typename FRAME::Header Header;
+  static const nq_size_t kDefaultMaxRecordLength = (nq_size_t)kStreamReceiveWindowLimit;
+ protected:
+  std::string pending_;
+  nq_size_t max_record_len_;
+ public:
+  NqRecordParser(nq_size_t max_record_len = kDefaultMaxRecordLength) : 
+    pending_(), max_record_len_(max_record_len) {}
+  inline size_t pending_length() const { return pending_.length(); }
+  //call f(const Header &, const char *payload, nq_size_t payload_len) for each complete record in p.
+  //payload pointer is only valid in f. returns false if stream data is broken.
+  template <class F>
+  bool Parse(const char *p, nq_size_t len, F f) {
+    Header h;
+    nq_size_t hdlen, reclen;
+    while (pending_.length() > 0) {
+      //complete the record straddles regions first
+      hdlen = FRAME::Decode(pending_.data(), pending_.length(), &h, &reclen);
+      if (hdlen == 0) {
+        if (pending_.length() >= FRAME::kMaxHeaderLength) {
+          return false;
+        }
+        //header is still incomplete. take bytes at most max header length
+        nq_size_t take = std::min(len, (nq_size_t)(FRAME::kMaxHeaderLength - pending_.length()));
+        if (take <= 0) {
+          return true;
+        }
+        pending_.append(p, take);
+        p += take; len -= take;
+        continue;
+      }
+      if (reclen > max_record_len_) {
+        return false;
+      }
+      size_t total = hdlen + reclen;
+      if (pending_.length() > total) {
+        //bytes of following record are taken while completing header. give them back.
+        //they always come from p, because header is incomplete before last append.
+        auto excess = pending_.length() - total;
+        p -= excess; len += excess;
+        pending_.resize(total);
+      } else if (pending_.length() < total) {
+        nq_size_t take = std::min(len, (nq_size_t)(total - pending_.length()));
+        pending_.append(p, take);
+        p += take; len -= take;
+        if (pending_.length() < total) {
+          return true;
+        }
+      }
+      f(h, pending_.data() + hdlen, reclen);
+      pending_.clear();
+    }
+    while (len > 0) {
+      hdlen = FRAME::Decode(p, len, &h, &reclen);
+      if (hdlen == 0) {
+        if (len >= FRAME::kMaxHeaderLength) {
+          return false;
+        }
+        break;
+      }
+      if (reclen > max_record_len_) {
+        return false;
+      }
+      if ((hdlen + reclen) > len) {
+        break;
+      }
+      f(h, p + hdlen, reclen);
+      p += (hdlen + reclen); len -= (hdlen + reclen);
+    }
+    if (len > 0) {
+      pending_.assign(p, len);
+    }
+    return true;
+  }
+};
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "nq.h"
+#include "net/quic/core/quic_types.h"
+
+namespace net {
+//connection id => worker index table, for the connections which are not owned by
+//the worker of conn_id % n_worker (placed to less loaded worker when they are accepted).
+//looked up for every received packet, so lookup does not take lock while table is empty,
+//which is almost always true for the server which load is balanced.
+//
+//entry is added when first packet of the connection arrives, which may be spoofed or abandoned, 
+//so it expires unless the session is actually created by target worker (Confirm) before deadline. 
+//confirmed entry is removed when its connection enters time-wait list.
+class NqRouteTable {
+  static const int kNumShard = 16;
+  struct Entry {
+    int worker_index_;
+    nq_time_t expire_at_; //0 if confirmed
+  };
+  struct Shard {
+    std::mutex mutex_;
+    std::unordered_map<QuicConnectionId, Entry> map_;
+  };
+  Shard shards_[kNumShard];
+  std::atomic<size_t> size_;
+ public:
+  NqRouteTable() : size_(0) {}
+  inline size_t size() const { return size_.load(std::memory_order_relaxed); }
+  //returns -1 if conn_id is not overridden
+  inline int Find(QuicConnectionId conn_id) {
+    if (size() <= 0) {
+      return -1;
+    }
+    auto &s = shard(conn_id);
+    std::unique_lock<std::mutex> lock(s.mutex_);
+    auto it = s.map_.find(conn_id);
+    return it != s.map_.end() ? it->second.worker_index_ : -1;
+  }
+  inline void Add(QuicConnectionId conn_id, int worker_index, nq_time_t expire_at) {
+    auto &s = shard(conn_id);
+    std::unique_lock<std::mutex> lock(s.mutex_);
+    Entry e = { worker_index, expire_at };
+    if (s.map_.emplace(conn_id, e).second) {
+      size_++;
+    }
+  }
+  //called when session for conn_id is created. entry no more expires
+  inline void Confirm(QuicConnectionId conn_id) {
+    if (size() <= 0) {
+      return;
+    }
+    auto &s = shard(conn_id);
+    std::unique_lock<std::mutex> lock(s.mutex_);
+    auto it = s.map_.find(conn_id);
+    if (it != s.map_.end()) {
+      it->second.expire_at_ = 0;
+    }
+  }
+  inline void Remove(QuicConnectionId conn_id) {
+    if (size() <= 0) {
+      return;
+    }
+    auto &s = shard(conn_id);
+    std::unique_lock<std::mutex> lock(s.mutex_);
+    if (s.map_.erase(conn_id) > 0) {
+      size_--;
+    }
+  }
+  //remove unconfirmed entries which expire before now, from the shards which index % n_sweeper == sweeper_index.
+  //so that each worker can sweep its part periodically.
+  inline void Sweep(nq_time_t now, int sweeper_index, int n_sweeper) {
+    if (size() <= 0) {
+      return;
+    }
+    for (int i = sweeper_index; i < kNumShard; i += n_sweeper) {
+      auto &s = shards_[i];
+      std::unique_lock<std::mutex> lock(s.mutex_);
+      for (auto it = s.map_.begin(); it != s.map_.end(); ) {
+        if (it->second.expire_at_ != 0 && it->second.expire_at_ < now) {
+          it = s.map_.erase(it);
+          size_--;
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+ protected:
+  //lower bits are used for worker selection (conn_id % n_worker), so use upper bits
+  inline Shard &shard(QuicConnectionId conn_id) { return shards_[(conn_id >> 32) % kNumShard]; }
+};
+}
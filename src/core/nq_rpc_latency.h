@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nq.h"
+#include "basis/hdr_histogram.h"
+
+namespace net {
+//latency of rpc calls made by the client loop, from nq_rpc_call(_ex) invocation (including time in boxer queue)
+//to completion, per stream name and rpc type. each kind of completion (reply, timeout, goaway) has its own histogram,
+//so that timed out calls do not pollute percentiles of replied calls.
+//entries are only added and recorded by the loop thread, and can be read from any thread without blocking it.
+class NqRPCLatency {
+ public:
+  enum Completion {
+    Reply,
+    Timeout,
+    Goaway,
+    CompletionMax,
+  };
+  class Entry {
+    friend class NqRPCLatency;
+    std::string name_;
+    uint16_t type_;
+    nq::HdrHistogram histograms_[CompletionMax]; //in nsec
+    std::unique_ptr<nq::HdrHistogram[]> snapshots_; //value at last snapshot. protected by NqRPCLatency::mutex_
+    Entry *next_;
+   public:
+    Entry(const std::string &name, uint16_t type) : name_(name), type_(type), histograms_(), snapshots_(), next_(nullptr) {}
+    inline void Record(Completion c, nq_time_t start_ts) {
+      auto now = nq_time_now();
+      histograms_[c].Record(now > start_ts ? (now - start_ts) : 0);
+    }
+  };
+  NqRPCLatency() : head_(nullptr), mutex_() {}
+  ~NqRPCLatency() {
+    auto e = head_.load(std::memory_order_relaxed);
+    while (e != nullptr) {
+      auto next = e->next_;
+      delete e;
+      e = next;
+    }
+  }
+  //only called from loop thread. entries are never removed, so handlers can cache returned pointer.
+  Entry *FindOrAdd(const std::string &name, uint16_t type) {
+    for (auto e = head_.load(std::memory_order_relaxed); e != nullptr; e = e->next_) {
+      if (e->type_ == type && e->name_ == name) {
+        return e;
+      }
+    }
+    auto e = new Entry(name, type);
+    e->next_ = head_.load(std::memory_order_relaxed);
+    head_.store(e, std::memory_order_release);
+    return e;
+  }
+  //thread safe. if since_last_snapshot is true, summarizes calls completed after previous such call.
+  //callback receives array of summaries and its size, which is only valid during the callback.
+  void Summarize(bool since_last_snapshot, nq_on_client_rpc_latency_t cb) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<nq_rpc_latency_t> results;
+    std::unique_ptr<nq::HdrHistogram> delta;
+    for (auto e = head_.load(std::memory_order_acquire); e != nullptr; e = e->next_) {
+      nq_rpc_latency_t r;
+      r.name = e->name_.c_str();
+      r.type = e->type_;
+      nq_histogram_t *outs[CompletionMax] = { &r.reply, &r.timeout, &r.goaway };
+      if (since_last_snapshot && e->snapshots_ == nullptr) {
+        e->snapshots_.reset(new nq::HdrHistogram[CompletionMax]);
+      }
+      for (int i = 0; i < CompletionMax; i++) {
+        if (!since_last_snapshot) {
+          e->histograms_[i].Summarize(outs[i], 1);
+          continue;
+        }
+        if (delta == nullptr) { delta.reset(new nq::HdrHistogram()); }
+        delta->Diff(e->histograms_[i], e->snapshots_[i]);
+        delta->Summarize(outs[i], 1);
+        //snapshot + delta = value when this snapshot is taken
+        e->snapshots_[i].Merge(*delta);
+      }
+      results.push_back(r);
+    }
+    nq_closure_call(cb, results.data(), (int)results.size());
+  }
+ private:
+  std::atomic<Entry*> head_;
+  std::mutex mutex_;
+};
+}
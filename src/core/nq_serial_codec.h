@@ -1,6 +1,5 @@
 #pragma once
 
-#include <map>
 #include <mutex>
 #include <algorithm>
 
@@ -8,6 +7,7 @@
 
 #include "nq.h"
 #include "basis/id_factory.h"
+#include "basis/slot_map.h"
 
 namespace net {
 typedef uint32_t NqSessionIndex; //logical serial for session
@@ -16,16 +16,22 @@ typedef uint32_t NqAlarmIndex;   //logical serial for alarm
 
 /*
 conn serial: 64 bit
-  client: [session index 31bit][client bit 1bit][timestamp 32bit]
-  server: [session index 31bit][client bit 1bit][timestamp 32bit]
+  client: [session index 31bit][client bit 1bit][generation 32bit]
+  server: [session index 31bit][client bit 1bit][generation 32bit]
 
-stream serial: 128 bit
-  client: [stream index 31bit][client bit 1bit][timestamp 32bit]
-  server: [stream index 31bit][client bit 1bit][timestamp 32bit]
+stream serial: 64 bit
+  client: [stream index 31bit][client bit 1bit][generation 32bit]
+  server: [stream index 31bit][client bit 1bit][generation 32bit]
 
-alarm serial: 128 bit
-  client: [alarm index 31bit][client bit 1bit][timestamp 32bit]
-  server: [alarm index 31bit][client bit 1bit][timestamp 32bit]
+alarm serial: 64 bit
+  client: [alarm index 31bit][client bit 1bit][generation 32bit]
+  server: [alarm index 31bit][client bit 1bit][generation 32bit]
+
+generation:
+  session and alarm: generation of the slot in NqSessiontMap. incremented each time the slot is reused.
+  stream: always 1. stream index is given by monotonic IdFactory, so it is not reused 
+  until 2^31 streams are created in the same loop.
+  generation is never 0, so serial is never empty.
 
 equality:
   128 bit serial is same
@@ -48,21 +54,28 @@ class NqSerial : public nq_serial_t {
   static inline void Clear(nq_serial_t &serial) {
     serial.data[0] = 0;
   }
+  //used for validating handle from the thread which does not own the object. see NqStaticSection
+  static inline bool IsSameAtomic(const nq_serial_t &stored, const nq_serial_t &s) {
+    return __atomic_load_n(&stored.data[0], __ATOMIC_SEQ_CST) == s.data[0];
+  }
+  static inline void ClearAtomic(nq_serial_t &serial) {
+    __atomic_store_n(&serial.data[0], 0, __ATOMIC_SEQ_CST);
+  }
   static inline uint64_t InfoBits(const nq_serial_t &serial) {
     return serial.data[0];
   }
   template <typename INDEX>
-  static inline void Encode(nq_serial_t &out_serial, INDEX object_index, bool is_client) {
+  static inline void Encode(nq_serial_t &out_serial, INDEX object_index, uint32_t generation, bool is_client) {
     STATIC_ASSERT(sizeof(INDEX) <= sizeof(uint32_t), "INDEX template type should be with in word");
-    ASSERT(object_index <= 0x7FFFFFFF);
-    out_serial.data[0] = (uint64_t)(nq_time_unix() << 32) | ((uint64_t)object_index) | (is_client ? CLIENT_BIT : 0);
+    ASSERT(object_index <= 0x7FFFFFFF && generation != 0);
+    out_serial.data[0] = (((uint64_t)generation) << 32) | ((uint64_t)object_index) | (is_client ? CLIENT_BIT : 0);
   }
   template <typename INDEX>
   static inline INDEX ObjectIndex(const nq_serial_t &serial) {
     STATIC_ASSERT(sizeof(INDEX) <= sizeof(uint32_t), "INDEX template type should be with in word");
     return (INDEX)((NqSerial::InfoBits(serial) & 0x000000007FFFFFFF));
   } 
-  static inline uint32_t Timestamp(const nq_serial_t &serial) {
+  static inline uint32_t Generation(const nq_serial_t &serial) {
     return (uint32_t)((serial.data[0] & 0xFFFFFFFF00000000) >> 32);
   }
   static inline bool IsClient(const nq_serial_t &serial) {
@@ -102,6 +115,9 @@ class NqSerial : public nq_serial_t {
   inline void Clear() {
     NqSerial::Clear(*this);
   }
+  inline void ClearAtomic() {
+    NqSerial::ClearAtomic(*this);
+  }
   inline const std::string Dump() const {
     return NqSerial::Dump(*this);
   }
@@ -109,12 +125,12 @@ class NqSerial : public nq_serial_t {
 
 class NqAlarmSerialCodec {
  public:
-  static inline void ServerEncode(nq_serial_t &out_serial, NqAlarmIndex alarm_index) {
-    NqSerial::Encode(out_serial, alarm_index, false);
+  static inline void ServerEncode(nq_serial_t &out_serial, NqAlarmIndex alarm_index, uint32_t generation) {
+    NqSerial::Encode(out_serial, alarm_index, generation, false);
   }
 
-  static inline void ClientEncode(nq_serial_t &out_serial, NqAlarmIndex alarm_index) {
-    NqSerial::Encode(out_serial, alarm_index, true);
+  static inline void ClientEncode(nq_serial_t &out_serial, NqAlarmIndex alarm_index, uint32_t generation) {
+    NqSerial::Encode(out_serial, alarm_index, generation, true);
   }
 
   static inline NqAlarmIndex ClientAlarmIndex(const nq_serial_t &s) { return NqSerial::ObjectIndex<NqAlarmIndex>(s); } 
@@ -122,12 +138,12 @@ class NqAlarmSerialCodec {
 };
 class NqConnSerialCodec {
  public:
-  static inline void ServerEncode(nq_serial_t &out_serial, NqSessionIndex session_index) {
-    NqSerial::Encode(out_serial, session_index, false);
+  static inline void ServerEncode(nq_serial_t &out_serial, NqSessionIndex session_index, uint32_t generation) {
+    NqSerial::Encode(out_serial, session_index, generation, false);
   }
 
-  static inline void ClientEncode(nq_serial_t &out_serial, NqSessionIndex session_index) {
-    NqSerial::Encode(out_serial, session_index, true);
+  static inline void ClientEncode(nq_serial_t &out_serial, NqSessionIndex session_index, uint32_t generation) {
+    NqSerial::Encode(out_serial, session_index, generation, true);
   }
 
   static inline NqSessionIndex ClientSessionIndex(const nq_serial_t &s) { return NqSerial::ObjectIndex<NqSessionIndex>(s); }
@@ -135,55 +151,47 @@ class NqConnSerialCodec {
 };
 class NqStreamSerialCodec {
  public:
+  static const uint32_t kGeneration = 1;
   static inline void ServerEncode(nq_serial_t &out_serial, NqStreamIndex stream_index) {
-    NqSerial::Encode(out_serial, stream_index, false);
+    NqSerial::Encode(out_serial, stream_index, kGeneration, false);
   }
 
   static inline void ClientEncode(nq_serial_t &out_serial, NqStreamIndex stream_index) {
-    NqSerial::Encode(out_serial, stream_index, true);
+    NqSerial::Encode(out_serial, stream_index, kGeneration, true);
   }
 
   static inline QuicStreamId ClientStreamIndex(const nq_serial_t &s) { return NqSerial::ObjectIndex<QuicStreamId>(s); }
   static inline QuicStreamId ServerStreamIndex(const nq_serial_t &s) { return NqSerial::ObjectIndex<QuicStreamId>(s); }
 };
+//owner of sessions or alarms, which gives index and generation for their serial.
 template <class S, typename INDEX>
-class NqSessiontMap : protected std::map<INDEX, S*> {
-  nq::IdFactory<INDEX> idgen_;
+class NqSessiontMap : protected nq::SlotMap<S*, INDEX> {
  public:
-  typedef std::map<INDEX, S*> container;
-  NqSessiontMap() : container(), idgen_() {}
+  typedef nq::SlotMap<S*, INDEX> container;
+  NqSessiontMap() : container() {}
   ~NqSessiontMap() { Clear(); }
-  inline INDEX NewId() { 
-    return idgen_.New(); 
-  }
   inline void Clear() {
-    for (auto &kv : *this) {
-      delete kv.second;
-    }
-    container::clear();
+    container::Iter([this](INDEX idx, S *s) {
+      container::Remove(idx);
+      delete s;
+    });
   }
   inline void Iter(std::function<void (INDEX, S*)> cb) {
-    for (auto it = container::begin(); it != container::end(); ) {
-      typename container::iterator kv = it;
-      ++it;
-      cb(kv->first, kv->second);
-    }
+    container::Iter(cb);
   }
   inline INDEX Add(S *s) { 
-    auto idx = NewId();
-    (*this)[idx] = s; 
-    return idx;
+    return container::Add(s);
   }
   inline void Remove(INDEX idx) {
-    auto it = container::find(idx);
-    if (it != container::end()) {
-      container::erase(it);
-    }
+    container::Remove(idx);
   }
   inline S *Find(INDEX idx) {
-    auto it = container::find(idx);
-    return it != container::end() ? it->second : nullptr;
+    return container::Find(idx);
+  }
+  inline uint32_t Generation(INDEX idx) const {
+    return container::Generation(idx);
   }
+  inline size_t size() const { return container::size(); }
 };
 
 template <class H, class P>
@@ -0,0 +1,118 @@
+#include "core/nq_server.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace net {
+struct MetricDesc {
+  const char *name_, *type_, *help_;
+  size_t offset_;
+};
+#define METRIC(__name, __type, __help) \
+  { #__name, __type, __help, offsetof(nq_worker_metrics_t, __name) }
+static const MetricDesc kMetricDescs[] = {
+  METRIC(recv_calls, "counter", "number of recvmmsg (or recvmsg) calls"),
+  METRIC(packets_received, "counter", "packets read from socket"),
+  METRIC(packets_forwarded, "counter", "packets forwarded to the worker which owns connection"),
+  METRIC(packets_processed, "counter", "packets processed by sessions"),
+  METRIC(ops_processed, "counter", "cross thread operations processed"),
+  METRIC(alarms_fired, "counter", "alarms fired"),
+  METRIC(loop_polls, "counter", "iterations of worker loop"),
+  METRIC(packet_queue_depth, "gauge", "forwarded packets not processed yet"),
+  METRIC(invoke_queue_depth, "gauge", "cross thread operations not processed yet"),
+  METRIC(sessions, "gauge", "sessions owned by worker"),
+  METRIC(chlos_buffered, "gauge", "connections waiting for being accepted"),
+};
+#undef METRIC
+//caller (usually app's main thread) should not be blocked long by slow collector
+static const int kUnixSocketTimeoutMs = 1000;
+
+static bool WriteAll(int fd, const std::string &buf) {
+  size_t sent = 0;
+  while (sent < buf.length()) {
+    auto r = write(fd, buf.data() + sent, buf.length() - sent);
+    if (r < 0) {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+    sent += r;
+  }
+  return true;
+}
+static bool WriteToUnixSocket(const char *path, const std::string &buf) {
+  struct sockaddr_un sa;
+  if (strlen(path) >= sizeof(sa.sun_path)) {
+    return false;
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  //also bounds connect, which blocks while backlog of collector is full
+  struct timeval tv = { kUnixSocketTimeoutMs / 1000, (kUnixSocketTimeoutMs % 1000) * 1000 };
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) {
+    close(fd);
+    return false;
+  }
+  bool ok = connect(fd, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa)) == 0 && WriteAll(fd, buf);
+  close(fd);
+  return ok;
+}
+static bool WriteToFile(const char *path, const std::string &buf) {
+  //write to temporary file and rename it, so that reader never sees partially written file.
+  //temporary file name is unique, not to be clobbered by concurrent dump to the same path
+  std::string tmp = std::string(path) + ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    return false;
+  }
+  //mkstemp creates file with 0600, but collector may run as other user
+  bool ok = fchmod(fd, 0644) == 0 && WriteAll(fd, buf);
+  close(fd);
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool NqServer::DumpMetrics(const char *path) {
+  std::vector<nq_worker_metrics_t> metrics(n_worker_);
+  if (Metrics(metrics.data(), n_worker_) <= 0) {
+    return false;
+  }
+  std::string buf;
+  char line[256];
+  for (auto &d : kMetricDescs) {
+    bool counter = strcmp(d.type_, "counter") == 0;
+    snprintf(line, sizeof(line), "# HELP nq_worker_%s%s %s\n# TYPE nq_worker_%s%s %s\n", 
+      d.name_, counter ? "_total" : "", d.help_, d.name_, counter ? "_total" : "", d.type_);
+    buf += line;
+    for (uint32_t i = 0; i < n_worker_; i++) {
+      auto v = *reinterpret_cast<const uint64_t *>(reinterpret_cast<const char *>(&metrics[i]) + d.offset_);
+      snprintf(line, sizeof(line), "nq_worker_%s%s{worker=\"%u\"} %llu\n", 
+        d.name_, counter ? "_total" : "", i, (unsigned long long)v);
+      buf += line;
+    }
+  }
+  const char kUnixPrefix[] = "unix:";
+  if (strncmp(path, kUnixPrefix, sizeof(kUnixPrefix) - 1) == 0) {
+    return WriteToUnixSocket(path + sizeof(kUnixPrefix) - 1, buf);
+  }
+  return WriteToFile(path, buf);
+}
+}
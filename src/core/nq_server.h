@@ -6,11 +6,13 @@
 #include <map>
 #include <tuple>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 
 #include "basis/handler_map.h"
 #include "core/nq_worker.h"
 #include "core/nq_config.h"
+#include "core/nq_route_table.h"
 
 namespace net {
 class NqServer {
@@ -43,11 +45,18 @@ class NqServer {
   std::condition_variable cond_;
   std::thread shutdown_thread_;
   nq::IdFactory<uint32_t> stream_index_factory_;
+  NqRouteTable route_table_;
+  std::unique_ptr<std::atomic<uint32_t>[]> worker_loads_;
 
  public:
 	NqServer(uint32_t n_worker) : 
     status_(RUNNING), n_worker_(n_worker), worker_queue_(nullptr), invoke_queues_list_(), 
-    stream_index_factory_(0x7FFFFFFF) {}
+    stream_index_factory_(0x7FFFFFFF), route_table_(), 
+    worker_loads_(new std::atomic<uint32_t>[n_worker]) {
+    for (uint32_t i = 0; i < n_worker; i++) {
+      worker_loads_[i] = 0;
+    }
+  }
   ~NqServer() {}
   nq::HandlerMap *Open(const nq_addr_t *addr, const nq_svconf_t *conf) {
     if (port_configs_.find(addr->port) != port_configs_.end()) {
@@ -77,6 +86,27 @@ class NqServer {
 			return NQ_EALLOC;
 		}
     int r = 0;
+    //create all workers first, because workers wake up each other via workers_ 
+		for (uint32_t i = 0; i < n_worker_; i++) {
+			workers_[i] = new NqWorker(i, *this);
+		}
+    //bind sockets here in order of worker index, 
+    //because reuseport steering program selects socket by its index in SO_REUSEPORT group.
+    for (uint32_t i = 0; i < n_worker_; i++) {
+      if (!workers_[i]->Bind()) {
+        //including sockets of workers_[i] which are created before failure
+        for (uint32_t j = 0; j <= i; j++) {
+          workers_[j]->Unbind();
+        }
+        return NQ_ESYSCALL;
+      }
+    }
+    for (auto &kv : port_configs_) {
+      if (kv.second.server().use_reuseport_steering && n_worker_ > 1) {
+        //program is shared in the group, so attaching to one socket is enough
+        NqWorker::AttachSteeringProgram(workers_[0]->listen_fd(kv.first), n_worker_);
+      }
+    }
 		for (uint32_t i = 0; i < n_worker_; i++) {
 			if ((r = StartWorker(i)) < 0) {
 				return r;
@@ -105,6 +135,9 @@ class NqServer {
       std::unique_lock<std::mutex> lock(mutex_); //wait for Stop() call finished
       status_ = TERMINATING;
     }
+    for (auto &kv : workers_) {
+      kv.second->Wakeup(); //let worker notice shutdown immediately
+    }
     cond_.notify_all();
     {
       //wait for Stop() call finished by wait for condition_variable.
@@ -120,6 +153,64 @@ class NqServer {
     }
   }
   PacketQueue &Q4(int idx) { return worker_queue_[idx]; }
+  //send packet to the worker of idx and wake it up
+  inline void Forward(int idx, NqPacket *p) {
+    worker_queue_[idx].enqueue(p);
+    workers_.at(idx)->Wakeup();
+  }
+  inline void Wakeup(int idx) { workers_.at(idx)->Wakeup(); }
+  //fill metrics of workers. returns number of workers, or 0 if not started
+  int Metrics(nq_worker_metrics_t *metrics, int n_metrics) {
+    if (workers_.size() < n_worker_ || worker_queue_ == nullptr) {
+      return 0;
+    }
+    for (uint32_t i = 0; i < n_worker_ && (int)i < n_metrics; i++) {
+      auto &m = metrics[i];
+      workers_.at(i)->metrics().Read(&m);
+      m.packet_queue_depth = worker_queue_[i].size_approx();
+      m.invoke_queue_depth = 0;
+      for (auto &kv : invoke_queues_list_) {
+        m.invoke_queue_depth += kv.second[i].size_approx();
+      }
+    }
+    return n_worker_;
+  }
+  //get latency histogram of stage. if idx is negative, histograms of all workers are merged
+  bool Latency(int idx, nq_trace_stage_t stage, nq_histogram_t *hist) {
+    if (stage < 0 || stage >= NQ_TRACE_STAGE_MAX || workers_.size() < n_worker_ || idx >= (int)n_worker_) {
+      return false;
+    }
+    if (idx >= 0) {
+      NqTracer::Summarize(workers_.at(idx)->tracer().histogram(stage), hist);
+      return true;
+    }
+    std::unique_ptr<nq::HdrHistogram> merged(new nq::HdrHistogram());
+    for (uint32_t i = 0; i < n_worker_; i++) {
+      merged->Merge(workers_.at(i)->tracer().histogram(stage));
+    }
+    NqTracer::Summarize(*merged, hist);
+    return true;
+  }
+  //write metrics in prometheus text format to file or unix domain socket
+  bool DumpMetrics(const char *path);
+  inline bool RequestConnStats(int idx, nq_on_server_conn_stats_t cb) {
+    auto it = workers_.find(idx);
+    if (it == workers_.end()) {
+      return false;
+    }
+    it->second->RequestConnStats(cb);
+    return true;
+  }
+  inline NqRouteTable &route_table() { return route_table_; }
+  inline void UpdateLoad(int idx, uint32_t load) { worker_loads_[idx].store(load, std::memory_order_relaxed); }
+  inline uint32_t load(int idx) const { return worker_loads_[idx].load(std::memory_order_relaxed); }
+  inline int LeastLoadedWorker() const {
+    int least = 0;
+    for (uint32_t i = 1; i < n_worker_; i++) {
+      if (load(i) < load(least)) { least = i; }
+    }
+    return least;
+  }
   inline bool alive() const { return status_ == RUNNING; }
   inline bool terminated() const { return status_ == TERMINATED; }
   inline uint32_t n_worker() const { return n_worker_; }
@@ -141,8 +232,7 @@ class NqServer {
     cond_.notify_all();
   }
   int StartWorker(int index) {
-    auto l = new NqWorker(index, *this);
-    workers_[index] = l;
+    auto l = workers_[index];
     l->Start(worker_queue_[index]);
     return NQ_OK;
   } 
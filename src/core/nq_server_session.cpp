@@ -11,14 +11,14 @@ namespace net {
 NqServerSession::NqServerSession(QuicConnection *connection,
                                  const NqServer::PortConfig &port_config)
   : NqSession(connection, dispatcher(), this, port_config), //dispatcher implements QuicSession::Visitor interface
-  port_config_(port_config), own_handler_map_(), context_(nullptr) {
+  port_config_(port_config), own_handler_map_(), context_(nullptr), stream_table_() {
   init_crypto_stream();
 }
 nq_conn_t NqServerSession::ToHandle() { 
   return MakeHandle<nq_conn_t, NqSession::Delegate>(static_cast<NqSession::Delegate *>(this), session_serial_);
 }
-std::mutex &NqServerSession::static_mutex() {
-  return dispatcher()->session_allocator_body().Bss(this)->mutex();
+NqStaticSection &NqServerSession::static_section() {
+  return *(dispatcher()->session_allocator_body().Bss(this));
 }
 NqBoxer *NqServerSession::boxer() { 
   return static_cast<NqBoxer *>(dispatcher()); 
@@ -34,18 +34,13 @@ NqStream *NqServerSession::FindStream(QuicStreamId id) {
   return it != dynamic_streams().end() ? static_cast<NqStream *>(it->second.get()) : nullptr;
 }
 NqStream *NqServerSession::FindStreamBySerial(const nq_serial_t &s, bool include_closed) {
-  //TODO(iyatomi): now assume not so much stream with one session. 
-  //in that case, below code probably faster because of good memory locality. 
-  //but better to handle so-many-stream per session case separately
-  for (auto &kv : dynamic_streams()) {
-    auto st = static_cast<NqStream *>(kv.second.get());
-    TRACE("FindStreamBySerial: %p(a), s = %s, sts = %s %p %p", 
-      this, NqSerial::Dump(s).c_str(), st->stream_serial().Dump().c_str(), st, static_cast<NqServerStream *>(st)->context());
-    if (st->stream_serial() == s) {
-      return st;
-    }
+  auto it = stream_table_.find(NqStreamSerialCodec::ServerStreamIndex(s));
+  if (it != stream_table_.end()) {
+    return it->second->stream_serial() == s ? it->second : nullptr;
   }
   if (include_closed) {
+    //closed streams are soon deleted, and zombie streams only wait for ack. 
+    //they are rarely looked up, so just scan them.
     auto &closed_list = *closed_streams();
     for (auto &e : closed_list) {
       auto st = static_cast<NqStream *>(e.get());
@@ -64,9 +59,12 @@ NqStream *NqServerSession::FindStreamBySerial(const nq_serial_t &s, bool include
   }
   return nullptr;
 }
+void NqServerSession::OnStreamClose(NqStream *s) {
+  stream_table_.erase(NqStreamSerialCodec::ServerStreamIndex(s->stream_serial()));
+}
 void NqServerSession::InitSerial() {
   auto session_index = dispatcher()->server_map().Add(this);
-  NqConnSerialCodec::ServerEncode(session_serial_, session_index);
+  NqConnSerialCodec::ServerEncode(session_serial_, session_index, dispatcher()->server_map().Generation(session_index));
 }
 NqStreamIndex NqServerSession::NewStreamIndex() { 
   return dispatcher()->stream_index_factory().New(); 
@@ -106,13 +104,17 @@ bool NqServerSession::IsClient() const {
 }
 QuicStream* NqServerSession::CreateIncomingDynamicStream(QuicStreamId id) {
   auto s = new(dispatcher()) NqServerStream(id, this, false);
-  s->InitSerial(NewStreamIndex());
+  auto idx = NewStreamIndex();
+  s->InitSerial(idx);
+  stream_table_[idx] = s;
   ActivateStream(QuicWrapUnique(s));
   return s;
 }
 QuicStream* NqServerSession::CreateOutgoingDynamicStream() {
   auto s = new(dispatcher()) NqServerStream(GetNextOutgoingStreamId(), this, true);
-  s->InitSerial(NewStreamIndex());
+  auto idx = NewStreamIndex();
+  s->InitSerial(idx);
+  stream_table_[idx] = s;
   ActivateStream(QuicWrapUnique(s)); //activate here. it needs to send packet normally in stream OnOpen handler
   return s;
 }
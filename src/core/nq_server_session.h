@@ -2,6 +2,7 @@
 
 #include <map>
 #include <mutex>
+#include <unordered_map>
 
 #include "core/nq_session.h"
 #include "core/nq_server.h"
@@ -22,13 +23,15 @@ class NqServerSession : public NqSession,
   //if you set included closed to true, be careful to use returned value, 
   //this pointer soon will be invalid.
   NqStream *FindStreamBySerial(const nq_serial_t &s, bool include_closed = false);
+  //called when stream is closed (moved from dynamic streams to closed or zombie streams)
+  void OnStreamClose(NqStream *s);
   void InitSerial();
   inline void InvalidateSerial() { 
-    std::unique_lock<std::mutex> lk(static_mutex());
-    session_serial_.Clear(); 
+    session_serial_.ClearAtomic(); 
+    static_section().WaitUnpinned();
   }
 
-  std::mutex &static_mutex();
+  NqStaticSection &static_section();
   NqBoxer *boxer();
   NqDispatcher *dispatcher();
   inline const NqSerial &session_serial() const { return session_serial_; }
@@ -69,6 +72,8 @@ class NqServerSession : public NqSession,
   std::unique_ptr<nq::HandlerMap> own_handler_map_;
   NqSerial session_serial_;
   void *context_;
+  //stream index => stream, for the streams in dynamic_streams()
+  std::unordered_map<NqStreamIndex, NqStream *> stream_table_;
 };
 
 }
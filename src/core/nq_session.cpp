@@ -11,7 +11,7 @@ NqSession::NqSession(QuicConnection* connection,
                      Visitor* owner,
                      Delegate* delegate,
                      const QuicConfig& config) : 
-  QuicSession(connection, owner, config), delegate_(delegate) {
+  QuicSession(connection, owner, config), delegate_(delegate), next_stats_publish_(QuicTime::Zero()) {
   //chromium implementation treat initial value (3) as special stream (header stream for SPDY)
   auto id = GetNextOutgoingStreamId();
   ASSERT(perspective() == Perspective::IS_SERVER || id == kHeadersStreamId);
@@ -50,5 +50,44 @@ void NqSession::OnCryptoHandshakeEvent(CryptoHandshakeEvent event) {
     delegate_->OnOpen();
   }
 }
+//FYI(iyatomi): both are called for every processed packet / ack, so stats snapshot is kept 
+//up to date without extra alarm. 
+void NqSession::OnCongestionWindowChange(QuicTime now) {
+  QuicSession::OnCongestionWindowChange(now);
+  MaybePublishStats(now);
+}
+void NqSession::PostProcessAfterData() {
+  QuicSession::PostProcessAfterData();
+  MaybePublishStats(connection()->clock()->ApproximateNow());
+}
+void NqSession::MaybePublishStats(QuicTime now) {
+  if (!delegate_->StatsRequested() || now < next_stats_publish_) {
+    return;
+  }
+  next_stats_publish_ = now + QuicTime::Delta::FromMicroseconds(kStatsPublishIntervalUs);
+  nq_conn_stats_t st;
+  GetConnStats(&st);
+  delegate_->PublishStats(st);
+}
+/* static */
+void NqSession::GetConnStats(QuicConnection *c, nq_conn_stats_t *st) {
+  auto &spm = c->sent_packet_manager();
+  auto &stats = c->GetStats(); //also updates rtt and bandwidth estimate in stats
+  st->srtt = nq_time_usec(stats.srtt_us);
+  st->min_rtt = nq_time_usec(stats.min_rtt_us);
+  st->cwnd = spm.GetCongestionWindowInBytes();
+  st->bytes_in_flight = spm.GetBytesInFlight();
+  st->bytes_sent = stats.bytes_sent;
+  st->bytes_received = stats.bytes_received;
+  st->bytes_retransmitted = stats.bytes_retransmitted;
+  st->packets_sent = stats.packets_sent;
+  st->packets_received = stats.packets_received;
+  st->packets_retransmitted = stats.packets_retransmitted;
+  st->packets_lost = stats.packets_lost;
+  st->loss_rate = stats.packets_sent > 0 ? ((double)stats.packets_lost / stats.packets_sent) : 0.0;
+  st->bandwidth_estimate = stats.estimated_bandwidth.ToBytesPerSecond();
+  auto sa = spm.GetSendAlgorithm();
+  st->pacing_rate = sa != nullptr ? sa->PacingRate(st->bytes_in_flight).ToBytesPerSecond() : 0;
+}
 
 } //net
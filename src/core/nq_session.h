@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 
 #include "net/quic/core/quic_session.h"
@@ -10,6 +11,7 @@
 #include "basis/defs.h"
 #include "basis/handler_map.h"
 #include "basis/id_factory.h"
+#include "basis/seqlock.h"
 #include "core/nq_serial_codec.h"
 #include "core/nq_static_section.h"
 
@@ -29,6 +31,7 @@ class NqSession : public QuicSession {
   };
   class Delegate {
    public:
+    Delegate() : stats_(), stats_requested_(false) {}
     virtual ~Delegate() {}
     virtual void *Context() const = 0;
     virtual void Destroy() = 0;
@@ -54,10 +57,38 @@ class NqSession : public QuicSession {
     inline NqSessionIndex SessionIndex() const { 
       return NqSerial::ObjectIndex<NqSessionIndex>(SessionSerial());
     }
+    //transport statistics is published by the thread which owns connection,
+    //and can be read from any thread while delegate is alive. 
+    //publishing starts after first RequestStats, so connections nobody reads do not pay for it.
+    inline bool StatsRequested() const { return stats_requested_.load(std::memory_order_relaxed); }
+    //returns true only for the first call. caller should let owner thread publish first snapshot 
+    //(PublishStats), because connection which is idle never publishes it by itself.
+    inline bool RequestStats() { 
+      return !StatsRequested() && !stats_requested_.exchange(true); 
+    }
+    inline void PublishStats(const nq_conn_stats_t &st) { stats_.Write(st); }
+    //publish current statistics of Connection(). should be called from the thread which owns connection.
+    //if client is reconnecting, published when new connection processes packets.
+    inline void PublishStats() {
+      if (!IsConnected()) {
+        return;
+      }
+      nq_conn_stats_t st;
+      NqSession::GetConnStats(Connection(), &st);
+      PublishStats(st);
+    }
+    //returns false if no snapshot is published yet
+    inline bool ReadStats(nq_conn_stats_t *st) const { return stats_.Read(st); }
+   private:
+    nq::SeqLock<nq_conn_stats_t> stats_;
+    std::atomic<bool> stats_requested_;
   };
  private:
+  //minimum interval of publishing stats snapshot
+  static const int64_t kStatsPublishIntervalUs = 10 * 1000;
   std::unique_ptr<QuicCryptoStream> crypto_stream_;
   Delegate *delegate_;
+  QuicTime next_stats_publish_;
  public:
   //NqSession takes ownership of connection
   NqSession(QuicConnection *connection,
@@ -81,6 +112,14 @@ class NqSession : public QuicSession {
                           const std::string& error_details,
                           ConnectionCloseSource source) override;
   void OnCryptoHandshakeEvent(CryptoHandshakeEvent event) override;
+  void OnCongestionWindowChange(QuicTime now) override;
+  void PostProcessAfterData() override;
+
+  //fill transport statistics of connection(). should be called from the thread which owns connection.
+  inline void GetConnStats(nq_conn_stats_t *st) { GetConnStats(connection(), st); }
+  static void GetConnStats(QuicConnection *c, nq_conn_stats_t *st);
+  //publish snapshot of statistics to delegate, if someone reads it and interval passed since last publish
+  void MaybePublishStats(QuicTime now);
 
  protected:
   //implements QuicSession
@@ -0,0 +1,88 @@
+#include "core/nq_shared_socket.h"
+
+#include "basis/syscall.h"
+#include "core/nq_client.h"
+#include "core/nq_network_helper.h"
+
+namespace net {
+bool NqSharedSocket::Open(const QuicSocketAddress &server_address) {
+  if (fd_ > -1) {
+    return true;
+  }
+  auto fd = QuicSocketUtils::CreateUDPSocket(server_address, &overflow_supported_);
+  if (fd < 0) {
+    return false;
+  }
+  if (server_address.host().address_family() == IpAddressFamily::IP_V4) {
+    address_ = QuicSocketAddress(QuicIpAddress::Any4(), 0);
+  } else {
+    address_ = QuicSocketAddress(QuicIpAddress::Any6(), 0);
+  }
+  sockaddr_storage addr = address_.generic_address();
+  socklen_t slen = nq::Syscall::GetSockAddrLen(addr.ss_family);
+  if (slen == 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), slen) < 0) {
+    QUIC_LOG(ERROR) << "Bind failed: " << strerror(errno);
+    nq::Syscall::Close(fd);
+    return false;
+  }
+  if (address_.FromSocket(fd) != 0) {
+    QUIC_LOG(ERROR) << "Unable to get self address.  Error: " << strerror(errno);
+  }
+  gro_supported_ = NqPacketReader::EnableGRO(fd);
+  reader_.Configure(kReadBatchSize);
+  if (loop_->Add(fd, this, NqLoop::EV_READ | NqLoop::EV_WRITE) < 0) {
+    nq::Syscall::Close(fd);
+    return false;
+  }
+  fd_ = fd;
+  return true;
+}
+void NqSharedSocket::Close() {
+  //all connections should be destroyed before
+  ASSERT(routes_.size() == 0);
+  if (fd_ > -1) {
+    loop_->Del(fd_);
+    TRACE("close shared fd: %d", fd_);
+    nq::Syscall::Close(fd_);
+    fd_ = -1;
+  }
+}
+void NqSharedSocket::OnEvent(Fd fd, const Event& event) {
+  if (NqLoop::Readable(event)) {
+    bool more_to_read = true;
+    while (more_to_read) {
+      more_to_read = reader_.Read(fd, address_.port(), *loop_, this, 
+                                  overflow_supported_ ? &packets_dropped_ : nullptr, gro_supported_);
+    }
+  }
+  if (NqLoop::Writable(event) && routes_.size() > 0) {
+    //socket is only blocked for the connections which actually got EAGAIN.
+    //FYI(iyatomi): copy first because OnCanWrite may close connection and modify routes_
+    blocked_.clear();
+    for (auto &kv : routes_) {
+      auto cl = kv.second->client();
+      if (cl->connected() && cl->writer()->IsWriteBlocked()) {
+        blocked_.push_back(kv.second);
+      }
+    }
+    for (auto h : blocked_) {
+      h->OnWritable();
+    }
+  }
+  if (NqLoop::Closed(event)) {
+    TRACE("closed %d", fd);
+  }
+}
+void NqSharedSocket::OnRecv(NqPacketReader::Packet *p) {
+  auto it = routes_.find(p->ConnectionId());
+  if (it != routes_.end() && it->second->client()->connected()) {
+    it->second->ProcessPacket(p);
+  } else {
+    //packet for already closed connection. connection id is never omitted because 
+    //NqClientConfig requests server to send full connection id when socket is shared.
+    //FYI(iyatomi): no public reset is needed, closed connection already sent connection close 
+    //and server drops its state on receiving it or by idle timeout.
+  }
+  reader_.Pool(p);
+}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "net/quic/core/quic_types.h"
+#include "net/quic/platform/api/quic_socket_address.h"
+
+#include "basis/io_processor.h"
+#include "core/nq_loop.h"
+#include "core/nq_packet_reader.h"
+
+namespace net {
+class NqNetworkHelper;
+//UDP socket shared by client connections of one NqClientLoop, which enable nq_clconf_t::use_shared_socket.
+//incoming packets are read in batch for all connections, and routed to each connection by connection id,
+//as NqDispatcher does in server side.
+class NqSharedSocket : public nq::IoProcessor,
+                       public NqPacketReader::Delegate {
+ public:
+  typedef nq::Fd Fd;
+  typedef nq::IoProcessor::Event Event;
+  //shared socket handles much more packets than per connection socket, so read more at once
+  static const int kReadBatchSize = 64;
+ private:
+  NqLoop *loop_;
+  Fd fd_;
+  QuicSocketAddress address_;
+  QuicPacketCount packets_dropped_;
+  bool overflow_supported_, gro_supported_;
+  NqPacketReader reader_;
+  std::unordered_map<QuicConnectionId, NqNetworkHelper*> routes_;
+  //reused on every writable event, not to allocate
+  std::vector<NqNetworkHelper*> blocked_;
+ public:
+  NqSharedSocket(NqLoop *loop) : loop_(loop), fd_(-1), address_(), packets_dropped_(0), 
+    overflow_supported_(false), gro_supported_(false), reader_(), routes_(), blocked_() {}
+  ~NqSharedSocket() { Close(); }
+  //create socket which has same address family as server_address, and bind it to ephemeral port
+  bool Open(const QuicSocketAddress &server_address);
+  void Close();
+  inline Fd fd() const { return fd_; }
+  inline const QuicSocketAddress &address() const { return address_; }
+  inline void Register(QuicConnectionId cid, NqNetworkHelper *h) { routes_[cid] = h; }
+  inline void Unregister(QuicConnectionId cid, NqNetworkHelper *h) {
+    auto it = routes_.find(cid);
+    if (it != routes_.end() && it->second == h) {
+      routes_.erase(it);
+    }
+  }
+
+  // implements nq::IoProcessor
+  void OnEvent(Fd fd, const Event &e) override;
+  void OnClose(Fd fd) override {}
+  int OnOpen(Fd fd) override { return NQ_OK; }
+
+  // implements NqPacketReader::Delegate
+  void OnRecv(NqPacketReader::Packet *p) override;
+};
+}
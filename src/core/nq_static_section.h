@@ -1,13 +1,35 @@
 #pragma once
 
+#include <atomic>
+#include <thread>
+
 namespace net {
 //statically allocated section which is related with object which is allocated with
 //nq::AllocatorWithBSS. this memory block keep on being alive even if related object freed.
+//
+//it holds number of threads which are validating handle of related object (pin count), 
+//so that handle can be validated without lock. protocol is:
+//  other thread: Pin => compare stored serial with handle's => use object if same => Unpin
+//  owner thread: clear stored serial => WaitUnpinned => free object
+//all of pin, serial load/store and pin count check are sequentially consistent, so either 
+//other thread sees cleared serial, or owner thread sees its pin and waits until it finishes using object.
 class NqStaticSection {
-  std::mutex mutex_;
+  std::atomic<uint32_t> pin_count_;
+  uint32_t padd_;
  public:
-  NqStaticSection() : mutex_() {}
+  class Pin {
+    NqStaticSection *section_;
+   public:
+    Pin(NqStaticSection *section) : section_(section) { section_->pin_count_.fetch_add(1); }
+    ~Pin() { section_->pin_count_.fetch_sub(1, std::memory_order_release); }
+  };
+  NqStaticSection() : pin_count_(0), padd_(0) {}
   ~NqStaticSection() {}
-  std::mutex &mutex() { return mutex_; }
+  //called by owner thread after stored serial is cleared
+  inline void WaitUnpinned() const {
+    while (pin_count_.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
 };  
-}
\ No newline at end of file
+}
@@ -8,6 +8,7 @@
 #include "core/nq_client_loop.h"
 #include "core/nq_dispatcher.h"
 #include "core/nq_unwrapper.h"
+#include "core/nq_trace.h"
 
 namespace net {
 
@@ -84,7 +85,7 @@ NqStreamHandler *NqStream::CreateStreamHandler(const nq::HandlerMap::HandlerEntr
   } break;
   case nq::HandlerMap::STREAM: {
     if (nq_closure_is_empty(he->stream.stream_reader)) {
-      s = new NqSimpleStreamHandler(this, he->stream.on_stream_record);
+      s = new NqSimpleStreamHandler(this, he->stream.on_stream_record, he->stream_records);
     } else {
       s = new NqRawStreamHandler(this, he->stream.on_stream_record, 
                                  he->stream.stream_reader, 
@@ -172,10 +173,19 @@ void NqStream::OnDataAvailable() {
     }
   }
   size_t consumed = 0;
+  //handler calls app callback for each received record
+  auto t = NqTracer::Current();
+  bool traced = t != nullptr && t->Active() && i < n_blocks;
+  if (traced) {
+    t->OnCallbackEnter();
+  }
   for (;i < n_blocks; i++) {
     handler_->OnRecv(NqStreamHandler::ToCStr(v[i].iov_base), v[i].iov_len);
     consumed += v[i].iov_len;
   }
+  if (traced) {
+    t->OnCallbackExit();
+  }
   sequencer()->MarkConsumed(consumed);  
 }
 
@@ -217,9 +227,9 @@ const std::string &NqClientStream::Protocol() const {
   return c->stream_manager().FindStreamName(
     NqStreamSerialCodec::ClientStreamIndex(stream_serial()));
 }
-std::mutex &NqClientStream::static_mutex() {
+NqStaticSection &NqClientStream::static_section() {
   auto cl = static_cast<NqClientLoop *>(stream_allocator());  
-  return cl->stream_allocator().Bss(this)->mutex();
+  return *(cl->stream_allocator().Bss(this));
 }
 
 
@@ -235,11 +245,13 @@ void NqServerStream::InitSerial(NqStreamIndex idx) {
 void NqServerStream::OnClose() {
   ASSERT(!nq_session()->delegate()->IsClient());
   NqStream::OnClose();
+  //remove from stream table before serial cleared, because serial contains its key
+  static_cast<NqServerSession *>(nq_session()->delegate())->OnStreamClose(this);
   InvalidateSerial();
 }
-std::mutex &NqServerStream::static_mutex() {
+NqStaticSection &NqServerStream::static_section() {
   auto cl = static_cast<NqDispatcher *>(stream_allocator());  
-  return cl->stream_allocator().Bss(this)->mutex();
+  return *(cl->stream_allocator().Bss(this));
 }
 
 
@@ -264,6 +276,39 @@ class AckHandler : public QuicAckListenerInterface {
     nq_closure_call(opt_.on_retransmit, retransmitted_bytes);
   }
 };
+/* static */
+NqSharedFrame *NqSharedFrame::NewStreamFrame(const void *p, nq_size_t len) {
+  const size_t hdlen = NqStreamHandler::len_buff_len;
+  auto f = new(nq::Syscall::MemAlloc(sizeof(NqSharedFrame) + hdlen + len)) NqSharedFrame(Stream, 0, 0);
+  auto buffer = const_cast<char *>(f->data());
+  auto ofs = nq::LengthCodec::Encode(len, buffer, hdlen);
+  memcpy(buffer + ofs, p, len);
+  f->payload_offset_ = ofs;
+  f->length_ = ofs + len;
+  return f;
+}
+/* static */
+NqSharedFrame *NqSharedFrame::NewNotifyFrame(uint16_t type, const void *p, nq_size_t len) {
+  ASSERT(type > 0);
+  const size_t hdlen = NqStreamHandler::header_buff_len + NqStreamHandler::len_buff_len;
+  auto f = new(nq::Syscall::MemAlloc(sizeof(NqSharedFrame) + hdlen + len)) NqSharedFrame(Notify, 0, 0);
+  auto buffer = const_cast<char *>(f->data());
+  size_t ofs = nq::HeaderCodec::Encode(static_cast<int16_t>(type), 0, buffer, hdlen);
+  ofs += nq::LengthCodec::Encode(len, buffer + ofs, hdlen - ofs);
+  memcpy(buffer + ofs, p, len);
+  f->payload_offset_ = ofs;
+  f->length_ = ofs + len;
+  return f;
+}
+void NqSharedFrame::Unref() {
+  if (refcnt_.fetch_sub(1) == 1) {
+    this->~NqSharedFrame();
+    nq::Syscall::MemFree(this);
+  }
+}
+
+
+
 void NqStreamHandler::WriteBytes(const char *p, nq_size_t len) {
   stream_->SendHandshake();
   stream_->WriteOrBufferData(QuicStringPiece(p, len), false, nullptr);
@@ -278,18 +323,42 @@ void NqStreamHandler::WriteBytes(const char *p, nq_size_t len, const nq_stream_o
 
 
 void NqSimpleStreamHandler::OnRecv(const void *p, nq_size_t len) {
-  //greedy read and called back
-	parse_buffer_.append(ToCStr(p), len);
-	const char *pstr = parse_buffer_.c_str();
-	size_t plen = parse_buffer_.length();
-	nq_size_t reclen = 0, read_ofs = nq::LengthCodec::Decode(&reclen, pstr, plen);
-	if (reclen > 0 && (reclen + read_ofs) <= plen) {
-	  nq_closure_call(on_recv_, stream_->ToHandle<nq_stream_t>(), pstr + read_ofs, reclen);
-	  parse_buffer_.erase(0, reclen + read_ofs);
-	} else if (reclen == 0 && plen > len_buff_len) { //TODO(iyatomi): use unlikely
-		//broken payload. should resolve payload length
-		stream_->Disconnect();
-	}
+  bool ok;
+  if (nq_closure_is_empty(on_recv_batch_)) {
+    //greedy read and called back
+    ok = parser_.Parse(ToCStr(p), len, [this](const NqLengthFrame::Header &, const char *pstr, nq_size_t reclen) {
+      nq_closure_call(on_recv_, stream_->ToHandle<nq_stream_t>(), pstr, reclen);
+    });
+  } else {
+    //records which are inside of p, are kept valid until this function returns. 
+    //but the record completed in parser's pending buffer is not, so it is given by itself.
+    //(it always comes first, so record order is kept)
+    nq_record_t records[kMaxBatchRecords];
+    int n_records = 0;
+    bool straddled = parser_.pending_length() > 0;
+    auto st = stream_->ToHandle<nq_stream_t>();
+    ok = parser_.Parse(ToCStr(p), len, [&](const NqLengthFrame::Header &, const char *pstr, nq_size_t reclen) {
+      if (straddled) {
+        straddled = false;
+        nq_record_t r = { ToPV(pstr), reclen };
+        nq_closure_call(on_recv_batch_, st, &r, 1);
+        return;
+      }
+      records[n_records].data = ToPV(pstr);
+      records[n_records].len = reclen;
+      if (++n_records >= kMaxBatchRecords) {
+        nq_closure_call(on_recv_batch_, st, records, n_records);
+        n_records = 0;
+      }
+    });
+    if (n_records > 0) {
+      nq_closure_call(on_recv_batch_, st, records, n_records);
+    }
+  }
+  if (!ok) {
+    //broken payload. should resolve payload length
+    stream_->Disconnect();
+  }
 }
 void NqSimpleStreamHandler::Send(const void *p, nq_size_t len) {
   QuicConnection::ScopedPacketBundler bundler(
@@ -316,76 +385,222 @@ void NqRawStreamHandler::OnRecv(const void *p, nq_size_t len) {
   
 
 
-void NqSimpleRPCStreamHandler::EntryRequest(nq_msgid_t msgid, nq_on_rpc_reply_t cb, nq_time_t timeout_duration_ts) {
+nq_msgid_t NqSimpleRPCStreamHandler::NewRequest() {
+  if (free_request_ == kNone && !GrowRequestTable()) {
+    return 0;
+  }
+  auto idx = free_request_;
+  auto &r = requests_[idx];
+  free_request_ = r.next_;
+  //generation is wrapped around so that msgid does not exceed limit
+  if (((nq_msgid_t)(r.generation_ + 1)) >= (msgid_limit_ >> request_table_bits_)) {
+    r.generation_ = 1;
+  } else {
+    r.generation_++;
+  }
+  r.msgid_ = (((nq_msgid_t)r.generation_) << request_table_bits_) | idx;
+  r.prev_ = r.next_ = r.queue_ = kNone;
+  return r.msgid_;
+}
+void NqSimpleRPCStreamHandler::EntryRequest(nq_msgid_t msgid, uint16_t type, nq_on_rpc_reply_t cb, 
+                                            nq_time_t timeout_duration_ts, nq_time_t call_ts) {
+  auto idx = FindRequest(msgid);
+  ASSERT(idx != kNone);
   if (stream()->stream_serial().IsEmpty()) {
     //if NqStreamHandler::WriteBytes fails, stream closed before returning it. 
+    RemoveRequest(idx);
     return;
   }
-  auto req = new Request(this, msgid, cb);
-  req_map_[msgid] = req;
+  auto qidx = FindOrAddDeadlineQueue(timeout_duration_ts);
+  auto &q = deadline_queues_[qidx];
+  auto &r = requests_[idx];
   auto now = nq_time_now();
-  req->Start(loop_, now + timeout_duration_ts);
+  r.on_reply_ = cb;
+  r.deadline_ = now + timeout_duration_ts;
+  r.call_ts_ = call_ts != 0 ? call_ts : now;
+  r.latency_ = LatencyEntry(type);
+  r.queue_ = qidx;
+  r.prev_ = q.tail_;
+  r.next_ = kNone;
+  if (q.tail_ != kNone) {
+    requests_[q.tail_].next_ = idx;
+  } else {
+    q.head_ = idx;
+  }
+  q.tail_ = idx;
+  ScheduleTimeout(r.deadline_);
+}
+void NqSimpleRPCStreamHandler::RemoveRequest(uint32_t idx) {
+  auto &r = requests_[idx];
+  if (r.queue_ != kNone) {
+    auto &q = deadline_queues_[r.queue_];
+    if (r.prev_ != kNone) { requests_[r.prev_].next_ = r.next_; } else { q.head_ = r.next_; }
+    if (r.next_ != kNone) { requests_[r.next_].prev_ = r.prev_; } else { q.tail_ = r.prev_; }
+  }
+  //FYI(iyatomi): alarm is not re-scheduled even if r is the head of the queue. 
+  //OnTimeout just re-schedules it when fired earlier than next deadline.
+  r.msgid_ = 0;
+  r.queue_ = kNone;
+  r.next_ = free_request_;
+  free_request_ = idx;
+}
+NqRPCLatency::Entry *NqSimpleRPCStreamHandler::LatencyEntry(uint16_t type) {
+  if (!nq_session()->delegate()->IsClient()) {
+    return nullptr;
+  }
+  //only a few rpc types are used by one stream, so just scan
+  for (auto &e : latency_entries_) {
+    if (e.first == type) {
+      return e.second;
+    }
+  }
+  auto cl = static_cast<NqClientLoop *>(stream_->GetBoxer());
+  auto e = cl->rpc_latency().FindOrAdd(stream_->Protocol(), type);
+  latency_entries_.push_back({ type, e });
+  return e;
+}
+bool NqSimpleRPCStreamHandler::GrowRequestTable() {
+  uint32_t bits = requests_.size() <= 0 ? kInitialRequestTableBits : (request_table_bits_ + 1);
+  //at least 2 generations should be available for each slot
+  if ((msgid_limit_ >> bits) < 3) {
+    return false;
+  }
+  uint32_t size = 1 << bits, mask = size - 1;
+  //free slots of new table start from the generation above any msgid already issued. otherwise 
+  //msgid of timed out request can be issued again just after growing, and its late reply is 
+  //delivered to the new request. slot keeps generation of its last msgid after it is freed.
+  nq_msgid_t max_issued = 0;
+  for (uint32_t i = 0; i < requests_.size(); i++) {
+    auto issued = (((nq_msgid_t)requests_[i].generation_) << request_table_bits_) | i;
+    if (requests_[i].generation_ > 0 && issued > max_issued) {
+      max_issued = issued;
+    }
+  }
+  std::vector<Request> requests(size);
+  for (auto &r : requests) {
+    r.msgid_ = 0;
+    r.generation_ = max_issued >> bits;
+    r.queue_ = kNone;
+  }
+  //in-flight requests are moved to the index of new table which msgid indicates.
+  //because msgid & old mask is unique, msgid & new mask is also unique.
+  auto remap = [this, mask](uint32_t idx) { 
+    return idx == kNone ? kNone : (requests_[idx].msgid_ & mask); 
+  };
+  for (auto &r : requests_) {
+    if (r.msgid_ == 0) { continue; }
+    auto &nr = requests[r.msgid_ & mask];
+    nr = r;
+    nr.generation_ = r.msgid_ >> bits;
+    nr.prev_ = remap(r.prev_);
+    nr.next_ = remap(r.next_);
+  }
+  for (auto &q : deadline_queues_) {
+    q.head_ = remap(q.head_);
+    q.tail_ = remap(q.tail_);
+  }
+  requests_.swap(requests);
+  request_table_bits_ = bits;
+  free_request_ = kNone;
+  for (uint32_t i = size; i > 0; i--) {
+    if (requests_[i - 1].msgid_ == 0) {
+      requests_[i - 1].next_ = free_request_;
+      free_request_ = i - 1;
+    }
+  }
+  return true;
+}
+uint32_t NqSimpleRPCStreamHandler::FindOrAddDeadlineQueue(nq_time_t duration) {
+  //usually only a few kinds of timeout duration used (mostly default_timeout_ts_), so just scan
+  for (uint32_t i = 0; i < deadline_queues_.size(); i++) {
+    if (deadline_queues_[i].duration_ == duration) {
+      return i;
+    }
+  }
+  deadline_queues_.push_back({ duration, kNone, kNone });
+  return deadline_queues_.size() - 1;
+}
+void NqSimpleRPCStreamHandler::ScheduleTimeout(nq_time_t deadline) {
+  if (alarm_deadline_ == 0 || deadline < alarm_deadline_) {
+    alarm_deadline_ = deadline;
+    alarm_.Start(loop_, deadline);
+  }
+}
+void NqSimpleRPCStreamHandler::OnTimeout() {
+  alarm_deadline_ = 0;
+  auto now = nq_time_now();
+  //callback may add or remove request, so search expired one from the first each time
+  while (true) {
+    uint32_t idx = kNone;
+    for (auto &q : deadline_queues_) {
+      if (q.head_ != kNone && requests_[q.head_].deadline_ <= now) {
+        idx = q.head_;
+        break;
+      }
+    }
+    if (idx == kNone) {
+      break;
+    }
+    auto cb = CompleteRequest(idx, NqRPCLatency::Timeout);
+    nq_closure_call(cb, stream_->ToHandle<nq_rpc_t>(), NQ_ETIMEOUT, "", 0);
+  }
+  for (auto &q : deadline_queues_) {
+    if (q.head_ != kNone) {
+      ScheduleTimeout(requests_[q.head_].deadline_);
+    }
+  }
+}
+void NqSimpleRPCStreamHandler::Cleanup() {
+  for (uint32_t i = 0; i < deadline_queues_.size(); i++) {
+    uint32_t idx;
+    while ((idx = deadline_queues_[i].head_) != kNone) {
+      auto cb = CompleteRequest(idx, NqRPCLatency::Goaway);
+      nq_closure_call(cb, stream_->ToHandle<nq_rpc_t>(), NQ_EGOAWAY, "", 0);
+    }
+  }
+  alarm_.Stop(loop_);
+  alarm_deadline_ = 0;
 }
 void NqSimpleRPCStreamHandler::OnRecv(const void *p, nq_size_t len) {
   //TRACE("stream %llx handler OnRecv %u bytes", stream_->nq_session()->delegate()->SessionSerial().data[0], len);
   //greedy read and called back
-  parse_buffer_.append(ToCStr(p), len);
-  //prepare tmp variables
-  const char *pstr = parse_buffer_.c_str();
-  size_t plen = parse_buffer_.length(), read_ofs;
-  int16_t type_tmp; nq_msgid_t msgid; nq_size_t reclen;
-  nq_error_t type;
-  do {
-    //decode header
-    read_ofs = nq::HeaderCodec::Decode(&type_tmp, &msgid, pstr, plen);
-    /* tmp_ofs => length of encoded header, reclen => actual payload length */
-    auto tmp_ofs = nq::LengthCodec::Decode(&reclen, pstr + read_ofs, plen - read_ofs);
-    if (tmp_ofs == 0) { break; }
-    read_ofs += tmp_ofs;
-    if ((read_ofs + reclen) > plen) {
-      //TRACE("short of buffer %u %zu %zu\n", reclen, read_ofs, plen);
-      break;
-    }
-    //TRACE("sid = %llx, msgid, type = %u %d", stream_->nq_session()->delegate()->SessionSerial(), msgid, type_tmp);
-    /*
-      type > 0 && msgid != 0 => request
-      type <= 0 && msgid != 0 => reply
-      type > 0 && msgid == 0 => notify
-    */
-    type = static_cast<nq_error_t>(type_tmp);
-    pstr += read_ofs; //move pointer to top of payload
-    if (msgid != 0) {
-      if (type <= 0) {
-        auto it = req_map_.find(msgid);
-        if (it != req_map_.end()) {
-          auto req = it->second;
-          req_map_.erase(it);
-          //reply from serve side
-          nq_closure_call(req->on_reply_, stream_->ToHandle<nq_rpc_t>(), type, ToPV(pstr), reclen);
-          req->Destroy(loop_); //cancel firing alarm and free memory for req
-        } else {
-          //probably timedout. caller should already be received timeout error
-          //req object deleted in OnAlarm
-          //TRACE("stream handler reply: msgid not found %u", msgid);
-        }
+  if (!parser_.Parse(ToCStr(p), len, [this](const NqRPCFrame::Header &h, const char *pstr, nq_size_t reclen) {
+    OnRecord(h.type_, h.msgid_, pstr, reclen);
+  })) {
+    //broken payload. should resolve payload length
+    stream_->Disconnect();
+  }
+}
+void NqSimpleRPCStreamHandler::OnRecord(int16_t type_tmp, nq_msgid_t msgid, const char *pstr, nq_size_t reclen) {
+  //TRACE("sid = %llx, msgid, type = %u %d", stream_->nq_session()->delegate()->SessionSerial(), msgid, type_tmp);
+  /*
+    type > 0 && msgid != 0 => request
+    type <= 0 && msgid != 0 => reply
+    type > 0 && msgid == 0 => notify
+  */
+  auto type = static_cast<nq_error_t>(type_tmp);
+  if (msgid != 0) {
+    if (type <= 0) {
+      auto idx = FindRequest(msgid);
+      if (idx != kNone && requests_[idx].queue_ != kNone) {
+        auto cb = CompleteRequest(idx, NqRPCLatency::Reply);
+        //reply from serve side
+        nq_closure_call(cb, stream_->ToHandle<nq_rpc_t>(), type, ToPV(pstr), reclen);
       } else {
-        //request
-        //fprintf(stderr, "stream handler request: idx %u %llu\n", 
-          //nq::Endian::NetbytesToHost<uint32_t>(pstr), 
-          //nq::Endian::NetbytesToHost<uint64_t>(pstr + 4));
-        nq_closure_call(on_request_, stream_->ToHandle<nq_rpc_t>(), type, msgid, ToPV(pstr), reclen);
+        //probably timedout. caller should already be received timeout error
+        //TRACE("stream handler reply: msgid not found %u", msgid);
       }
-    } else if (type > 0) {
-      //notify
-      //TRACE("stream handler notify: type %u", type);
-      nq_closure_call(on_notify_, stream_->ToHandle<nq_rpc_t>(), type, ToPV(pstr), reclen);
     } else {
-      ASSERT(false);
+      //request
+      nq_closure_call(on_request_, stream_->ToHandle<nq_rpc_t>(), type, msgid, ToPV(pstr), reclen);
     }
-    parse_buffer_.erase(0, reclen + read_ofs);
-    pstr = parse_buffer_.c_str();
-    plen = parse_buffer_.length();
-  } while (parse_buffer_.length() > 0);
+  } else if (type > 0) {
+    //notify
+    //TRACE("stream handler notify: type %u", type);
+    nq_closure_call(on_notify_, stream_->ToHandle<nq_rpc_t>(), type, ToPV(pstr), reclen);
+  } else {
+    ASSERT(false);
+  }
 }
 void NqSimpleRPCStreamHandler::Notify(uint16_t type, const void *p, nq_size_t len) {
   QuicConnection::ScopedPacketBundler bundler(
@@ -399,19 +614,27 @@ void NqSimpleRPCStreamHandler::Notify(uint16_t type, const void *p, nq_size_t le
   memcpy(buffer + ofs, p, len);
   WriteBytes(buffer, ofs + len);  
 }
-void NqSimpleRPCStreamHandler::Call(uint16_t type, const void *p, nq_size_t len, nq_on_rpc_reply_t cb) {
+void NqSimpleRPCStreamHandler::Call(uint16_t type, const void *p, nq_size_t len, nq_on_rpc_reply_t cb, nq_time_t call_ts) {
   //QuicConnection::ScopedPacketBundler bundler(
     //nq_session()->connection(), QuicConnection::SEND_ACK_IF_QUEUED);
-  nq_msgid_t msgid = msgid_factory_.New();
+  nq_msgid_t msgid = NewRequest();
+  if (msgid == 0) {
+    nq_closure_call(cb, stream_->ToHandle<nq_rpc_t>(), NQ_EALLOC, "", 0);
+    return;
+  }
   SendCommon(type, msgid, p, len);
-  EntryRequest(msgid, cb, default_timeout_ts_);
+  EntryRequest(msgid, type, cb, default_timeout_ts_, call_ts);
 }
-void NqSimpleRPCStreamHandler::CallEx(uint16_t type, const void *p, nq_size_t len, nq_rpc_opt_t &opt) {
+void NqSimpleRPCStreamHandler::CallEx(uint16_t type, const void *p, nq_size_t len, nq_rpc_opt_t &opt, nq_time_t call_ts) {
   //QuicConnection::ScopedPacketBundler bundler(
     //nq_session()->connection(), QuicConnection::SEND_ACK_IF_QUEUED);
-  nq_msgid_t msgid = msgid_factory_.New();
+  nq_msgid_t msgid = NewRequest();
+  if (msgid == 0) {
+    nq_closure_call(opt.callback, stream_->ToHandle<nq_rpc_t>(), NQ_EALLOC, "", 0);
+    return;
+  }
   SendCommon(type, msgid, p, len);
-  EntryRequest(msgid, opt.callback, opt.timeout);
+  EntryRequest(msgid, type, opt.callback, opt.timeout, call_ts);
 }
 
 void NqSimpleRPCStreamHandler::Reply(nq_error_t result, nq_msgid_t msgid, const void *p, nq_size_t len) {
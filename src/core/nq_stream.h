@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "net/quic/core/quic_stream.h"
 #include "net/quic/core/quic_alarm.h"
@@ -12,7 +14,10 @@
 #include "core/nq_closure.h"
 #include "core/nq_loop.h"
 #include "core/nq_alarm.h"
+#include "core/nq_record_parser.h"
+#include "core/nq_rpc_latency.h"
 #include "core/nq_serial_codec.h"
+#include "core/nq_static_section.h"
 
 namespace net {
 
@@ -56,10 +61,10 @@ class NqStream : public QuicStream {
   virtual void **ContextBuffer() = 0;
   virtual NqBoxer *GetBoxer() = 0;
   virtual const std::string &Protocol() const = 0;
-  virtual std::mutex &StaticMutex() = 0;
+  virtual NqStaticSection &StaticSection() = 0;
   inline void InvalidateSerial() { 
-    std::unique_lock<std::mutex> lk(StaticMutex());
-    stream_serial_.Clear(); 
+    stream_serial_.ClearAtomic(); 
+    StaticSection().WaitUnpinned();
   }
 
   inline bool establish_side() const { return establish_side_; }
@@ -98,7 +103,7 @@ class NqClientStream : public NqStream {
     NqStream(id, nq_session, establish_side, priority) {}
 
   void InitSerial(NqStreamIndex idx);
-  std::mutex &static_mutex();
+  NqStaticSection &static_section();
   NqBoxer *boxer();
 
   NqBoxer *GetBoxer() override { return boxer(); }
@@ -106,7 +111,7 @@ class NqClientStream : public NqStream {
   void OnClose() override;
   void **ContextBuffer() override;
   const std::string &Protocol() const override;
-  std::mutex &StaticMutex() override { return static_mutex(); }
+  NqStaticSection &StaticSection() override { return static_section(); }
 };
 class NqServerStream : public NqStream {
   void *context_;
@@ -120,7 +125,7 @@ class NqServerStream : public NqStream {
   inline void *context() { return context_; }
 
   void InitSerial(NqStreamIndex idx);
-  std::mutex &static_mutex();
+  NqStaticSection &static_section();
   NqBoxer *boxer();
 
   NqBoxer *GetBoxer() override { return boxer(); }
@@ -128,11 +133,38 @@ class NqServerStream : public NqStream {
   void *Context() override { return context_; }
   void **ContextBuffer() override { return &context_; }
   const std::string &Protocol() const override { return buffer_; }
-  std::mutex &StaticMutex() override { return static_mutex(); }
+  NqStaticSection &StaticSection() override { return static_section(); }
 };
 
 
 
+//ref counted frame which is encoded once and written to multiple streams (eg. group broadcast).
+//frame is immutable after created, so can be shared between threads.
+class NqSharedFrame {
+ public:
+  enum Kind : uint8_t {
+    Stream = 1, //record of NqSimpleStreamHandler
+    Notify = 2, //notification of NqSimpleRPCStreamHandler
+  };
+ private:
+  std::atomic<int> refcnt_;
+  Kind kind_;
+  nq_size_t length_, payload_offset_;
+  NqSharedFrame(Kind kind, nq_size_t length, nq_size_t payload_offset) : 
+    refcnt_(1), kind_(kind), length_(length), payload_offset_(payload_offset) {}
+ public:
+  static NqSharedFrame *NewStreamFrame(const void *p, nq_size_t len);
+  static NqSharedFrame *NewNotifyFrame(uint16_t type, const void *p, nq_size_t len);
+  inline void Ref() { refcnt_.fetch_add(1); }
+  void Unref();
+  inline Kind kind() const { return kind_; }
+  inline const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+  inline nq_size_t length() const { return length_; }
+  //original payload, for the stream which needs to encode frame by itself
+  inline const void *payload() const { return data() + payload_offset_; }
+  inline nq_size_t payload_length() const { return length_ - payload_offset_; }
+};
+
 class NqStreamHandler {
  protected:
   NqStream *stream_;
@@ -147,6 +179,8 @@ class NqStreamHandler {
   virtual void Send(const void *p, nq_size_t len) = 0;  
   virtual void SendEx(const void *p, nq_size_t len, const nq_stream_opt_t &opt) = 0;  
   virtual void Cleanup() = 0;
+  //write pre-encoded frame. frame of the kind which this handler does not handle, is ignored.
+  virtual void SendFrame(const NqSharedFrame &f) = 0;
 
   //operation
   //it has same assumption and restriction as NqStream::RunTask
@@ -180,11 +214,15 @@ class NqStreamHandler {
 
 // A QUIC stream that separated with encoded length
 class NqSimpleStreamHandler : public NqStreamHandler {
+  //max records given to on_recv_batch_ at once
+  static const int kMaxBatchRecords = 64;
   nq_on_stream_record_t on_recv_;
-  std::string parse_buffer_;
+  nq_on_stream_records_t on_recv_batch_;
+  NqRecordParser<NqLengthFrame> parser_;
  public:
-  NqSimpleStreamHandler(NqStream *stream, nq_on_stream_record_t on_recv) : 
-    NqStreamHandler(stream), on_recv_(on_recv), parse_buffer_() {};
+  NqSimpleStreamHandler(NqStream *stream, nq_on_stream_record_t on_recv, 
+                        nq_on_stream_records_t on_recv_batch) : 
+    NqStreamHandler(stream), on_recv_(on_recv), on_recv_batch_(on_recv_batch), parser_() {};
 
   inline void SendCommon(const void *p, nq_size_t len, const nq_stream_opt_t *opt) {
     char buffer[len_buff_len + len];
@@ -202,6 +240,9 @@ class NqSimpleStreamHandler : public NqStreamHandler {
   void Send(const void *p, nq_size_t len) override;
   void SendEx(const void *p, nq_size_t len, const nq_stream_opt_t &opt) override;
   void Cleanup() override {}
+  void SendFrame(const NqSharedFrame &f) override {
+    if (f.kind() == NqSharedFrame::Stream) { WriteBytes(f.data(), f.length()); }
+  }
 
  private:
   DISALLOW_COPY_AND_ASSIGN(NqSimpleStreamHandler);
@@ -232,6 +273,10 @@ class NqRawStreamHandler : public NqStreamHandler {
   void Send(const void *p, nq_size_t len) override { SendCommon(p, len, nullptr); }
   void SendEx(const void *p, nq_size_t len, const nq_stream_opt_t &opt) override { SendCommon(p, len, &opt); }
   void Cleanup() override {}
+  //raw stream encodes record with its own writer, so only payload can be shared
+  void SendFrame(const NqSharedFrame &f) override {
+    if (f.kind() == NqSharedFrame::Stream) { SendCommon(f.payload(), f.payload_length(), nullptr); }
+  }
 
  private:
   DISALLOW_COPY_AND_ASSIGN(NqRawStreamHandler);
@@ -239,71 +284,100 @@ class NqRawStreamHandler : public NqStreamHandler {
 
 // A QUIC stream handles RPC style communication
 class NqSimpleRPCStreamHandler : public NqStreamHandler {
-  class Request : public NqAlarmBase {
+  static const uint32_t kNone = 0xFFFFFFFF;
+  static const uint32_t kInitialRequestTableBits = 4;
+  //in-flight request. stored in requests_ and directly indexed by msgid, 
+  //which is [generation][index of requests_], so that msgid of reused slot differs from previous one.
+  struct Request {
+    nq_on_rpc_reply_t on_reply_;
+    nq_time_t deadline_;
+    nq_time_t call_ts_;
+    NqRPCLatency::Entry *latency_; //nullptr if latency is not measured (server side)
+    nq_msgid_t msgid_;     //0 if slot is unused
+    uint32_t generation_;
+    uint32_t prev_, next_; //link of deadline queue. next_ is also used for free list
+    uint32_t queue_;       //index of deadline_queues_. kNone until EntryRequest called
+  };
+  //requests which have same timeout duration. requests are appended in the order of call,
+  //so queue is always sorted by deadline. 
+  struct DeadlineQueue {
+    nq_time_t duration_;
+    uint32_t head_, tail_;
+  };
+  //only earliest deadline among the heads of deadline queues, is registered to loop.
+  class TimeoutAlarm : public NqAlarmBase {
+    NqSimpleRPCStreamHandler *handler_;
    public:
-    Request(NqSimpleRPCStreamHandler *stream_handler, 
-            nq_msgid_t msgid,
-            nq_on_rpc_reply_t on_reply) : 
-            NqAlarmBase(), 
-            stream_handler_(stream_handler), on_reply_(on_reply), msgid_(msgid) {}
-    ~Request() {}
+    TimeoutAlarm(NqSimpleRPCStreamHandler *handler) : NqAlarmBase(), handler_(handler) {}
     void OnFire(NqLoop *) override { 
-      auto it = stream_handler_->req_map_.find(msgid_);
-      if (it != stream_handler_->req_map_.end()) {
-        nq_closure_call(on_reply_, stream_handler_->stream()->ToHandle<nq_rpc_t>(), NQ_ETIMEOUT, "", 0);
-        stream_handler_->req_map_.erase(it);
-      }
-      delete this;
-    }
-    inline void GoAway() {
-      nq_closure_call(on_reply_, stream_handler_->stream()->ToHandle<nq_rpc_t>(), NQ_EGOAWAY, "", 0);
+      ClearInvocationTS();
+      handler_->OnTimeout(); 
     }
-   private:
-    friend class NqSimpleRPCStreamHandler;
-    NqSimpleRPCStreamHandler *stream_handler_; 
-    nq_on_rpc_reply_t on_reply_;
-    nq_msgid_t msgid_/*, padd_[3]*/;
   };
-  void EntryRequest(nq_msgid_t msgid, nq_on_rpc_reply_t cb, nq_time_t timeout_duration_ts = 0);
+  //returns 0 if too many requests are in-flight
+  nq_msgid_t NewRequest();
+  void EntryRequest(nq_msgid_t msgid, uint16_t type, nq_on_rpc_reply_t cb, 
+                    nq_time_t timeout_duration_ts, nq_time_t call_ts);
+  inline uint32_t FindRequest(nq_msgid_t msgid) const {
+    auto idx = msgid & ((1 << request_table_bits_) - 1);
+    return (idx < requests_.size() && requests_[idx].msgid_ == msgid) ? idx : kNone;
+  }
+  void RemoveRequest(uint32_t idx);
+  //removes request and records its latency. returns callback of the request
+  inline nq_on_rpc_reply_t CompleteRequest(uint32_t idx, NqRPCLatency::Completion c) {
+    auto &r = requests_[idx];
+    auto cb = r.on_reply_;
+    if (r.latency_ != nullptr) { r.latency_->Record(c, r.call_ts_); }
+    RemoveRequest(idx);
+    return cb;
+  }
+  NqRPCLatency::Entry *LatencyEntry(uint16_t type);
+  bool GrowRequestTable();
+  uint32_t FindOrAddDeadlineQueue(nq_time_t duration);
+  void ScheduleTimeout(nq_time_t deadline);
+  void OnTimeout();
  private:
-  std::string parse_buffer_;
+  NqRecordParser<NqRPCFrame> parser_;
   nq_on_rpc_request_t on_request_;
   nq_on_rpc_notify_t on_notify_;
-  nq_time_t default_timeout_ts_;
-  nq::IdFactory<nq_msgid_t> msgid_factory_;
-  std::map<uint32_t, Request*> req_map_;
+  nq_time_t default_timeout_ts_, alarm_deadline_;
+  std::vector<Request> requests_;
+  std::vector<DeadlineQueue> deadline_queues_;
+  std::vector<std::pair<uint16_t, NqRPCLatency::Entry*>> latency_entries_;
+  uint32_t free_request_, request_table_bits_;
+  nq_msgid_t msgid_limit_;
+  TimeoutAlarm alarm_;
   NqLoop *loop_;
  public:
   NqSimpleRPCStreamHandler(NqStream *stream, 
     nq_on_rpc_request_t on_request, nq_on_rpc_notify_t on_notify, nq_time_t timeout, bool use_large_msgid) : 
-    NqStreamHandler(stream), parse_buffer_(), 
-    on_request_(on_request), on_notify_(on_notify), default_timeout_ts_(timeout),
-    msgid_factory_(), req_map_(),
+    NqStreamHandler(stream), parser_(), 
+    on_request_(on_request), on_notify_(on_notify), default_timeout_ts_(timeout), alarm_deadline_(0),
+    requests_(), deadline_queues_(), latency_entries_(), free_request_(kNone), request_table_bits_(0), 
+    msgid_limit_(use_large_msgid ? 0xFFFFFFFF : 0xFFFF), alarm_(this),
     loop_(stream->GetLoop()) {
-    if (!use_large_msgid) { msgid_factory_.set_limit(0xFFFF); }
     if (default_timeout_ts_ == 0) { default_timeout_ts_ = nq_time_sec(30); }
   }
 
-  ~NqSimpleRPCStreamHandler() {}
+  ~NqSimpleRPCStreamHandler() { alarm_.Stop(loop_); }
 
-  void Cleanup() override {
-    for (auto &kv : req_map_) {
-      kv.second->GoAway();
-      kv.second->Destroy(loop_);
-    }
-    req_map_.clear();
-  }
+  void Cleanup() override;
 
   //implements NqStream
   void OnRecv(const void *p, nq_size_t len) override;
   void Send(const void *p, nq_size_t len) override { ASSERT(false); }
   void SendEx(const void *p, nq_size_t len, const nq_stream_opt_t &opt) override { ASSERT(false); }  
-  virtual void Call(uint16_t type, const void *p, nq_size_t len, nq_on_rpc_reply_t cb);
-  virtual void CallEx(uint16_t type, const void *p, nq_size_t len, nq_rpc_opt_t &opt);
+  void SendFrame(const NqSharedFrame &f) override {
+    if (f.kind() == NqSharedFrame::Notify) { WriteBytes(f.data(), f.length()); }
+  }
+  //call_ts is the time when nq_rpc_call(_ex) is called. 0 means now
+  virtual void Call(uint16_t type, const void *p, nq_size_t len, nq_on_rpc_reply_t cb, nq_time_t call_ts = 0);
+  virtual void CallEx(uint16_t type, const void *p, nq_size_t len, nq_rpc_opt_t &opt, nq_time_t call_ts = 0);
   void Notify(uint16_t type, const void *p, nq_size_t len);
   void Reply(nq_error_t result, nq_msgid_t msgid, const void *p, nq_size_t len);
 
  protected:
+  void OnRecord(int16_t type, nq_msgid_t msgid, const char *p, nq_size_t len);
   inline void SendCommon(uint16_t type, nq_msgid_t msgid, const void *p, nq_size_t len) {
     ASSERT(type > 0);
     //pack and send buffer
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <sys/time.h>
+
+#include "nq.h"
+#include "basis/hdr_histogram.h"
+
+namespace net {
+//per message latency tracing of sampled received packets. one tracer is owned by each worker,
+//and the worker thread traces at most one packet at a time:
+//kernel rx -> (forwarded to other worker) -> dequeued and processed -> app callback entry ->
+//callback exit -> first packet written after callback -> sendmsg done.
+//total latency is kernel rx to callback exit, and reply path is measured separately.
+//duration of each stage is recorded to histogram of the stage (in usec), which can be read from any thread.
+//all timestamps are wall clock usec, which is same as receipt time of packets (see NqLoop::ConvertWallTimeToQuicTime)
+class NqTracer {
+ public:
+  enum State {
+    Idle,
+    Received,     //processing sampled packet
+    CallbackDone, //app callback finished, waiting reply is written
+    Written,      //reply is written, waiting it is actually sent
+  };
+  NqTracer() : state_(Idle), rx_us_(0), dequeue_us_(0), callback_enter_us_(0),
+               callback_exit_us_(0), write_us_(0), histograms_() {}
+
+  //thread local tracer, which is set by the worker thread
+  static inline NqTracer *Current() { return current_; }
+  static inline void SetCurrent(NqTracer *t) { current_ = t; }
+  static inline uint64_t NowInUsec() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return ((uint64_t)tv.tv_usec) + (((uint64_t)tv.tv_sec) * 1000 * 1000);
+  }
+
+  //called when processing of sampled packet starts. forwarded_us is 0 if packet is not forwarded
+  void Begin(uint64_t rx_us, uint64_t forwarded_us) {
+    if (state_ != Idle) {
+      Finish(false); //previous trace still waits flush. give up measuring its reply
+    }
+    dequeue_us_ = NowInUsec();
+    rx_us_ = rx_us;
+    Record(NQ_TRACE_RX_TO_DEQUEUE, rx_us_, dequeue_us_);
+    if (forwarded_us > 0) {
+      Record(NQ_TRACE_FORWARD, forwarded_us, dequeue_us_);
+    }
+    callback_enter_us_ = callback_exit_us_ = write_us_ = 0;
+    state_ = Received;
+  }
+  //called when processing of sampled packet finishes.
+  //if reply is buffered by batch mode writer, trace continues until it is flushed.
+  inline void End() {
+    if (state_ == Received || state_ == CallbackDone) {
+      Finish(false);
+    }
+  }
+  inline bool Active() const { return state_ == Received; }
+  //only first app callback for the packet is traced, because callback exit changes state
+  inline void OnCallbackEnter() { callback_enter_us_ = NowInUsec(); }
+  inline void OnCallbackExit() {
+    callback_exit_us_ = NowInUsec();
+    state_ = CallbackDone;
+  }
+  inline bool WaitWrite() const { return state_ == CallbackDone; }
+  //called when first packet is written after app callback. OnSent should be called 
+  //when the packet is actually sent (immediately, or when batch mode writer flushes it).
+  //FYI(iyatomi): the packet is not necessarily the reply written by the callback. it may be an ACK 
+  //or data of other stream, which is written before the reply.
+  inline void OnWrite() {
+    write_us_ = NowInUsec();
+    state_ = Written;
+  }
+  inline bool WaitSent() const { return state_ == Written; }
+  inline void OnSent() { Finish(true); }
+
+  //thread safe
+  inline const nq::HdrHistogram &histogram(nq_trace_stage_t stage) const { return histograms_[stage]; }
+  static inline void Summarize(const nq::HdrHistogram &h, nq_histogram_t *out) { h.Summarize(out, nq_time_usec(1)); }
+
+ protected:
+  inline void Record(nq_trace_stage_t stage, uint64_t from_us, uint64_t to_us) {
+    //kernel timestamp and gettimeofday may slightly disagree
+    histograms_[stage].Record(to_us > from_us ? (to_us - from_us) : 0);
+  }
+  //stages after dequeue are only recorded for the packet which delivers data to app callback,
+  //so that packets which only contain ACK or control frames do not pollute them.
+  void Finish(bool sent) {
+    if (callback_enter_us_ > 0 && callback_exit_us_ > 0) {
+      Record(NQ_TRACE_DELIVERY, dequeue_us_, callback_enter_us_);
+      Record(NQ_TRACE_CALLBACK, callback_enter_us_, callback_exit_us_);
+      Record(NQ_TRACE_TOTAL, rx_us_, callback_exit_us_);
+      if (sent) {
+        Record(NQ_TRACE_REPLY_WRITE, callback_exit_us_, write_us_);
+        Record(NQ_TRACE_SENDMSG, write_us_, NowInUsec());
+      }
+    }
+    state_ = Idle;
+  }
+
+  State state_;
+  uint64_t rx_us_, dequeue_us_, callback_enter_us_, callback_exit_us_, write_us_;
+  nq::HdrHistogram histograms_[NQ_TRACE_STAGE_MAX];
+  static thread_local NqTracer *current_;
+};
+}
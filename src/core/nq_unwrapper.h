@@ -1,7 +1,5 @@
 #pragma once
 
-#include <mutex>
-
 #include "nq.h"
 #include "basis/allocator.h"
 #include "core/nq_client.h"
@@ -17,13 +15,15 @@ namespace net {
 //  1. member p can be cast to NqSession::Delegate* or NqStream* (and its derived classes, NqServerStream, NqClientStream, NqClient, NqServerSession)
 //     but none of its virtual function can be called. because its vtbl may become invalid already.
 //  2. validity should be checked serial stored in pointer of casted object and handle (nq_conn_t.s, nq_rpc_t.s, nq_stream_t.s, nq_alarm_t.s),
-//     with locking mutex which is returned by StaticMutex(nq_conn_t/nq_rpc_t/nq_stream_t/nq_alarm_t)
+//     with pinning NqStaticSection which is returned by UnwrapSection(nq_conn_t/nq_rpc_t/nq_stream_t/nq_alarm_t). 
+//     stored serial should be read with NqSerial::IsSameAtomic, because owner thread clears it without lock.
 //
 //caller should be use following functions with following step. for convenience, UNWRAP_CONN and UNWRAP_STREAM is provided.
-//  1. lock mutex which is returned by NqUnwrapper::UnwrapMutex. 
+//  1. pin static section which is returned by NqUnwrapper::UnwrapSection. (no lock, just atomic increment)
 //  2. get storead serial
 //  3. get NqSession::Delegate* or NqStream* or NqAlarm* by getting corresponding UnwrapXXX method
-//  4. if non-null pointer returned, you can call any method as its synchronized. otherwise, handle(nq_conn_t/nq_rpc_t/nq_stream_t/nq_alarm_t) is 
+//  4. if stored serial and handle's are same, you can call any method until unpin, because owner thread 
+//     waits for unpin before freeing object (see NqStaticSection). otherwise, handle(nq_conn_t/nq_rpc_t/nq_stream_t/nq_alarm_t) is 
 //     already invalid and do nothing 
 class NqUnwrapper {
  public:
@@ -75,33 +75,33 @@ class NqUnwrapper {
   }
 
   
-  //unwrap mutex
-  static inline std::mutex *UnsafeUnwrapMutex(bool is_client, NqSession::Delegate *delegate_ptr) {
+  //unwrap static section
+  static inline NqStaticSection *UnsafeUnwrapSection(bool is_client, NqSession::Delegate *delegate_ptr) {
     if (is_client) {
       auto cli = static_cast<NqClient *>(delegate_ptr);
-      return &(cli->static_mutex());
+      return &(cli->static_section());
     } else {
       auto sv = static_cast<NqServerSession *>(delegate_ptr);
-      return &(sv->static_mutex());
+      return &(sv->static_section());
     }
   }
-  static inline std::mutex *UnwrapMutex(const nq_serial_t &stream_serial, NqStream *delegate_ptr) {
+  static inline NqStaticSection *UnwrapSection(const nq_serial_t &stream_serial, NqStream *delegate_ptr) {
     auto b = UnwrapBoxer(NqSerial::IsClient(stream_serial), delegate_ptr);
     if (b->MainThread()) {
       return nullptr; //avoid deadlock
     }
     if (NqSerial::IsClient(stream_serial)) {
-      return &(static_cast<NqClientStream *>(delegate_ptr)->static_mutex());
+      return &(static_cast<NqClientStream *>(delegate_ptr)->static_section());
     } else {
-      return &(static_cast<NqServerStream *>(delegate_ptr)->static_mutex());
+      return &(static_cast<NqServerStream *>(delegate_ptr)->static_section());
     }
   }
-  static inline std::mutex *UnwrapMutex(nq_conn_t conn) {
+  static inline NqStaticSection *UnwrapSection(nq_conn_t conn) {
     auto b = UnwrapBoxer(conn);
     if (b->MainThread()) {
       return nullptr; //avoid deadlock
     }
-    return UnsafeUnwrapMutex(NqSerial::IsClient(conn.s), reinterpret_cast<NqSession::Delegate *>(conn.p));
+    return UnsafeUnwrapSection(NqSerial::IsClient(conn.s), reinterpret_cast<NqSession::Delegate *>(conn.p));
   }
 
 
@@ -123,10 +123,10 @@ class NqUnwrapper {
     TRACE("UNWRAP_CONN(%s): invalid handle: %s", __purpose, INVALID_REASON(__handle)); \
   } else { \
     __d = reinterpret_cast<NqSession::Delegate *>(__handle.p); \
-    auto m = NqUnwrapper::UnwrapMutex(__handle); \
-    if (m != nullptr) { \
-      std::unique_lock<std::mutex> lk(*m); \
-      if (__d->SessionSerial() == __handle.s) { \
+    auto sec = NqUnwrapper::UnwrapSection(__handle); \
+    if (sec != nullptr) { \
+      NqStaticSection::Pin pin(sec); \
+      if (NqSerial::IsSameAtomic(NqUnwrapper::UnwrapStoredSerial(NqSerial::IsClient(__handle.s), __d), __handle.s)) { \
         __code; \
       } \
     } else if (__d->SessionSerial() == __handle.s) { \
@@ -158,10 +158,10 @@ class NqUnwrapper {
     TRACE("UNWRAP_STREAM(%s): invalid handle: %s", __purpose, INVALID_REASON(__handle)); \
   } else { \
     __s = reinterpret_cast<NqStream *>(__handle.p); \
-    auto m = NqUnwrapper::UnwrapMutex(__handle.s, reinterpret_cast<NqStream *>(__handle.p)); \
-    if (m != nullptr) { \
-      std::unique_lock<std::mutex> lk(*m); \
-      if (__s->stream_serial() == __handle.s) { \
+    auto sec = NqUnwrapper::UnwrapSection(__handle.s, __s); \
+    if (sec != nullptr) { \
+      NqStaticSection::Pin pin(sec); \
+      if (NqSerial::IsSameAtomic(__s->stream_serial(), __handle.s)) { \
         __code; \
       } \
     } else if (__s->stream_serial() == __handle.s) { \
@@ -189,7 +189,7 @@ class NqUnwrapper {
   __code; \
 }
 /*#define UNWRAP_ALARM(__handle, __a, __code) { \
-  std::unique_lock<std::mutex> lock(NqUnwrapper::UnwrapMutex(__handle)); \
+  NqStaticSection::Pin pin(NqUnwrapper::UnwrapSection(__handle)); \
   __a = NqUnwrapper::UnwrapAlarm(__handle); \
   if (__a != nullptr) { \
     __code; \
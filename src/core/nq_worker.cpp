@@ -1,5 +1,9 @@
 #include "core/nq_worker.h"
 
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
+
 #include "basis/syscall.h"
 #include "core/nq_client_loop.h"
 #include "core/nq_dispatcher.h"
@@ -7,10 +11,12 @@
 #include "core/nq_server.h"
 
 namespace net {
+thread_local NqTracer *NqTracer::current_ = nullptr;
+
 void NqWorker::Process(NqPacket *p) {
   for (size_t i = 0; i < dispatchers_.size(); i++) {
     if (dispatchers_[i].first == p->port()) {
-      dispatchers_[i].second->Process(p);
+      dispatchers_[i].second->OnForwarded(p);
       return;
     }
   }
@@ -25,13 +31,16 @@ void NqWorker::Run(PacketQueue &pq) {
     exit(1);
     return;
   }
+  NqTracer::SetCurrent(&tracer_);
   NqPacket *p;
   nq_time_t next_try_accept = 0;
+  uint32_t load = 0;
+  nq_time_t next_load_sample = nq_time_now() + kLoadSampleInterval;
   while (server_.alive()) {
     //TODO(iyatomi): better way to handle this (eg. with timer system)
     nq_time_t now = nq_time_now();
     bool try_accept = false;
-    if ((next_try_accept + nq_time_msec(10)) < now) {
+    if ((next_try_accept + kAcceptInterval) < now) {
       try_accept = true;
       next_try_accept = now;
     }
@@ -41,13 +50,41 @@ void NqWorker::Run(PacketQueue &pq) {
       Process(p);
     }
     //wait and process incoming event
+    size_t n_ops = 0;
     for (int i = 0; i < n_dispatcher; i++) {
-      iq[i]->Poll(ds[i]);
+      n_ops += iq[i]->Poll(ds[i]);
       if (try_accept) {
         ds[i]->Accept();
       }
     }
-    loop_.Poll();
+    NqWorkerMetrics::Add(metrics_.ops_processed_, n_ops);
+    if (next_load_sample < now) {
+      //load is moving average of processed and forwarded packets per second, which is used to place new connection
+      uint32_t n_processed = 0;
+      for (int i = 0; i < n_dispatcher; i++) {
+        n_processed += ds[i]->TakeProcessedCount();
+      }
+      auto per_sec = (uint32_t)((((uint64_t)n_processed) * nq_time_sec(1)) / (now - next_load_sample + kLoadSampleInterval));
+      load = (load * 3 + per_sec) / 4;
+      server_.UpdateLoad(index_, load);
+      next_load_sample = now + kLoadSampleInterval;
+      //remove routes of the connections which are placed but never accepted
+      server_.route_table().Sweep(now, index_, server_.n_worker());
+      //gauges are also sampled at the same interval
+      size_t n_sessions = 0, n_chlos = 0;
+      for (int i = 0; i < n_dispatcher; i++) {
+        n_sessions += ds[i]->server_map().size();
+        n_chlos += ds[i]->NumChlosBuffered();
+      }
+      NqWorkerMetrics::Set(metrics_.sessions_, n_sessions);
+      NqWorkerMetrics::Set(metrics_.chlos_buffered_, n_chlos);
+    }
+    ProcessConnStatsRequests(ds, n_dispatcher);
+    loop_.FlushWriters();
+    //sleep until next alarm or wakeup by other thread
+    loop_.Poll(WaitDuration(pq, iq, ds, n_dispatcher, next_try_accept + kAcceptInterval));
+    NqWorkerMetrics::Set(metrics_.alarms_fired_, loop_.alarms_fired());
+    NqWorkerMetrics::Add(metrics_.loop_polls_, 1);
   }
   //shutdown proc
   bool per_worker_shutdown_state[n_dispatcher];
@@ -74,22 +111,61 @@ void NqWorker::Run(PacketQueue &pq) {
         per_worker_shutdown_state[i] = true;
       }
     }
-    loop_.Poll();
+    loop_.FlushWriters();
+    loop_.Poll(WaitDuration(pq, iq, ds, n_dispatcher, 0));
+  }
+}
+nq_time_t NqWorker::WaitDuration(PacketQueue &pq, InvokeQueue **iq, NqDispatcher **ds, 
+                                 int n_dispatcher, nq_time_t next_try_accept) {
+  loop_.PrepareWait();
+  if (pq.size_approx() > 0 || stats_requests_.size_approx() > 0) {
+    return 0;
+  }
+  nq_time_t wait = kMaxIdleWait;
+  for (int i = 0; i < n_dispatcher; i++) {
+    if (iq[i]->size_approx() > 0) {
+      return 0;
+    }
+    if (next_try_accept > 0 && ds[i]->HasChlosBuffered()) {
+      auto now = nq_time_now();
+      wait = std::min(wait, next_try_accept > now ? (next_try_accept - now) : 0);
+    }
   }
+  return wait;
+}
+void NqWorker::ProcessConnStatsRequests(NqDispatcher **ds, int n_dispatcher) {
+  nq_on_server_conn_stats_t cb;
+  if (!stats_requests_.try_dequeue(cb)) {
+    return;
+  }
+  //take snapshot once, and share it with all requests which arrive at the same time
+  std::vector<nq_conn_t> conns;
+  std::vector<nq_conn_stats_t> stats;
+  for (int i = 0; i < n_dispatcher; i++) {
+    ds[i]->server_map().Iter([&conns, &stats](NqSessionIndex, NqServerSession *s) {
+      nq_conn_stats_t st;
+      s->GetConnStats(&st);
+      conns.push_back(s->ToHandle());
+      stats.push_back(st);
+    });
+  }
+  do {
+    nq_closure_call(cb, index_, conns.data(), stats.data(), (int)conns.size());
+  } while (stats_requests_.try_dequeue(cb));
 }
 bool NqWorker::Listen(InvokeQueue **iq, NqDispatcher **ds) {
   if (loop_.Open(server_.port_configs().size()) < 0) {
     ASSERT(false);
     return false;
   }
+  int recv_batch_size = 0;
+  for (auto &kv : server_.port_configs()) {
+    recv_batch_size = std::max(recv_batch_size, kv.second.server().recv_batch_size);
+  }
+  reader_.Configure(recv_batch_size);
   int port_index = 0;
   for (auto &kv : server_.port_configs()) {
-    QuicSocketAddress address;
-    if (!ToSocketAddress(kv.second.address_, address)) {
-      ASSERT(false);
-      return false;
-    }
-    auto listen_fd = CreateUDPSocketAndBind(address);
+    auto listen_fd = this->listen_fd(kv.first);
     if (listen_fd < 0) {
       ASSERT(false);
       return false;
@@ -99,8 +175,7 @@ bool NqWorker::Listen(InvokeQueue **iq, NqDispatcher **ds) {
       ASSERT(false);
       return false;      
     }
-    nq::logger::info({
-      {"msg", "listen"},
+    nq::logger::info("listen", {
       {"thread_index", index_}, 
       {"fd", listen_fd},
     });
@@ -118,6 +193,66 @@ bool NqWorker::Listen(InvokeQueue **iq, NqDispatcher **ds) {
   }
   return true;
 }
+bool NqWorker::Bind() {
+  for (auto &kv : server_.port_configs()) {
+    QuicSocketAddress address;
+    if (!ToSocketAddress(kv.second.address_, address)) {
+      ASSERT(false);
+      return false;
+    }
+    auto fd = CreateUDPSocketAndBind(address);
+    if (fd < 0) {
+      return false;
+    }
+    listen_fds_.push_back(std::pair<int, nq::Fd>(kv.first, fd));
+  }
+  return true;
+}
+void NqWorker::Unbind() {
+  for (auto &kv : listen_fds_) {
+    nq::Syscall::Close(kv.second);
+  }
+  listen_fds_.clear();
+}
+/* static */
+bool NqWorker::AttachSteeringProgram(nq::Fd fd, uint32_t n_worker) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  //packet offset is relative to udp payload. gquic public header is 
+  //1 byte flags + 8 byte connection id (network byte order) when flags & 0x08.
+  //cbpf only has 32bit arithmetic, so calculate conn_id % n as ((hi % n) * (2^32 % n) + lo % n) % n.
+  //it does not overflow because n_worker is far less than 2^16.
+  //returning index >= number of sockets, lets kernel fallback to hash based selection.
+  const uint32_t kFallback = 0xFFFFFFFF;
+  uint32_t n = n_worker, r32 = (uint32_t)((1ULL << 32) % n);
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 9, 0, 11), //too short
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x08, 0, 9), //no connection id
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 1),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n),
+    BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, r32),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 5),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_RET | BPF_K, kFallback),
+  };
+  struct sock_fprog prog;
+  prog.len = (unsigned short)(sizeof(code) / sizeof(code[0]));
+  prog.filter = code;
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+    QUIC_LOG(WARNING) << "setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed: " << strerror(errno);
+    return false;
+  }
+  return true;
+#else
+  QUIC_LOG(WARNING) << "reuseport steering is not supported on this platform";
+  return false;
+#endif
+}
 //helper
 nq::Fd NqWorker::CreateUDPSocketAndBind(const QuicSocketAddress& address) {
   nq::Fd fd = QuicSocketUtils::CreateUDPSocket(address, &overflow_supported_);
@@ -8,6 +8,8 @@
 #include "core/nq_server_loop.h"
 #include "core/nq_packet_reader.h"
 #include "core/nq_boxer.h"
+#include "core/nq_metrics.h"
+#include "core/nq_trace.h"
 
 namespace net {
 class NqServer;
@@ -21,19 +23,35 @@ class NqWorker {
   //TODO(iyatomi): measture this to confirm
   //almost case, should only have a few element. I think linear scan of vector faster
   std::vector<std::pair<int, NqDispatcher*>> dispatchers_;
+  std::vector<std::pair<int, nq::Fd>> listen_fds_;
   bool overflow_supported_;
+  moodycamel::ConcurrentQueue<nq_on_server_conn_stats_t> stats_requests_;
+  NqWorkerMetrics metrics_;
+  NqTracer tracer_;
  public:
   typedef moodycamel::ConcurrentQueue<NqPacket*> PacketQueue;
   typedef NqBoxer::Processor InvokeQueue;
   NqWorker(uint32_t index, NqServer &server) : 
     index_(index), server_(server), loop_(), reader_(), 
-    thread_(), dispatchers_(), overflow_supported_(false) {}
+    thread_(), dispatchers_(), listen_fds_(), overflow_supported_(false), stats_requests_(), metrics_(), tracer_() {}
   void Start(PacketQueue &pq) {
     thread_ = std::thread([this, &pq]() { Run(pq); });
   }
   void Process(NqPacket *p);
+  //create listen sockets of all ports. NqServer calls this in the order of worker index, 
+  //so that index of the socket in SO_REUSEPORT group, matches with worker index.
+  bool Bind();
+  //close listen sockets created by Bind. only for the case server fails to start
+  void Unbind();
   bool Listen(InvokeQueue **iq, NqDispatcher **ds);
   void Run(PacketQueue &queue);
+  //thread safe. wake worker thread up if it is blocked in waiting event.
+  inline void Wakeup() { loop_.Wakeup(); }
+  //thread safe. cb receives stats of all sessions of this worker, from worker thread.
+  inline void RequestConnStats(nq_on_server_conn_stats_t cb) {
+    stats_requests_.enqueue(cb);
+    Wakeup();
+  }
   void Join() {
     if (thread_.joinable()) {
       thread_.join();
@@ -44,12 +62,35 @@ class NqWorker {
   inline const NqServer &server() const { return server_; }
   inline NqPacketReader &reader() { return reader_; }
   inline NqServerLoop &loop() { return loop_; }
+  inline NqWorkerMetrics &metrics() { return metrics_; }
+  inline const NqWorkerMetrics &metrics() const { return metrics_; }
+  inline NqTracer &tracer() { return tracer_; }
+  inline const NqTracer &tracer() const { return tracer_; }
   inline uint32_t index() { return index_; }
   inline NqServer &server() { return server_; }
   inline std::thread::id thread_id() const { return thread_.get_id(); }
+  inline nq::Fd listen_fd(int port) const {
+    for (auto &kv : listen_fds_) {
+      if (kv.first == port) { return kv.second; }
+    }
+    return -1;
+  }
+
+  //attach program which returns conn_id % n_worker as socket index, to SO_REUSEPORT group which fd belongs to.
+  static bool AttachSteeringProgram(nq::Fd fd, uint32_t n_worker);
 
  protected:
+  //max sleep duration when there is no io event and alarm. 
+  //sleep is interrupted by Wakeup, so this only is for safety. 
+  static const nq_time_t kMaxIdleWait = 100 * 1000 * 1000;
+  //interval to process buffered CHLO
+  static const nq_time_t kAcceptInterval = 10 * 1000 * 1000;
+  //interval to update load of this worker
+  static const nq_time_t kLoadSampleInterval = 100 * 1000 * 1000;
   static bool ToSocketAddress(const nq_addr_t &addr, QuicSocketAddress &address);
+  nq_time_t WaitDuration(PacketQueue &pq, InvokeQueue **iq, NqDispatcher **ds, 
+                         int n_dispatcher, nq_time_t next_try_accept);
+  void ProcessConnStatsRequests(NqDispatcher **ds, int n_dispatcher);
   nq::Fd CreateUDPSocketAndBind(const QuicSocketAddress& address);
 };
 }
\ No newline at end of file
@@ -8,8 +8,11 @@
 #include "basis/defs.h"
 #include "basis/timespec.h"
 
+#include "core/nq_batch.h"
 #include "core/nq_closure.h"
+#include "core/nq_group.h"
 #include "core/nq_client_loop.h"
+#include "core/nq_client_pool.h"
 #include "core/nq_server.h"
 #include "core/nq_unwrapper.h"
 #include "core/nq_network_helper.h"
@@ -136,8 +139,7 @@ static void lib_init(bool client) {
     //initialize c-ares
     auto status = ares_library_init(ARES_LIB_INIT_ALL);
     if (status != ARES_SUCCESS) {
-      nq::logger::fatal({
-        {"msg", "fail to init ares"},
+      nq::logger::fatal("fail to init ares", {
         {"status", status}
       });
     }    
@@ -191,7 +193,7 @@ NQAPI_BOOTSTRAP void nq_client_destroy(nq_client_t cl) {
 NQAPI_BOOTSTRAP void nq_client_poll(nq_client_t cl) {
   NqClientLoop::FromHandle(cl)->Poll();
 }
-NQAPI_BOOTSTRAP bool nq_client_connect(nq_client_t cl, const nq_addr_t *addr, const nq_clconf_t *conf) {
+NQAPI_THREADSAFE bool nq_client_connect(nq_client_t cl, const nq_addr_t *addr, const nq_clconf_t *conf) {
   auto loop = NqClientLoop::FromHandle(cl);
   //we are not smart aleck and wanna use ipv4 if possible 
   return loop->Resolve(AF_INET, addr->host, addr->port, conf);
@@ -202,12 +204,44 @@ NQAPI_BOOTSTRAP nq_hdmap_t nq_client_hdmap(nq_client_t cl) {
 NQAPI_BOOTSTRAP void nq_client_set_thread(nq_client_t cl) {
   NqClientLoop::FromHandle(cl)->set_main_thread();
 }
+NQAPI_THREADSAFE void nq_client_rpc_latency(nq_client_t cl, bool since_last_snapshot, nq_on_client_rpc_latency_t cb) {
+  NqClientLoop::FromHandle(cl)->rpc_latency().Summarize(since_last_snapshot, cb);
+}
 NQAPI_BOOTSTRAP bool nq_client_resolve_host(nq_client_t cl, int family_pref, const char *hostname, nq_on_resolve_host_t cb) {
   return NqClientLoop::FromHandle(cl)->Resolve(family_pref, hostname, cb);
 }
 
 
 
+// --------------------------
+//
+// client pool API
+//
+// --------------------------
+NQAPI_BOOTSTRAP nq_client_pool_t nq_client_pool_create(int n_thread, int max_nfd, int max_stream_hint, const nq_dns_conf_t *dns_conf) {
+  lib_init(true); //anchor
+  auto p = new NqClientPool();
+  if (p->Open(n_thread, max_nfd, max_stream_hint, dns_conf) < 0) {
+    delete p;
+    return nullptr;
+  }
+  return p->ToHandle();
+}
+NQAPI_BOOTSTRAP nq_hdmap_t nq_client_pool_hdmap(nq_client_pool_t pool) {
+  return NqClientPool::FromHandle(pool)->mutable_handler_map()->ToHandle();
+}
+NQAPI_BOOTSTRAP bool nq_client_pool_start(nq_client_pool_t pool) {
+  return NqClientPool::FromHandle(pool)->Start();
+}
+NQAPI_THREADSAFE bool nq_client_pool_connect(nq_client_pool_t pool, const nq_addr_t *addr, const nq_clconf_t *conf) {
+  return NqClientPool::FromHandle(pool)->Connect(addr, conf);
+}
+NQAPI_BOOTSTRAP void nq_client_pool_destroy(nq_client_pool_t pool) {
+  delete NqClientPool::FromHandle(pool);
+}
+
+
+
 
 // --------------------------
 //
@@ -232,6 +266,18 @@ NQAPI_BOOTSTRAP void nq_server_join(nq_server_t sv) {
   psv->Join();
   delete psv;
 }
+NQAPI_THREADSAFE bool nq_server_conn_stats(nq_server_t sv, int worker, nq_on_server_conn_stats_t cb) {
+  return NqServer::FromHandle(sv)->RequestConnStats(worker, cb);
+}
+NQAPI_THREADSAFE int nq_server_metrics(nq_server_t sv, nq_worker_metrics_t *metrics, int n_metrics) {
+  return NqServer::FromHandle(sv)->Metrics(metrics, n_metrics);
+}
+NQAPI_THREADSAFE bool nq_server_metrics_dump(nq_server_t sv, const char *path) {
+  return NqServer::FromHandle(sv)->DumpMetrics(path);
+}
+NQAPI_THREADSAFE bool nq_server_latency(nq_server_t sv, int worker, nq_trace_stage_t stage, nq_histogram_t *hist) {
+  return NqServer::FromHandle(sv)->Latency(worker, stage, hist);
+}
 
 
 
@@ -249,6 +295,9 @@ NQAPI_BOOTSTRAP bool nq_hdmap_rpc_handler(nq_hdmap_t h, const char *name, nq_rpc
 NQAPI_BOOTSTRAP bool nq_hdmap_stream_factory(nq_hdmap_t h, const char *name, nq_stream_factory_t factory) {
   return nq::HandlerMap::FromHandle(h)->AddEntry(name, factory);
 }
+NQAPI_BOOTSTRAP bool nq_hdmap_stream_records_handler(nq_hdmap_t h, const char *name, nq_on_stream_records_t on_stream_records) {
+  return nq::HandlerMap::FromHandle(h)->SetRecordsHandler(name, on_stream_records);
+}
 NQAPI_BOOTSTRAP void nq_hdmap_raw_handler(nq_hdmap_t h, nq_stream_handler_t handler) {
   nq::HandlerMap::FromHandle(h)->SetRawHandler(handler);
 }
@@ -297,6 +346,22 @@ NQAPI_THREADSAFE nq_time_t nq_conn_reconnect_wait(nq_conn_t conn) {
   }, "nq_conn_reconnect_wait");
   return 0;
 }
+NQAPI_THREADSAFE bool nq_conn_stats(nq_conn_t conn, nq_conn_stats_t *stats) {
+  NqSession::Delegate *d;
+  UNWRAP_CONN(conn, d, {
+    if (d->RequestStats()) {
+      //first snapshot. published by owner thread, without waiting for next packet processing
+      auto b = NqUnwrapper::UnwrapBoxer(conn);
+      if (b->MainThread()) {
+        d->PublishStats();
+      } else {
+        b->InvokeConn(conn.s, d, NqBoxer::OpCode::PublishStats);
+      }
+    }
+    return d->ReadStats(stats);
+  }, "nq_conn_stats");
+  return false;
+}
 NQAPI_CLOSURECALL void *nq_conn_ctx(nq_conn_t conn) {
   NqSession::Delegate *d;
   UNSAFE_UNWRAP_CONN(conn, d, {
@@ -388,6 +453,18 @@ NQAPI_THREADSAFE void nq_stream_send_ex(nq_stream_t s, const void *data, nq_size
     b->InvokeStream(s.s, st, NqBoxer::OpCode::SendEx, data, datalen, *opt);
   }, "nq_stream_send");
 }
+NQAPI_THREADSAFE void nq_stream_send_owned(nq_stream_t s, void *data, nq_size_t datalen, nq_on_buffer_free_t on_free) {
+  NqStream *st; NqBoxer *b; bool handed = false;
+  UNWRAP_STREAM_OR_ENQUEUE(s, st, b, {
+    st->Handler<NqStreamHandler>()->Send(data, datalen);
+  }, {
+    b->Enqueue(new NqBoxer::Op(s.s, st, NqBoxer::OpCode::Send, NqBoxer::Op::Data(data, datalen, on_free)));
+    handed = true;
+  }, "nq_stream_send_owned");
+  if (!handed) {
+    nq_closure_call(on_free, data, datalen);
+  }
+}
 NQAPI_THREADSAFE void nq_stream_task(nq_stream_t s, nq_on_stream_task_t cb) {
   NqUnwrapper::UnwrapBoxer(s)->InvokeStream(s.s, ToStream(s), NqBoxer::OpCode::Task, nq_to_dyn_closure(cb));
 }
@@ -490,6 +567,50 @@ NQAPI_THREADSAFE void nq_rpc_reply(nq_rpc_t rpc, nq_msgid_t msgid, const void *d
 NQAPI_THREADSAFE void nq_rpc_error(nq_rpc_t rpc, nq_msgid_t msgid, const void *data, nq_size_t datalen) {
   rpc_reply_common(rpc, NQ_EUSER, msgid, data, datalen);
 }
+NQAPI_THREADSAFE void nq_rpc_call_owned(nq_rpc_t rpc, int16_t type, void *data, nq_size_t datalen, 
+                                        nq_on_buffer_free_t on_free, nq_on_rpc_reply_t on_reply) {
+  ASSERT(type > 0);
+  NqStream *st; NqBoxer *b; bool handed = false;
+  UNWRAP_STREAM_OR_ENQUEUE(rpc, st, b, {
+    st->Handler<NqSimpleRPCStreamHandler>()->Call(type, data, datalen, on_reply);
+  }, {
+    b->Enqueue(new NqBoxer::Op(rpc.s, st, NqBoxer::OpCode::Call, type, 
+                               NqBoxer::Op::Data(data, datalen, on_free), on_reply));
+    handed = true;
+  }, "nq_rpc_call_owned");
+  if (!handed) {
+    nq_closure_call(on_free, data, datalen);
+  }
+}
+NQAPI_THREADSAFE void nq_rpc_notify_owned(nq_rpc_t rpc, int16_t type, void *data, nq_size_t datalen, 
+                                          nq_on_buffer_free_t on_free) {
+  ASSERT(type > 0);
+  NqStream *st; NqBoxer *b; bool handed = false;
+  UNWRAP_STREAM_OR_ENQUEUE(rpc, st, b, {
+    st->Handler<NqSimpleRPCStreamHandler>()->Notify(type, data, datalen);
+  }, {
+    b->Enqueue(new NqBoxer::Op(rpc.s, st, NqBoxer::OpCode::Notify, type, 
+                               NqBoxer::Op::Data(data, datalen, on_free)));
+    handed = true;
+  }, "nq_rpc_notify_owned");
+  if (!handed) {
+    nq_closure_call(on_free, data, datalen);
+  }
+}
+NQAPI_THREADSAFE void nq_rpc_reply_owned(nq_rpc_t rpc, nq_msgid_t msgid, void *data, nq_size_t datalen, 
+                                         nq_on_buffer_free_t on_free) {
+  NqStream *st; NqBoxer *b; bool handed = false;
+  UNWRAP_STREAM_OR_ENQUEUE(rpc, st, b, {
+    st->Handler<NqSimpleRPCStreamHandler>()->Reply(NQ_OK, msgid, data, datalen);
+  }, {
+    b->Enqueue(new NqBoxer::Op(rpc.s, st, NqBoxer::OpCode::Reply, NQ_OK, msgid, 
+                               NqBoxer::Op::Data(data, datalen, on_free)));
+    handed = true;
+  }, "nq_rpc_reply_owned");
+  if (!handed) {
+    nq_closure_call(on_free, data, datalen);
+  }
+}
 NQAPI_THREADSAFE void nq_rpc_task(nq_rpc_t rpc, nq_on_rpc_task_t cb) {
   NqUnwrapper::UnwrapBoxer(rpc)->InvokeStream(rpc.s, ToStream(rpc), NqBoxer::OpCode::Task, nq_to_dyn_closure(cb));
 }
@@ -509,6 +630,105 @@ NQAPI_THREADSAFE nq_sid_t nq_rpc_sid(nq_rpc_t rpc) {
 
 
 
+// --------------------------
+//
+// batch API
+//
+// --------------------------
+NQAPI_THREADSAFE nq_batch_t nq_batch_create() {
+  return (new NqBatch())->ToHandle();
+}
+NQAPI_THREADSAFE void nq_batch_destroy(nq_batch_t b) {
+  delete NqBatch::FromHandle(b);
+}
+NQAPI_THREADSAFE void nq_batch_stream_send(nq_batch_t b, nq_stream_t s, const void *data, nq_size_t datalen) {
+  if (NqSerial::IsEmpty(s.s)) {
+    TRACE("nq_batch_stream_send: invalid handle: %s", INVALID_REASON(s));
+    return;
+  }
+  NqBatch::FromHandle(b)->Add(NqUnwrapper::UnwrapBoxer(s), 
+    new NqBoxer::Op(s.s, ToStream(s), NqBoxer::OpCode::Send, NqBoxer::Op::Data(data, datalen)));
+}
+NQAPI_THREADSAFE void nq_batch_rpc_call(nq_batch_t b, nq_rpc_t rpc, int16_t type, const void *data, nq_size_t datalen, nq_on_rpc_reply_t on_reply) {
+  ASSERT(type > 0);
+  if (NqSerial::IsEmpty(rpc.s)) {
+    TRACE("nq_batch_rpc_call: invalid handle: %s", INVALID_REASON(rpc));
+    return;
+  }
+  NqBatch::FromHandle(b)->Add(NqUnwrapper::UnwrapBoxer(rpc), 
+    new NqBoxer::Op(rpc.s, ToStream(rpc), NqBoxer::OpCode::Call, type, NqBoxer::Op::Data(data, datalen), on_reply));
+}
+NQAPI_THREADSAFE void nq_batch_rpc_notify(nq_batch_t b, nq_rpc_t rpc, int16_t type, const void *data, nq_size_t datalen) {
+  ASSERT(type > 0);
+  if (NqSerial::IsEmpty(rpc.s)) {
+    TRACE("nq_batch_rpc_notify: invalid handle: %s", INVALID_REASON(rpc));
+    return;
+  }
+  NqBatch::FromHandle(b)->Add(NqUnwrapper::UnwrapBoxer(rpc), 
+    new NqBoxer::Op(rpc.s, ToStream(rpc), NqBoxer::OpCode::Notify, type, NqBoxer::Op::Data(data, datalen)));
+}
+NQAPI_THREADSAFE void nq_batch_rpc_reply(nq_batch_t b, nq_rpc_t rpc, nq_msgid_t msgid, const void *data, nq_size_t datalen) {
+  if (NqSerial::IsEmpty(rpc.s)) {
+    TRACE("nq_batch_rpc_reply: invalid handle: %s", INVALID_REASON(rpc));
+    return;
+  }
+  NqBatch::FromHandle(b)->Add(NqUnwrapper::UnwrapBoxer(rpc), 
+    new NqBoxer::Op(rpc.s, ToStream(rpc), NqBoxer::OpCode::Reply, NQ_OK, msgid, NqBoxer::Op::Data(data, datalen)));
+}
+NQAPI_THREADSAFE void nq_batch_submit(nq_batch_t b) {
+  NqBatch::FromHandle(b)->Submit();
+}
+
+
+
+// --------------------------
+//
+// group API
+//
+// --------------------------
+NQAPI_THREADSAFE nq_group_t nq_group_create() {
+  return (new NqGroup())->ToHandle();
+}
+NQAPI_THREADSAFE void nq_group_destroy(nq_group_t g) {
+  delete NqGroup::FromHandle(g);
+}
+NQAPI_THREADSAFE bool nq_group_add_rpc(nq_group_t g, nq_rpc_t rpc) {
+  if (NqSerial::IsEmpty(rpc.s)) {
+    return false;
+  }
+  return NqGroup::FromHandle(g)->Add(NqUnwrapper::UnwrapBoxer(rpc), rpc.s, ToStream(rpc));
+}
+NQAPI_THREADSAFE bool nq_group_remove_rpc(nq_group_t g, nq_rpc_t rpc) {
+  if (NqSerial::IsEmpty(rpc.s)) {
+    return false;
+  }
+  return NqGroup::FromHandle(g)->Remove(NqUnwrapper::UnwrapBoxer(rpc), rpc.s, ToStream(rpc));
+}
+NQAPI_THREADSAFE bool nq_group_add_stream(nq_group_t g, nq_stream_t s) {
+  if (NqSerial::IsEmpty(s.s)) {
+    return false;
+  }
+  return NqGroup::FromHandle(g)->Add(NqUnwrapper::UnwrapBoxer(s), s.s, ToStream(s));
+}
+NQAPI_THREADSAFE bool nq_group_remove_stream(nq_group_t g, nq_stream_t s) {
+  if (NqSerial::IsEmpty(s.s)) {
+    return false;
+  }
+  return NqGroup::FromHandle(g)->Remove(NqUnwrapper::UnwrapBoxer(s), s.s, ToStream(s));
+}
+NQAPI_THREADSAFE nq_size_t nq_group_size(nq_group_t g) {
+  return NqGroup::FromHandle(g)->size();
+}
+NQAPI_THREADSAFE void nq_group_rpc_notify(nq_group_t g, int16_t type, const void *data, nq_size_t datalen) {
+  ASSERT(type > 0);
+  NqGroup::FromHandle(g)->Broadcast(NqSharedFrame::NewNotifyFrame(type, data, datalen));
+}
+NQAPI_THREADSAFE void nq_group_stream_send(nq_group_t g, const void *data, nq_size_t datalen) {
+  NqGroup::FromHandle(g)->Broadcast(NqSharedFrame::NewStreamFrame(data, datalen));
+}
+
+
+
 // --------------------------
 //
 // time API
@@ -559,27 +779,7 @@ NQAPI_BOOTSTRAP void nq_log_config(const nq_logconf_t *conf) {
   nq::logger::configure(conf->callback, conf->id, conf->manual_flush);
 }
 NQAPI_THREADSAFE void nq_log(nq_loglv_t lv, const char *msg, nq_logparam_t *params, int n_params) {
-  nq::json j = {
-    {"msg", msg}
-  };
-  for (int i = 0; i < n_params; i++) {
-    auto p = params[i];
-    switch (p.type) {
-    case NQ_LOG_INTEGER:
-      j[p.key] = p.value.n;
-      break;
-    case NQ_LOG_STRING:
-      j[p.key] = p.value.s;
-      break;
-    case NQ_LOG_DECIMAL:
-      j[p.key] = p.value.d;
-      break;
-    case NQ_LOG_BOOLEAN:
-      j[p.key] = p.value.b;
-      break;
-    }
-  }
-  nq::logger::log((nq::logger::level::def)(int)lv, j);
+  nq::logger::log((nq::logger::level::def)(int)lv, msg, params, n_params);
 }
 NQAPI_THREADSAFE void nq_log_flush() {
   nq::logger::flush();
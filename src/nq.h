@@ -50,10 +50,16 @@ typedef uint32_t nq_stream_id_t;
 
 typedef struct nq_client_tag *nq_client_t; //NqClientLoop
 
+typedef struct nq_client_pool_tag *nq_client_pool_t; //NqClientPool
+
 typedef struct nq_server_tag *nq_server_t; //NqServer
 
 typedef struct nq_hdmap_tag *nq_hdmap_t; //nq::HandlerMap
 
+typedef struct nq_batch_tag *nq_batch_t; //NqBatch
+
+typedef struct nq_group_tag *nq_group_t; //NqGroup
+
 typedef struct {
   uint64_t data[1];
 } nq_serial_t;
@@ -90,6 +96,35 @@ typedef enum {
   NQ_ERESOLVE = -8, //address resolve error
 } nq_error_t;
 
+//transport statistics of connection
+typedef struct {
+  nq_time_t srtt, min_rtt;    //smoothed/minimum round trip time
+  uint64_t cwnd;              //congestion window in bytes
+  uint64_t bytes_in_flight;   //bytes sent but not acked or declared lost yet
+  uint64_t bytes_sent, bytes_received, bytes_retransmitted; //bytes_sent includes retransmission
+  uint64_t packets_sent, packets_received, packets_retransmitted, packets_lost;
+  double loss_rate;           //packets_lost / packets_sent
+  uint64_t pacing_rate;       //bytes per second
+  uint64_t bandwidth_estimate;//bytes per second
+} nq_conn_stats_t;
+
+//summary of latency histogram
+typedef struct {
+  uint64_t count;
+  nq_time_t min, max, mean;
+  nq_time_t p50, p90, p99, p999;
+} nq_histogram_t;
+
+//latency of rpc calls per stream name and rpc type, from nq_rpc_call(_ex) to its completion.
+//calls completed by timeout or connection close, are separately summarized.
+typedef struct {
+  const char *name;     //stream name which rpc belongs to
+  uint16_t type;        //rpc type
+  nq_histogram_t reply;   //replied (includes error reply from peer)
+  nq_histogram_t timeout; //NQ_ETIMEOUT
+  nq_histogram_t goaway;  //NQ_EGOAWAY
+} nq_rpc_latency_t;
+
 typedef struct {
   int code;        //explanation numeric error code
   const char *msg; //explanation message
@@ -138,6 +173,9 @@ NQ_DECL_CLOSURE(nq_time_t, nq_on_client_conn_close_t, void *, nq_conn_t, nq_erro
 //because nq_conn_t is already invalidate when this callback invokes, almost nq_conn_* API returns invalid value in this callback.
 //so the callback is basically for cleanup user defined resourse, like closure arg pointer (1st arg) or user context (3rd arg).
 NQ_DECL_CLOSURE(void, nq_on_client_conn_finalize_t, void *, nq_conn_t, void *);
+//receive rpc latency summaries of the client. arguments are array of summaries and its size. 
+//called from the thread which calls nq_client_rpc_latency, and array is only valid during callback.
+NQ_DECL_CLOSURE(void, nq_on_client_rpc_latency_t, void *, const nq_rpc_latency_t *, int);
 
 
 /* server */
@@ -145,6 +183,9 @@ NQ_DECL_CLOSURE(void, nq_on_client_conn_finalize_t, void *, nq_conn_t, void *);
 typedef nq_on_client_conn_open_t nq_on_server_conn_open_t;
 //server connection closed. same as nq_on_client_conn_close_t but no reconnection feature
 NQ_DECL_CLOSURE(void, nq_on_server_conn_close_t, void *, nq_conn_t, nq_error_t, const nq_error_detail_t*, bool);
+//receive transport statistics of all connections of the worker. arguments are worker index, 
+//array of connections and their statistics, and its size. called from the worker thread, and arrays are only valid during callback.
+NQ_DECL_CLOSURE(void, nq_on_server_conn_stats_t, void *, int, const nq_conn_t *, const nq_conn_stats_t *, int);
 
 
 /* conn */
@@ -166,6 +207,12 @@ NQ_DECL_CLOSURE(void*, nq_stream_reader_t, void *, nq_stream_t, const char *, nq
 NQ_DECL_CLOSURE(nq_size_t, nq_stream_writer_t, void *, nq_stream_t, const void *, nq_size_t, void **);
 
 NQ_DECL_CLOSURE(void, nq_on_stream_record_t, void *, nq_stream_t, const void *, nq_size_t);
+//records which are received by single read. pointers are only valid during callback.
+typedef struct {
+  const void *data;
+  nq_size_t len;
+} nq_record_t;
+NQ_DECL_CLOSURE(void, nq_on_stream_records_t, void *, nq_stream_t, const nq_record_t *, int);
 
 NQ_DECL_CLOSURE(void, nq_on_stream_task_t, void *, nq_stream_t);
 
@@ -207,6 +254,11 @@ NQ_DECL_CLOSURE(void, nq_on_reachability_change_t, void *, nq_reachability_t);
 NQ_DECL_CLOSURE(void, nq_on_resolve_host_t, void *, nq_error_t, const nq_error_detail_t *, const char *, nq_size_t);
 
 
+/* buffer */
+//called with send buffer handed over to nq_*_owned APIs and its length, when nq no longer uses it.
+NQ_DECL_CLOSURE(void, nq_on_buffer_free_t, void *, void *, nq_size_t);
+
+
 /* macro */
 #define nq_closure_is_empty(clsr) ((clsr).proc == nullptr)
 
@@ -226,6 +278,9 @@ NQ_DECL_CLOSURE(void, nq_on_resolve_host_t, void *, nq_error_t, const nq_error_d
 // client API
 //
 // --------------------------
+//conf structs (nq_dns_conf_t, nq_clconf_t, nq_svconf_t) should be zero-initialized (eg. memset) before 
+//setting fields. zero is the default of every field, so fields added by newer version of nq, 
+//which older code does not set, keep default behavior instead of being random.
 typedef struct {
   //dns query timeout in nsec
   nq_time_t query_timeout;
@@ -253,6 +308,15 @@ typedef struct {
   //track reachability to the provide hostname and recreate socket if changed.
   //useful for mobile connection. currently iOS only. use nq_conn_reachability_change for android.
   bool track_reachability;
+
+  //if set to true, outgoing packets are buffered while nq_client_poll processes events, 
+  //and sent at once with sendmmsg (and UDP_SEGMENT if kernel supports). linux only.
+  bool use_batch_write;
+
+  //if set to true, connection shares one UDP socket with other connections of same nq_client_t 
+  //which also set this flag. incoming packets are routed by connection id. 
+  //reduces fds and read syscalls when client has many connections.
+  bool use_shared_socket;
   
   //total handshake time limit / no input limit. default 1000ms/500ms
   nq_time_t handshake_timeout, idle_timeout; 
@@ -264,26 +328,53 @@ NQAPI_BOOTSTRAP nq_client_t nq_client_create(int max_nfd, int max_stream_hint, c
 NQAPI_BOOTSTRAP void nq_client_poll(nq_client_t cl);
 // close connection and destroy client object. after call this, do not call nq_client_* API.
 NQAPI_BOOTSTRAP void nq_client_destroy(nq_client_t cl);
-// create conn from client. server side can get from argument of on_accept handler
-// return invalid conn on error, can check with nq_conn_is_valid. 
-// TODO(iyatomi): make it NQAPI_THREADSAFE
-NQAPI_BOOTSTRAP bool nq_client_connect(nq_client_t cl, const nq_addr_t *addr, const nq_clconf_t *conf);
+// start connecting to addr. server side can get conn from argument of on_accept handler.
+// connection result is notified via conf->on_open or conf->on_close.
+// can be called from any thread. if called other than the thread which polls cl, 
+// connecting is started in next nq_client_poll.
+NQAPI_THREADSAFE bool nq_client_connect(nq_client_t cl, const nq_addr_t *addr, const nq_clconf_t *conf);
 // get handler map of the client. 
 NQAPI_BOOTSTRAP nq_hdmap_t nq_client_hdmap(nq_client_t cl);
 // set thread id that calls nq_client_poll.
 // call this if thread which polls this nq_client_t is different from creator thread.
 NQAPI_BOOTSTRAP void nq_client_set_thread(nq_client_t cl);
+// summarize latency of rpc calls made by connections of the client, per stream name and rpc type.
+// if since_last_snapshot is true, only calls completed after previous call with since_last_snapshot = true
+// are summarized (useful for periodic reporting). otherwise all calls since client creation are summarized.
+// does not block the thread which polls cl. 
+NQAPI_THREADSAFE void nq_client_rpc_latency(nq_client_t cl, bool since_last_snapshot, nq_on_client_rpc_latency_t cb);
 // resolve host. nq_client_t need to be polled by nq_client_poll to work correctly
 // family_pref can be AF_INET or AF_INET6, and control which address family searched first. 
 NQAPI_BOOTSTRAP bool nq_client_resolve_host(nq_client_t, int family_pref, const char *hostname, nq_on_resolve_host_t cb);
 
 
 
+// --------------------------
+//
+// client pool API
+//
+// --------------------------
+// create n_thread clients, each of them is polled by its own thread. max_nfd and max_stream_hint are per thread.
+// connections are distributed across clients, so throughput scales with number of cores.
+NQAPI_BOOTSTRAP nq_client_pool_t nq_client_pool_create(int n_thread, int max_nfd, int max_stream_hint, const nq_dns_conf_t *dns_conf);
+// get handler map which is shared by all clients of the pool. setup before nq_client_pool_start.
+NQAPI_BOOTSTRAP nq_hdmap_t nq_client_pool_hdmap(nq_client_pool_t pool);
+// start polling threads. 
+NQAPI_BOOTSTRAP bool nq_client_pool_start(nq_client_pool_t pool);
+// start connecting to addr with one of the clients in the pool. 
+// all callbacks of the connection are invoked from the thread of that client.
+NQAPI_THREADSAFE bool nq_client_pool_connect(nq_client_pool_t pool, const nq_addr_t *addr, const nq_clconf_t *conf);
+// stop polling threads, close all connections and destroy pool. after call this, do not call nq_client_pool_* API.
+NQAPI_BOOTSTRAP void nq_client_pool_destroy(nq_client_pool_t pool);
+
+
+
 // --------------------------
 //
 // server API
 //
 // --------------------------
+//should be zero-initialized before setting fields, as nq_clconf_t.
 typedef struct {
   //connection open/close watcher
   nq_on_server_conn_open_t on_open;
@@ -301,10 +392,73 @@ typedef struct {
   //if set to true, max_session_hint will be hard limit
   bool use_max_session_hint_as_limit;
 
+  //if set to true, memory for sessions and streams is allocated from huge page. 
+  //uses reserved hugetlb pages if exists, otherwise transparent huge page. linux only.
+  bool use_hugepage;
+
+  //if set to true, outgoing packets are buffered while worker processes events, 
+  //and sent at once with sendmmsg (and UDP_SEGMENT if kernel supports). linux only.
+  bool use_batch_write;
+
+  //if set to true, receive coalesced packets at once with UDP_GRO, 
+  //and process them without copy. linux only, ignored if kernel does not support. default false.
+  bool use_gro;
+
+  //number of datagrams read by one recvmmsg call. default 16, and at most 1024 (default is used if out of range). 
+  //workers share receive buffers between ports, so largest value of listened ports is used.
+  int recv_batch_size;
+
+  //if set to positive value, new connection is placed to least loaded worker, instead of worker of 
+  //conn_id % n_worker, when load (processed and forwarded packets per sec) of the latter exceeds the former's
+  //by more than rebalance_threshold percent. 0 to disable. 
+  //only placement of new connection is balanced. established connections are never moved to other worker,
+  //because its QuicConnection and handles are bound to the worker. packets of the placed connection are 
+  //forwarded to it by the worker which receives them. ignored if use_reuseport_steering is enabled.
+  int rebalance_threshold;
+
+  //if set to true, attach BPF program to SO_REUSEPORT group of listen sockets, which steers 
+  //datagram by its connection id, so that kernel delivers it to the worker owns the connection. 
+  //linux only. packets which are not steered correctly (eg. attach failure) are forwarded between workers.
+  bool use_reuseport_steering;
+
+  //if set to positive value N, trace latency of 1 of N received packets through each stage of 
+  //processing (see nq_trace_stage_t). results can be read by nq_server_latency. 0 to disable.
+  int trace_sample_rate;
+
   //total handshake time limit / no input limit / shutdown wait. default 1000ms/5000ms/5sec
   nq_time_t handshake_timeout, idle_timeout, shutdown_timeout; 
 } nq_svconf_t;
 
+//stages of traced packet. kernel rx -> dequeue -> app callback entry -> callback exit -> reply written -> sendmsg
+typedef enum {
+  NQ_TRACE_RX_TO_DEQUEUE = 0, //kernel receive timestamp to start of processing by the worker
+  NQ_TRACE_FORWARD,     //enqueue to start of processing by other worker. only for forwarded packets
+  //following stages are only recorded for packets which deliver data to app callback
+  NQ_TRACE_DELIVERY,    //start of processing (decrypt, frame delivery) to app callback entry
+  NQ_TRACE_CALLBACK,    //app callback (on_stream_record, on_rpc_request, ...) entry to exit
+  NQ_TRACE_REPLY_WRITE, //callback exit to first packet written after callback (may be ACK, not the reply itself)
+  NQ_TRACE_SENDMSG,     //packet written to the packet is actually sent by sendmsg (or sendmmsg in batch mode)
+  NQ_TRACE_TOTAL,       //kernel receive timestamp to app callback exit
+  NQ_TRACE_STAGE_MAX,
+} nq_trace_stage_t;
+
+//performance counters and gauges of a worker
+typedef struct {
+  //counters. increase monotonically from server start
+  uint64_t recv_calls;        //number of recvmmsg (or recvmsg) calls
+  uint64_t packets_received;  //packets read from socket
+  uint64_t packets_forwarded; //packets forwarded to other worker which owns connection
+  uint64_t packets_processed; //packets processed by sessions of this worker
+  uint64_t ops_processed;     //cross thread operations processed 
+  uint64_t alarms_fired;
+  uint64_t loop_polls;        //iterations of the worker loop
+  //gauges
+  uint64_t packet_queue_depth;//packets forwarded from other workers, not processed yet
+  uint64_t invoke_queue_depth;//cross thread operations not processed yet
+  uint64_t sessions;
+  uint64_t chlos_buffered;    //connections waiting for being accepted
+} nq_worker_metrics_t;
+
 //create server which has n_worker of workers
 NQAPI_BOOTSTRAP nq_server_t nq_server_create(int n_worker);
 //listen and returns handler map associated with it. 
@@ -313,6 +467,20 @@ NQAPI_BOOTSTRAP nq_hdmap_t nq_server_listen(nq_server_t sv, const nq_addr_t *add
 NQAPI_BOOTSTRAP void nq_server_start(nq_server_t sv, bool block);
 //request shutdown and wait for server to stop. after calling this API, do not call nq_server_* API
 NQAPI_BOOTSTRAP void nq_server_join(nq_server_t sv);
+//request worker to snapshot transport statistics of all its connections in one pass, and pass them to cb.
+//cb is invoked from the worker thread, on next iteration of its loop. returns false if worker index is invalid 
+//or server is not started.
+NQAPI_THREADSAFE bool nq_server_conn_stats(nq_server_t sv, int worker, nq_on_server_conn_stats_t cb);
+//get metrics of workers without lock. metrics of i-th worker is stored in metrics[i], for first min(n_metrics, n_worker) workers.
+//returns number of workers, or 0 if server is not started.
+NQAPI_THREADSAFE int nq_server_metrics(nq_server_t sv, nq_worker_metrics_t *metrics, int n_metrics);
+//write metrics of all workers in prometheus text format, to path. if path starts with "unix:", 
+//rest of it is treated as path of unix domain socket (SOCK_STREAM) to connect and write, with 1 second timeout. 
+//otherwise file is atomically replaced (eg. for node_exporter's textfile collector). returns false on error.
+NQAPI_THREADSAFE bool nq_server_metrics_dump(nq_server_t sv, const char *path);
+//get latency histogram of the stage, traced by worker. if worker is negative, histograms of all workers are merged.
+//returns false if worker index is invalid or server is not started. needs svconf.trace_sample_rate to be set.
+NQAPI_THREADSAFE bool nq_server_latency(nq_server_t sv, int worker, nq_trace_stage_t stage, nq_histogram_t *hist);
 
 
 
@@ -344,6 +512,10 @@ NQAPI_BOOTSTRAP bool nq_hdmap_stream_handler(nq_hdmap_t h, const char *name, nq_
 NQAPI_BOOTSTRAP bool nq_hdmap_rpc_handler(nq_hdmap_t h, const char *name, nq_rpc_handler_t handler);
 
 NQAPI_BOOTSTRAP bool nq_hdmap_stream_factory(nq_hdmap_t h, const char *name, nq_stream_factory_t factory);
+//opt in batch delivery for the stream which is registered by nq_hdmap_stream_handler without stream_reader/writer.
+//after calling this, on_stream_record of the handler is not called, and all complete records received at once 
+//are given to on_stream_records together. returns false if no such stream handler registered for name.
+NQAPI_BOOTSTRAP bool nq_hdmap_stream_records_handler(nq_hdmap_t h, const char *name, nq_on_stream_records_t on_stream_records);
 //if you call this API, nq_hdmap_t become "raw mode". any other hdmap settings are ignored, 
 //and all incoming/outgoing streams are handled with the handler which is given to this API.
 NQAPI_BOOTSTRAP void nq_hdmap_raw_handler(nq_hdmap_t h, nq_stream_handler_t handler);
@@ -375,6 +547,13 @@ NQAPI_THREADSAFE bool nq_conn_is_client(nq_conn_t conn);
 NQAPI_THREADSAFE bool nq_conn_is_valid(nq_conn_t conn, nq_on_conn_validate_t cb);
 //get reconnect wait duration in us. 0 means does not wait reconnection
 NQAPI_THREADSAFE nq_time_t nq_conn_reconnect_wait(nq_conn_t conn);
+//get latest snapshot of transport statistics. snapshot is updated by the thread which owns conn, 
+//when it processes packets (at most once per 10ms), so this never blocks that thread. 
+//snapshot is only published after first call of this API for the conn. returns false if conn is invalid, 
+//or first snapshot is not published yet (stats is zero filled). first call publishes it immediately 
+//if called from the thread which owns conn, otherwise it is published in next poll of that thread.
+//for client connection, statistics is reset on reconnection.
+NQAPI_THREADSAFE bool nq_conn_stats(nq_conn_t conn, nq_conn_stats_t *stats);
 //get context, which is set at on_conn_open
 NQAPI_CLOSURECALL void *nq_conn_ctx(nq_conn_t conn);
 //check equality of nq_conn_t.
@@ -415,6 +594,9 @@ NQAPI_THREADSAFE void nq_stream_close(nq_stream_t s);
 NQAPI_THREADSAFE void nq_stream_send(nq_stream_t s, const void *data, nq_size_t datalen);
 //send arbiter byte array/arbiter object to stream peer, and can receive ack of it.
 NQAPI_THREADSAFE void nq_stream_send_ex(nq_stream_t s, const void *data, nq_size_t datalen, nq_stream_opt_t *opt);
+//same as nq_stream_send, but data is handed over to nq without copy, when called from other thread than owner of s.
+//on_free is called exactly once (possibly from other thread) after nq finished to use data, even if s is already invalid.
+NQAPI_THREADSAFE void nq_stream_send_owned(nq_stream_t s, void *data, nq_size_t datalen, nq_on_buffer_free_t on_free);
 //schedule execution of closure which is given to cb, will called with given s.
 NQAPI_THREADSAFE void nq_stream_task(nq_stream_t s, nq_on_stream_task_t cb);
 //check equality of nq_stream_t.
@@ -463,6 +645,11 @@ NQAPI_THREADSAFE void nq_rpc_notify(nq_rpc_t rpc, int16_t type, const void *data
 NQAPI_THREADSAFE void nq_rpc_reply(nq_rpc_t rpc, nq_msgid_t msgid, const void *data, nq_size_t datalen);
 //send error response to specified request. data and datalen is error detail
 NQAPI_THREADSAFE void nq_rpc_error(nq_rpc_t rpc, nq_msgid_t msgid, const void *data, nq_size_t datalen);
+//same as nq_rpc_call/nq_rpc_notify/nq_rpc_reply, but data is handed over to nq without copy. 
+//on_free is called as same manner as nq_stream_send_owned.
+NQAPI_THREADSAFE void nq_rpc_call_owned(nq_rpc_t rpc, int16_t type, void *data, nq_size_t datalen, nq_on_buffer_free_t on_free, nq_on_rpc_reply_t on_reply);
+NQAPI_THREADSAFE void nq_rpc_notify_owned(nq_rpc_t rpc, int16_t type, void *data, nq_size_t datalen, nq_on_buffer_free_t on_free);
+NQAPI_THREADSAFE void nq_rpc_reply_owned(nq_rpc_t rpc, nq_msgid_t msgid, void *data, nq_size_t datalen, nq_on_buffer_free_t on_free);
 //schedule execution of closure which is given to cb, will called with given rpc.
 NQAPI_THREADSAFE void nq_rpc_task(nq_rpc_t rpc, nq_on_rpc_task_t cb);
 //check equality of nq_rpc_t.
@@ -475,6 +662,55 @@ NQAPI_CLOSURECALL void *nq_rpc_ctx(nq_rpc_t s);
 
 
 
+// --------------------------
+//
+// batch API
+//
+// --------------------------
+//create batch, which accumulates operations to streams and submits them at once by nq_batch_submit.
+//operations for streams owned by the same thread, are enqueued with single queue operation.
+//batch itself is not thread safe. use it from only one thread at a time.
+NQAPI_THREADSAFE nq_batch_t nq_batch_create();
+//destroy batch. operations not submitted are discarded.
+NQAPI_THREADSAFE void nq_batch_destroy(nq_batch_t b);
+//same as nq_stream_send, nq_rpc_call, nq_rpc_notify and nq_rpc_reply, but operation is buffered until nq_batch_submit.
+NQAPI_THREADSAFE void nq_batch_stream_send(nq_batch_t b, nq_stream_t s, const void *data, nq_size_t datalen);
+NQAPI_THREADSAFE void nq_batch_rpc_call(nq_batch_t b, nq_rpc_t rpc, int16_t type, const void *data, nq_size_t datalen, nq_on_rpc_reply_t on_reply);
+NQAPI_THREADSAFE void nq_batch_rpc_notify(nq_batch_t b, nq_rpc_t rpc, int16_t type, const void *data, nq_size_t datalen);
+NQAPI_THREADSAFE void nq_batch_rpc_reply(nq_batch_t b, nq_rpc_t rpc, nq_msgid_t msgid, const void *data, nq_size_t datalen);
+//submit buffered operations. if caller is the thread which owns streams, operations are processed immediately.
+//batch can be reused after submit.
+NQAPI_THREADSAFE void nq_batch_submit(nq_batch_t b);
+
+
+
+// --------------------------
+//
+// group API
+//
+// --------------------------
+//create group, which is set of rpc/stream handles to broadcast same data. 
+//members can be owned by different workers. broadcast encodes data only once, 
+//and sends only 1 operation per worker which owns members, not per member.
+NQAPI_THREADSAFE nq_group_t nq_group_create();
+//destroy group. broadcast already requested is still delivered.
+NQAPI_THREADSAFE void nq_group_destroy(nq_group_t g);
+//add/remove member. returns false if rpc/stream already added (add), or not found (remove). 
+//closed member is just skipped on broadcast, but remains in group until removed. 
+//so remove it in on_close callback of rpc/stream. 
+NQAPI_THREADSAFE bool nq_group_add_rpc(nq_group_t g, nq_rpc_t rpc);
+NQAPI_THREADSAFE bool nq_group_remove_rpc(nq_group_t g, nq_rpc_t rpc);
+NQAPI_THREADSAFE bool nq_group_add_stream(nq_group_t g, nq_stream_t s);
+NQAPI_THREADSAFE bool nq_group_remove_stream(nq_group_t g, nq_stream_t s);
+//number of members
+NQAPI_THREADSAFE nq_size_t nq_group_size(nq_group_t g);
+//same as calling nq_rpc_notify for all rpc members. stream members ignore it.
+NQAPI_THREADSAFE void nq_group_rpc_notify(nq_group_t g, int16_t type, const void *data, nq_size_t datalen);
+//same as calling nq_stream_send for all stream members. rpc members ignore it.
+NQAPI_THREADSAFE void nq_group_stream_send(nq_group_t g, const void *data, nq_size_t datalen);
+
+
+
 // --------------------------
 //
 // time API
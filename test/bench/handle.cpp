@@ -0,0 +1,149 @@
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nq.h"
+#include "core/nq_static_section.h"
+
+#define DURATION_MS (500)
+#define MAX_THREAD (16)
+#define N_OBJECT (4) //app threads hammer a few hot connections
+#define CHURN_INTERVAL_US (1000) //owner thread invalidates and re-validates object at this interval
+
+static inline uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+//object and its static section, as nq::Allocator lays out (BSS follows object)
+struct object {
+	nq_serial_t serial;
+	uint64_t payload;
+};
+
+//validation before NqStaticSection becomes lock free (UNWRAP_CONN with per object mutex)
+struct mutex_validator {
+	struct block { object o; std::mutex m; };
+	block blocks[N_OBJECT];
+	static const char *name() { return "mutex"; }
+	inline bool validate(int idx, const nq_serial_t &s, uint64_t *out) {
+		auto &b = blocks[idx];
+		std::unique_lock<std::mutex> lk(b.m);
+		if (b.o.serial.data[0] == s.data[0]) {
+			*out += b.o.payload;
+			return true;
+		}
+		return false;
+	}
+	inline void invalidate(int idx) {
+		auto &b = blocks[idx];
+		std::unique_lock<std::mutex> lk(b.m);
+		b.o.serial.data[0] = 0;
+	}
+	inline void revalidate(int idx, uint64_t serial) {
+		auto &b = blocks[idx];
+		std::unique_lock<std::mutex> lk(b.m);
+		b.o.serial.data[0] = serial;
+	}
+};
+
+//current validation (UNWRAP_CONN with NqStaticSection::Pin)
+struct pin_validator {
+	struct block { object o; net::NqStaticSection sec; };
+	block blocks[N_OBJECT];
+	static const char *name() { return "pin"; }
+	inline bool validate(int idx, const nq_serial_t &s, uint64_t *out) {
+		auto &b = blocks[idx];
+		net::NqStaticSection::Pin pin(&b.sec);
+		if (__atomic_load_n(&b.o.serial.data[0], __ATOMIC_SEQ_CST) == s.data[0]) {
+			*out += b.o.payload;
+			return true;
+		}
+		return false;
+	}
+	inline void invalidate(int idx) {
+		auto &b = blocks[idx];
+		__atomic_store_n(&b.o.serial.data[0], 0, __ATOMIC_SEQ_CST);
+		b.sec.WaitUnpinned();
+	}
+	inline void revalidate(int idx, uint64_t serial) {
+		auto &b = blocks[idx];
+		__atomic_store_n(&b.o.serial.data[0], serial, __ATOMIC_SEQ_CST);
+	}
+};
+
+template <class V>
+static void run(int n_thread) {
+	V v;
+	for (int i = 0; i < N_OBJECT; i++) {
+		v.blocks[i].o.serial.data[0] = i + 1;
+		v.blocks[i].o.payload = i;
+	}
+	std::atomic<bool> start(false), stop(false);
+	std::vector<std::thread> threads;
+	std::vector<uint64_t> counts(n_thread, 0), sums(n_thread, 0);
+	for (int t = 0; t < n_thread; t++) {
+		threads.emplace_back([&v, &start, &stop, &counts, &sums, t] {
+			while (!start.load()) {}
+			uint64_t n = 0, sum = 0;
+			nq_serial_t s;
+			while (!stop.load(std::memory_order_relaxed)) {
+				for (int k = 0; k < 64; k++) {
+					int idx = (t + k) % N_OBJECT;
+					s.data[0] = idx + 1;
+					v.validate(idx, s, &sum);
+					n++;
+				}
+			}
+			counts[t] = n;
+			sums[t] = sum;
+		});
+	}
+	//owner thread which closes and re-opens objects, like loop thread does
+	std::thread owner([&v, &start, &stop] {
+		while (!start.load()) {}
+		int idx = 0;
+		while (!stop.load()) {
+			v.invalidate(idx);
+			v.revalidate(idx, idx + 1);
+			idx = (idx + 1) % N_OBJECT;
+			struct timespec ts = { 0, CHURN_INTERVAL_US * 1000 };
+			nanosleep(&ts, nullptr);
+		}
+	});
+	auto begin = now();
+	start.store(true);
+	struct timespec ts = { DURATION_MS / 1000, (DURATION_MS % 1000) * 1000 * 1000 };
+	nanosleep(&ts, nullptr);
+	stop.store(true);
+	for (auto &th : threads) {
+		th.join();
+	}
+	owner.join();
+	auto elapsed = now() - begin;
+	uint64_t total = 0, sum = 0;
+	for (int t = 0; t < n_thread; t++) {
+		total += counts[t];
+		sum += sums[t];
+	}
+	printf("%6s: %2d threads: %12.0f calls/sec (%llu)\n", V::name(), n_thread, 
+		((double)total) * 1000 * 1000 * 1000 / elapsed, (unsigned long long)sum);
+}
+
+int main(int argc, char *argv[]) {
+	const char *mode = argc > 1 ? argv[1] : "all";
+	for (int n = 1; n <= MAX_THREAD; n *= 2) {
+		if (strcmp(mode, "all") == 0 || strcmp(mode, "mutex") == 0) {
+			run<mutex_validator>(n);
+		}
+		if (strcmp(mode, "all") == 0 || strcmp(mode, "pin") == 0) {
+			run<pin_validator>(n);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,437 @@
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "nq.h"
+#include "basis/hdr_histogram.h"
+
+//self contained load benchmark. starts nq_server_t with N workers and M client loops on 127.0.0.1 in one process,
+//then each connection keeps depth requests in flight (closed loop) for duration, with echo workload of:
+//  rpc:    nq_rpc_call, server replies payload
+//  notify: nq_rpc_notify, server notifies payload back
+//  stream: nq_stream_send, server sends record back
+//latency is measured from send to receipt of echo by the timestamp embedded in payload.
+//each run is printed as one json line. with -W, runs are repeated for each number of workers (worker scaling curve).
+//note that client loops run in the same process, so cpu per request includes client side cost
+//and client threads compete with workers for cores.
+
+#define DEFAULT_PORT (18888)
+#define WARMUP_SEC (1)
+#define CONNECT_TIMEOUT_SEC (10)
+#define MAX_PAYLOAD (60 * 1024)
+#define ECHO_TYPE (1)
+
+enum bench_mode {
+	MODE_RPC,
+	MODE_NOTIFY,
+	MODE_STREAM,
+};
+static const char *mode_names[] = { "rpc", "notify", "stream" };
+
+struct options {
+	bench_mode mode;
+	std::vector<int> workers;
+	int client_loops, ccu, depth, payload, duration_sec, port;
+	bool batch_write, shared_socket;
+	const char *cert, *key;
+};
+static options g_opts;
+
+/* state shared by client loops */
+static std::atomic<int> g_ready(0);
+static std::atomic<bool> g_measuring(false), g_stopping(false);
+
+static inline uint64_t cpu_usec() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 * 1000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+
+/* client */
+struct client_loop;
+struct conn_ctx {
+	client_loop *owner;
+	bool opened;
+	nq_rpc_t rpc;
+	nq_stream_t st;
+	nq_on_rpc_reply_t on_reply;
+};
+//only touched by the thread which polls the client, except results read after join
+struct client_loop {
+	int index, n_conn;
+	std::vector<conn_ctx> conns;
+	std::vector<char> payload;
+	nq::HdrHistogram latency; //nsec
+	uint64_t completed, errors;
+	std::thread thread;
+	client_loop() : index(0), n_conn(0), conns(), payload(), latency(), completed(0), errors(0), thread() {}
+};
+
+static void send_request(conn_ctx *c) {
+	auto &buf = c->owner->payload;
+	nq_time_t now = nq_time_now();
+	memcpy(buf.data(), &now, sizeof(now));
+	switch (g_opts.mode) {
+	case MODE_RPC:
+		nq_rpc_call(c->rpc, ECHO_TYPE, buf.data(), buf.size(), c->on_reply);
+		break;
+	case MODE_NOTIFY:
+		nq_rpc_notify(c->rpc, ECHO_TYPE, buf.data(), buf.size());
+		break;
+	case MODE_STREAM:
+		nq_stream_send(c->st, buf.data(), buf.size());
+		break;
+	}
+}
+static void on_echo(conn_ctx *c, const void *data, nq_size_t len) {
+	if (g_stopping.load(std::memory_order_relaxed)) {
+		return;
+	}
+	if (len >= sizeof(nq_time_t) && g_measuring.load(std::memory_order_relaxed)) {
+		nq_time_t sent_ts;
+		memcpy(&sent_ts, data, sizeof(sent_ts));
+		auto now = nq_time_now();
+		c->owner->latency.Record(now > sent_ts ? (now - sent_ts) : 0);
+		c->owner->completed++;
+	}
+	send_request(c);
+}
+static void start_requests(conn_ctx *c) {
+	g_ready++;
+	for (int i = 0; i < g_opts.depth; i++) {
+		send_request(c);
+	}
+}
+
+void on_client_conn_open(void *arg, nq_conn_t c, void **) {
+	auto cc = (conn_ctx *)arg;
+	if (cc->opened) {
+		return;
+	}
+	cc->opened = true;
+	if (g_opts.mode == MODE_STREAM) {
+		nq_conn_stream(c, "st", cc);
+	} else {
+		nq_conn_rpc(c, "rpc", cc);
+	}
+}
+nq_time_t on_client_conn_close(void *arg, nq_conn_t c, nq_error_t e, const nq_error_detail_t *detail, bool remote) {
+	if (!g_stopping.load()) {
+		fprintf(stderr, "connection closed during benchmark: %s(%d)\n", detail->msg, detail->code);
+	}
+	return 0; //no reconnection
+}
+void on_client_conn_finalize(void *arg, nq_conn_t c, void *ctx) {
+}
+bool on_client_rpc_open(void *p, nq_rpc_t rpc, void **ppctx) {
+	auto cc = (conn_ctx *)nq_rpc_ctx(rpc);
+	cc->rpc = rpc;
+	start_requests(cc);
+	return true;
+}
+void on_client_rpc_close(void *p, nq_rpc_t rpc) {
+}
+void on_client_rpc_request(void *p, nq_rpc_t rpc, uint16_t type, nq_msgid_t msgid, const void *data, nq_size_t len) {
+}
+void on_client_rpc_notify(void *p, nq_rpc_t rpc, uint16_t type, const void *data, nq_size_t len) {
+	on_echo((conn_ctx *)nq_rpc_ctx(rpc), data, len);
+}
+void on_client_rpc_reply(void *p, nq_rpc_t rpc, nq_error_t result, const void *data, nq_size_t len) {
+	auto cc = (conn_ctx *)p;
+	if (result < 0) {
+		//timeout or goaway
+		if (!g_stopping.load(std::memory_order_relaxed)) {
+			cc->owner->errors++;
+		}
+		return;
+	}
+	on_echo(cc, data, len);
+}
+bool on_client_stream_open(void *p, nq_stream_t s, void **ppctx) {
+	auto cc = (conn_ctx *)nq_stream_ctx(s);
+	cc->st = s;
+	start_requests(cc);
+	return true;
+}
+void on_client_stream_close(void *p, nq_stream_t s) {
+}
+void on_client_stream_record(void *p, nq_stream_t s, const void *data, nq_size_t len) {
+	on_echo((conn_ctx *)nq_stream_ctx(s), data, len);
+}
+
+static void run_client(client_loop *l, int port) {
+	nq_client_t cl = nq_client_create(l->n_conn, l->n_conn * 4, nullptr);
+	nq_hdmap_t hm = nq_client_hdmap(cl);
+
+	nq_rpc_handler_t rh;
+	nq_closure_init(rh.on_rpc_request, on_client_rpc_request, nullptr);
+	nq_closure_init(rh.on_rpc_notify, on_client_rpc_notify, nullptr);
+	nq_closure_init(rh.on_rpc_open, on_client_rpc_open, nullptr);
+	nq_closure_init(rh.on_rpc_close, on_client_rpc_close, nullptr);
+	rh.timeout = nq_time_sec(30);
+	rh.use_large_msgid = false;
+	nq_hdmap_rpc_handler(hm, "rpc", rh);
+
+	nq_stream_handler_t sh;
+	nq_closure_init(sh.on_stream_open, on_client_stream_open, nullptr);
+	nq_closure_init(sh.on_stream_close, on_client_stream_close, nullptr);
+	nq_closure_init(sh.on_stream_record, on_client_stream_record, nullptr);
+	sh.stream_reader = nq_closure_empty();
+	sh.stream_writer = nq_closure_empty();
+	nq_hdmap_stream_handler(hm, "st", sh);
+
+	nq_addr_t addr = {
+		"127.0.0.1", nullptr, nullptr, nullptr,
+		port
+	};
+	nq_clconf_t conf;
+	memset(&conf, 0, sizeof(conf));
+	conf.insecure = true;
+	conf.track_reachability = false;
+	conf.handshake_timeout = nq_time_sec(CONNECT_TIMEOUT_SEC);
+	conf.idle_timeout = nq_time_sec(60);
+	conf.use_batch_write = g_opts.batch_write;
+	conf.use_shared_socket = g_opts.shared_socket;
+	for (auto &c : l->conns) {
+		nq_closure_init(conf.on_open, on_client_conn_open, &c);
+		nq_closure_init(conf.on_close, on_client_conn_close, &c);
+		nq_closure_init(conf.on_finalize, on_client_conn_finalize, &c);
+		if (!nq_client_connect(cl, &addr, &conf)) {
+			fprintf(stderr, "fail to connect for client loop %d\n", l->index);
+		}
+	}
+	while (!g_stopping.load()) {
+		nq_client_poll(cl);
+	}
+	nq_client_destroy(cl);
+}
+
+
+
+/* server */
+bool on_server_rpc_open(void *p, nq_rpc_t rpc, void **ppctx) {
+	return true;
+}
+void on_server_rpc_close(void *p, nq_rpc_t rpc) {
+}
+void on_server_rpc_request(void *p, nq_rpc_t rpc, uint16_t type, nq_msgid_t msgid, const void *data, nq_size_t len) {
+	nq_rpc_reply(rpc, msgid, data, len);
+}
+void on_server_rpc_notify(void *p, nq_rpc_t rpc, uint16_t type, const void *data, nq_size_t len) {
+	nq_rpc_notify(rpc, type, data, len);
+}
+bool on_server_stream_open(void *p, nq_stream_t s, void **ppctx) {
+	return true;
+}
+void on_server_stream_close(void *p, nq_stream_t s) {
+}
+void on_server_stream_record(void *p, nq_stream_t s, const void *data, nq_size_t len) {
+	nq_stream_send(s, data, len);
+}
+void on_server_conn_open(void *, nq_conn_t c, void **ppctx) {
+}
+void on_server_conn_close(void *, nq_conn_t c, nq_error_t r, const nq_error_detail_t *detail, bool) {
+}
+
+static nq_server_t start_server(int n_worker, int port) {
+	nq_server_t sv = nq_server_create(n_worker);
+	nq_addr_t addr = {
+		"127.0.0.1", g_opts.cert, g_opts.key, nullptr,
+		port
+	};
+	nq_svconf_t conf;
+	memset(&conf, 0, sizeof(conf));
+	conf.quic_secret = "e336e27898ff1e17ac79e82fa0084999";
+	conf.quic_cert_cache_size = 0; //use default
+	conf.accept_per_loop = 0; //use default
+	conf.max_session_hint = g_opts.ccu + 16;
+	conf.max_stream_hint = (g_opts.ccu + 16) * 4;
+	conf.use_max_session_hint_as_limit = false;
+	conf.use_hugepage = false;
+	conf.use_batch_write = g_opts.batch_write;
+	conf.use_gro = false;
+	conf.recv_batch_size = 0; //use default
+	conf.rebalance_threshold = 0;
+	conf.use_reuseport_steering = true;
+	conf.trace_sample_rate = 0;
+	conf.handshake_timeout = nq_time_sec(CONNECT_TIMEOUT_SEC);
+	conf.idle_timeout = nq_time_sec(60);
+	conf.shutdown_timeout = nq_time_msec(100);
+	nq_closure_init(conf.on_open, on_server_conn_open, nullptr);
+	nq_closure_init(conf.on_close, on_server_conn_close, nullptr);
+
+	nq_hdmap_t hm = nq_server_listen(sv, &addr, &conf);
+
+	nq_rpc_handler_t rh;
+	nq_closure_init(rh.on_rpc_request, on_server_rpc_request, nullptr);
+	nq_closure_init(rh.on_rpc_notify, on_server_rpc_notify, nullptr);
+	nq_closure_init(rh.on_rpc_open, on_server_rpc_open, nullptr);
+	nq_closure_init(rh.on_rpc_close, on_server_rpc_close, nullptr);
+	rh.timeout = 0; //use default
+	rh.use_large_msgid = false;
+	nq_hdmap_rpc_handler(hm, "rpc", rh);
+
+	nq_stream_handler_t sh;
+	nq_closure_init(sh.on_stream_open, on_server_stream_open, nullptr);
+	nq_closure_init(sh.on_stream_close, on_server_stream_close, nullptr);
+	nq_closure_init(sh.on_stream_record, on_server_stream_record, nullptr);
+	sh.stream_reader = nq_closure_empty();
+	sh.stream_writer = nq_closure_empty();
+	nq_hdmap_stream_handler(hm, "st", sh);
+
+	nq_server_start(sv, false);
+	return sv;
+}
+
+
+
+/* main */
+static void run(int n_worker, int port) {
+	g_ready = 0;
+	g_measuring = false;
+	g_stopping = false;
+	nq_server_t sv = start_server(n_worker, port);
+
+	std::vector<client_loop> loops(g_opts.client_loops);
+	for (int i = 0; i < g_opts.client_loops; i++) {
+		auto &l = loops[i];
+		l.index = i;
+		l.n_conn = g_opts.ccu / g_opts.client_loops + (i < (g_opts.ccu % g_opts.client_loops) ? 1 : 0);
+		l.conns.resize(l.n_conn);
+		for (auto &c : l.conns) {
+			c.owner = &l;
+			c.opened = false;
+			nq_closure_init(c.on_reply, on_client_rpc_reply, &c);
+		}
+		l.payload.resize(g_opts.payload, 'a');
+	}
+	for (auto &l : loops) {
+		auto pl = &l;
+		l.thread = std::thread([pl, port] { run_client(pl, port); });
+	}
+
+	auto deadline = nq_time_now() + nq_time_sec(CONNECT_TIMEOUT_SEC);
+	while (g_ready.load() < g_opts.ccu && nq_time_now() < deadline) {
+		nq_time_sleep(nq_time_msec(10));
+	}
+	if (g_ready.load() < g_opts.ccu) {
+		fprintf(stderr, "only %d of %d connections are ready\n", g_ready.load(), g_opts.ccu);
+	}
+	nq_time_sleep(nq_time_sec(WARMUP_SEC));
+
+	auto cpu_start = cpu_usec();
+	auto start = nq_time_now();
+	g_measuring = true;
+	nq_time_sleep(nq_time_sec(g_opts.duration_sec));
+	g_measuring = false;
+	auto elapsed = nq_time_now() - start;
+	auto cpu = cpu_usec() - cpu_start;
+
+	g_stopping = true;
+	for (auto &l : loops) {
+		l.thread.join();
+	}
+	nq_server_join(sv);
+
+	nq::HdrHistogram latency;
+	uint64_t completed = 0, errors = 0;
+	for (auto &l : loops) {
+		latency.Merge(l.latency);
+		completed += l.completed;
+		errors += l.errors;
+	}
+	nq_histogram_t h;
+	latency.Summarize(&h, 1);
+	printf("{\"mode\":\"%s\",\"workers\":%d,\"client_loops\":%d,\"ccu\":%d,\"ready\":%d,\"depth\":%d,\"payload\":%d,"
+		"\"duration_sec\":%.3f,\"requests\":%llu,\"errors\":%llu,\"rps\":%.1f,"
+		"\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"cpu_us_per_req\":%.2f}\n",
+		mode_names[g_opts.mode], n_worker, g_opts.client_loops, g_opts.ccu, g_ready.load(), g_opts.depth, g_opts.payload,
+		((double)elapsed) / nq_time_sec(1), (unsigned long long)completed, (unsigned long long)errors,
+		((double)completed) * nq_time_sec(1) / elapsed,
+		h.p50 / 1000.0, h.p99 / 1000.0, h.p999 / 1000.0, h.max / 1000.0,
+		completed > 0 ? ((double)cpu) / completed : 0.0);
+	fflush(stdout);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-m rpc|notify|stream] [-w workers | -W workers,workers,...] [-c client_loops]\n"
+		"  [-n ccu] [-d depth] [-s payload_size] [-t duration_sec] [-p port] [-b(batch write)] [-S(shared socket)]\n"
+		"  [-C cert] [-K key]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	g_opts.mode = MODE_RPC;
+	g_opts.client_loops = 1;
+	g_opts.ccu = 100;
+	g_opts.depth = 1;
+	g_opts.payload = 64;
+	g_opts.duration_sec = 5;
+	g_opts.port = DEFAULT_PORT;
+	g_opts.batch_write = false;
+	g_opts.shared_socket = false;
+	g_opts.cert = "../e2e/server/certs/leaf_cert.pem";
+	g_opts.key = "../e2e/server/certs/leaf_cert.pkcs8";
+	int opt;
+	while ((opt = getopt(argc, argv, "m:w:W:c:n:d:s:t:p:bSC:K:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (strcmp(optarg, "rpc") == 0) { g_opts.mode = MODE_RPC; }
+			else if (strcmp(optarg, "notify") == 0) { g_opts.mode = MODE_NOTIFY; }
+			else if (strcmp(optarg, "stream") == 0) { g_opts.mode = MODE_STREAM; }
+			else { usage(argv[0]); return 1; }
+			break;
+		case 'w':
+			g_opts.workers.assign(1, atoi(optarg));
+			break;
+		case 'W': {
+			g_opts.workers.clear();
+			std::string list(optarg);
+			size_t ofs = 0;
+			while (ofs < list.length()) {
+				auto next = list.find(',', ofs);
+				if (next == std::string::npos) { next = list.length(); }
+				g_opts.workers.push_back(atoi(list.substr(ofs, next - ofs).c_str()));
+				ofs = next + 1;
+			}
+		} break;
+		case 'c': g_opts.client_loops = atoi(optarg); break;
+		case 'n': g_opts.ccu = atoi(optarg); break;
+		case 'd': g_opts.depth = atoi(optarg); break;
+		case 's': g_opts.payload = atoi(optarg); break;
+		case 't': g_opts.duration_sec = atoi(optarg); break;
+		case 'p': g_opts.port = atoi(optarg); break;
+		case 'b': g_opts.batch_write = true; break;
+		case 'S': g_opts.shared_socket = true; break;
+		case 'C': g_opts.cert = optarg; break;
+		case 'K': g_opts.key = optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (g_opts.workers.empty()) {
+		g_opts.workers.push_back(1);
+	}
+	//payload carries send timestamp
+	if (g_opts.payload < (int)sizeof(nq_time_t)) { g_opts.payload = sizeof(nq_time_t); }
+	if (g_opts.payload > MAX_PAYLOAD) { g_opts.payload = MAX_PAYLOAD; }
+	if (g_opts.client_loops <= 0 || g_opts.ccu < g_opts.client_loops || g_opts.depth <= 0 || g_opts.duration_sec <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (size_t i = 0; i < g_opts.workers.size(); i++) {
+		if (g_opts.workers[i] <= 0) { continue; }
+		//use different port for each run, not to receive packets for previous server
+		run(g_opts.workers[i], g_opts.port + (int)i);
+	}
+	return 0;
+}
@@ -0,0 +1,291 @@
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nq.h"
+#include "basis/allocator.h"
+#include "basis/header_codec.h"
+#include "core/nq_alarm.h"
+#include "core/nq_boxer.h"
+#include "core/nq_client_loop.h"
+#include "core/nq_loop.h"
+#include "core/nq_record_parser.h"
+#include "core/nq_serial_codec.h"
+#include "core/nq_unwrapper.h"
+
+//microbenchmarks of hot primitives of naquid. each result is printed as one json object per line, like
+//{"name":"codec.header.encode","threads":1,"ops":10000000,"ns_per_op":1.23,"mops_per_sec":812.3}
+//so that results before and after the change can be compared by script.
+//usage: micro [name prefix to run]
+
+#define N_CODEC (10000000)
+#define N_ALLOC (10000000)
+#define ALLOC_BATCH (64)
+#define N_ALARM (1000000)
+#define ALARM_BATCH (1024)
+#define N_OP (2000000)
+#define MAX_PRODUCER (4)
+#define N_RECORD (1000000)
+#define REGION_SIZE (1350) //approximate payload size of a QUIC packet
+#define N_HANDLE (10000000)
+
+static inline uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+//prevents compiler from eliminating measured code
+static volatile uint64_t g_sink = 0;
+static const char *g_filter = "";
+
+static bool enabled(const char *name) {
+	return strncmp(name, g_filter, strlen(g_filter)) == 0;
+}
+static void report(const char *name, int n_thread, uint64_t n_ops, uint64_t elapsed_ns) {
+	printf("{\"name\":\"%s\",\"threads\":%d,\"ops\":%llu,\"ns_per_op\":%.2f,\"mops_per_sec\":%.3f}\n",
+		name, n_thread, (unsigned long long)n_ops, ((double)elapsed_ns) / n_ops,
+		((double)n_ops * 1000) / elapsed_ns);
+	fflush(stdout);
+}
+
+/* codec */
+static void bench_codec() {
+	char buf[32];
+	nq_size_t lens[] = { 10, 200, 1000, 70000 };
+	nq_msgid_t msgids[] = { 1, 200, 40000, 0x7FFFFFFF };
+	if (enabled("codec.length.encode")) {
+		uint64_t sum = 0, start = now();
+		for (int i = 0; i < N_CODEC; i++) {
+			sum += nq::LengthCodec::Encode(lens[i & 3], buf, sizeof(buf));
+		}
+		report("codec.length.encode", 1, N_CODEC, now() - start);
+		g_sink += sum;
+	}
+	if (enabled("codec.length.decode")) {
+		char encoded[4][32]; nq_size_t n_encoded[4];
+		for (int i = 0; i < 4; i++) {
+			n_encoded[i] = nq::LengthCodec::Encode(lens[i], encoded[i], sizeof(encoded[i]));
+		}
+		uint64_t sum = 0, start = now();
+		for (int i = 0; i < N_CODEC; i++) {
+			nq_size_t len;
+			sum += nq::LengthCodec::Decode(&len, encoded[i & 3], n_encoded[i & 3]);
+			sum += len;
+		}
+		report("codec.length.decode", 1, N_CODEC, now() - start);
+		g_sink += sum;
+	}
+	if (enabled("codec.header.encode")) {
+		uint64_t sum = 0, start = now();
+		for (int i = 0; i < N_CODEC; i++) {
+			sum += nq::HeaderCodec::Encode((i & 1) ? 1 : -1, msgids[i & 3], buf, sizeof(buf));
+		}
+		report("codec.header.encode", 1, N_CODEC, now() - start);
+		g_sink += sum;
+	}
+	if (enabled("codec.header.decode")) {
+		char encoded[4][32]; nq_size_t n_encoded[4];
+		for (int i = 0; i < 4; i++) {
+			n_encoded[i] = nq::HeaderCodec::Encode((i & 1) ? 1 : -1, msgids[i], encoded[i], sizeof(encoded[i]));
+		}
+		uint64_t sum = 0, start = now();
+		for (int i = 0; i < N_CODEC; i++) {
+			int16_t type; nq_msgid_t msgid;
+			sum += nq::HeaderCodec::Decode(&type, &msgid, encoded[i & 3], n_encoded[i & 3]);
+			sum += msgid;
+		}
+		report("codec.header.decode", 1, N_CODEC, now() - start);
+		g_sink += sum;
+	}
+}
+
+/* allocator */
+struct object {
+	char body[256]; //around the size of NqClientStream
+};
+static void bench_allocator() {
+	if (!enabled("allocator.alloc_free")) {
+		return;
+	}
+	nq::Allocator<object> a(1024);
+	void *ptrs[ALLOC_BATCH];
+	//warm up so that chunks are already mapped
+	for (int i = 0; i < ALLOC_BATCH; i++) { ptrs[i] = a.Alloc(sizeof(object)); }
+	for (int i = 0; i < ALLOC_BATCH; i++) { a.Free(ptrs[i]); }
+	auto start = now();
+	for (int n = 0; n < N_ALLOC; n += ALLOC_BATCH) {
+		for (int i = 0; i < ALLOC_BATCH; i++) { ptrs[i] = a.Alloc(sizeof(object)); }
+		for (int i = 0; i < ALLOC_BATCH; i++) { a.Free(ptrs[i]); }
+	}
+	//one op = pair of Alloc and Free
+	report("allocator.alloc_free", 1, N_ALLOC, now() - start);
+}
+
+/* loop alarm */
+class bench_alarm : public net::NqAlarmBase {
+ public:
+	static uint64_t fired_;
+	void OnFire(net::NqLoop *) override {
+		ClearInvocationTS();
+		fired_++;
+	}
+};
+uint64_t bench_alarm::fired_ = 0;
+
+static void bench_loop() {
+	net::NqLoop loop;
+	if (loop.Open(16) < 0) {
+		fprintf(stderr, "fail to open loop\n");
+		return;
+	}
+	std::vector<bench_alarm> alarms(ALARM_BATCH);
+	if (enabled("loop.alarm.set_cancel")) {
+		//spread deadlines so that alarms are placed to various slots of the timer wheel
+		auto base = nq_time_now() + nq_time_sec(1);
+		auto start = now();
+		for (int n = 0; n < N_ALARM; n += ALARM_BATCH) {
+			for (int i = 0; i < ALARM_BATCH; i++) { alarms[i].Start(&loop, base + nq_time_msec(i * 7)); }
+			for (int i = 0; i < ALARM_BATCH; i++) { alarms[i].Stop(&loop); }
+		}
+		//one op = pair of SetAlarm and CancelAlarm
+		report("loop.alarm.set_cancel", 1, N_ALARM, now() - start);
+	}
+	if (enabled("loop.alarm.poll_fire")) {
+		bench_alarm::fired_ = 0;
+		uint64_t elapsed = 0;
+		for (int n = 0; n < N_ALARM; n += ALARM_BATCH) {
+			auto past = nq_time_now() - nq_time_msec(1);
+			for (int i = 0; i < ALARM_BATCH; i++) { alarms[i].Start(&loop, past); }
+			auto start = now();
+			while (loop.alarms_fired() < (uint64_t)(n + ALARM_BATCH)) {
+				loop.Poll(0);
+			}
+			elapsed += (now() - start);
+		}
+		//one op = one alarm fired by Poll
+		report("loop.alarm.poll_fire", 1, bench_alarm::fired_, elapsed);
+	}
+	loop.Close();
+}
+
+/* boxer */
+static void bench_boxer() {
+	if (!enabled("boxer.enqueue_poll")) {
+		return;
+	}
+	nq_client_t cl = nq_client_create(16, 16, nullptr);
+	auto loop = net::NqClientLoop::FromHandle(cl);
+	//ops are executed for the alarm which callback just stops it
+	auto a = loop->NewAlarm();
+	nq_on_alarm_t cb = { nullptr, [](void *, nq_time_t *next) { *next = 0; } };
+	a->Start(loop, nq_time_now() + nq_time_sec(3600), cb);
+	a->Stop(loop);
+	auto h = a->ToHandle();
+	for (int n_producer = 1; n_producer <= MAX_PRODUCER; n_producer *= 2) {
+		net::NqBoxer::Processor processor;
+		std::atomic<bool> start(false);
+		std::vector<std::thread> producers;
+		int n_per_producer = N_OP / n_producer;
+		for (int t = 0; t < n_producer; t++) {
+			producers.emplace_back([&processor, &start, a, h, n_per_producer] {
+				while (!start.load()) {}
+				for (int i = 0; i < n_per_producer; i++) {
+					processor.enqueue(new net::NqBoxer::Op(h.s, a, net::NqBoxer::OpCode::Exec, net::NqBoxer::OpTarget::Alarm));
+				}
+			});
+		}
+		uint64_t total = n_per_producer * n_producer, processed = 0;
+		auto begin = now();
+		start.store(true);
+		//loop thread side
+		while (processed < total) {
+			processed += processor.Poll(loop);
+		}
+		auto elapsed = now() - begin;
+		for (auto &th : producers) {
+			th.join();
+		}
+		//one op = enqueue by producers and process by loop thread
+		report("boxer.enqueue_poll", n_producer, total, elapsed);
+	}
+	nq_client_destroy(cl);
+}
+
+/* rpc */
+static void bench_rpc() {
+	if (!enabled("rpc.parse")) {
+		return;
+	}
+	//same as NqSimpleRPCStreamHandler::OnRecv, which feeds each stream frame to the parser
+	std::string stream;
+	char header[32], payload[256];
+	memset(payload, 'a', sizeof(payload));
+	for (int i = 0; i < N_RECORD; i++) {
+		nq_size_t len = rand() % sizeof(payload);
+		auto ofs = nq::HeaderCodec::Encode(1, (i % 0xFFFF) + 1, header, sizeof(header));
+		ofs += nq::LengthCodec::Encode(len, header + ofs, sizeof(header) - ofs);
+		stream.append(header, ofs);
+		stream.append(payload, len);
+	}
+	net::NqRecordParser<net::NqRPCFrame> parser;
+	uint64_t n_rec = 0, sum = 0;
+	auto start = now();
+	for (size_t ofs = 0; ofs < stream.length(); ofs += REGION_SIZE) {
+		nq_size_t len = std::min((size_t)REGION_SIZE, stream.length() - ofs);
+		parser.Parse(stream.data() + ofs, len, [&n_rec, &sum](const net::NqRPCFrame::Header &h, const char *rec, nq_size_t reclen) {
+			n_rec++;
+			sum += reclen;
+		});
+	}
+	//one op = one record parsed
+	report("rpc.parse", 1, n_rec, now() - start);
+	g_sink += sum;
+}
+
+/* handle */
+static void bench_handle() {
+	if (enabled("handle.serial_codec")) {
+		uint64_t sum = 0, start = now();
+		for (int i = 0; i < N_HANDLE; i++) {
+			nq_serial_t s;
+			net::NqConnSerialCodec::ClientEncode(s, i & 0xFFFF, i >> 16);
+			sum += net::NqConnSerialCodec::ClientSessionIndex(s) + net::NqSerial::Generation(s);
+		}
+		report("handle.serial_codec", 1, N_HANDLE, now() - start);
+		g_sink += sum;
+	}
+	if (enabled("handle.validate")) {
+		//validates alarm handles as nq_alarm_* API does, half of them are already invalid
+		nq_client_t cl = nq_client_create(16, 16, nullptr);
+		auto loop = net::NqClientLoop::FromHandle(cl);
+		nq_alarm_t handles[2] = { loop->NewAlarm()->ToHandle(), loop->NewAlarm()->ToHandle() };
+		handles[1].s.data[0]++;
+		uint64_t n_valid = 0, start = now();
+		for (int i = 0; i < N_HANDLE; i++) {
+			auto &h = handles[i & 1];
+			if (nq_alarm_is_valid(h) && net::NqUnwrapper::UnwrapBoxer(h) == loop) {
+				n_valid++;
+			}
+		}
+		report("handle.validate", 1, N_HANDLE, now() - start);
+		g_sink += n_valid;
+		nq_client_destroy(cl);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	g_filter = argc > 1 ? argv[1] : "";
+	bench_codec();
+	bench_allocator();
+	bench_loop();
+	bench_boxer();
+	bench_rpc();
+	bench_handle();
+	return 0;
+}
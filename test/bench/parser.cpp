@@ -0,0 +1,93 @@
+#include <string>
+#include <vector>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core/nq_record_parser.h"
+
+#define N_RECORD (1000000)
+#define REGION_SIZE (1350) //approximate payload size of a QUIC packet
+#define N_LOOP (5)
+
+static inline uint64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+//same algorithm as NqSimpleRPCStreamHandler::OnRecv before NqRecordParser is introduced
+struct legacy_parser {
+	std::string parse_buffer_;
+	template <class F>
+	void parse(const char *p, nq_size_t len, F f) {
+		parse_buffer_.append(p, len);
+		const char *pstr = parse_buffer_.c_str();
+		size_t plen = parse_buffer_.length(), read_ofs;
+		int16_t type; nq_msgid_t msgid; nq_size_t reclen;
+		do {
+			read_ofs = nq::HeaderCodec::Decode(&type, &msgid, pstr, plen);
+			if (read_ofs == 0) { break; }
+			auto tmp_ofs = nq::LengthCodec::Decode(&reclen, pstr + read_ofs, plen - read_ofs);
+			if (tmp_ofs == 0) { break; }
+			read_ofs += tmp_ofs;
+			if ((read_ofs + reclen) > plen) { break; }
+			f(type, msgid, pstr + read_ofs, reclen);
+			parse_buffer_.erase(0, reclen + read_ofs);
+			pstr = parse_buffer_.c_str();
+			plen = parse_buffer_.length();
+		} while (parse_buffer_.length() > 0);
+	}
+};
+
+static void make_stream(std::string &stream, int max_payload) {
+	char header[32], payload[65536];
+	memset(payload, 'a', sizeof(payload));
+	for (int i = 0; i < N_RECORD; i++) {
+		nq_size_t len = rand() % max_payload;
+		auto ofs = nq::HeaderCodec::Encode(1, (i % 0xFFFF) + 1, header, sizeof(header));
+		ofs += nq::LengthCodec::Encode(len, header + ofs, sizeof(header) - ofs);
+		stream.append(header, ofs);
+		stream.append(payload, len);
+	}
+}
+
+template <class P>
+static void run(const char *name, const std::string &stream, int region_size) {
+	uint64_t total_ns = 0, n_rec = 0, sum = 0;
+	for (int l = 0; l < N_LOOP; l++) {
+		P p;
+		auto start = now();
+		for (size_t ofs = 0; ofs < stream.length(); ofs += region_size) {
+			nq_size_t len = std::min((size_t)region_size, stream.length() - ofs);
+			p.parse(stream.data() + ofs, len, [&n_rec, &sum](int16_t type, nq_msgid_t msgid, const char *rec, nq_size_t reclen) {
+				n_rec++;
+				sum += reclen;
+			});
+		}
+		total_ns += (now() - start);
+	}
+	printf("%s: region %d bytes, %.2f Mrecords/sec (%llu records, %llu payload bytes)\n", name, region_size,
+		((double)n_rec * 1000) / total_ns, (unsigned long long)n_rec, (unsigned long long)sum);
+}
+
+struct new_parser {
+	net::NqRecordParser<net::NqRPCFrame> parser_;
+	template <class F>
+	void parse(const char *p, nq_size_t len, F f) {
+		parser_.Parse(p, len, [&f](const net::NqRPCFrame::Header &h, const char *rec, nq_size_t reclen) {
+			f(h.type_, h.msgid_, rec, reclen);
+		});
+	}
+};
+
+int main(int argc, char *argv[]) {
+	int max_payload = argc > 1 ? atoi(argv[1]) : 64;
+	int region_size = argc > 2 ? atoi(argv[2]) : REGION_SIZE;
+	std::string stream;
+	make_stream(stream, max_payload);
+	run<legacy_parser>("legacy", stream, region_size);
+	run<new_parser>("zero copy", stream, region_size);
+	return 0;
+}
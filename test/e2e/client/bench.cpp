@@ -2,6 +2,7 @@
 
 #include <map>
 #include <inttypes.h>
+#include <memory.h>
 
 #include <basis/endian.h>
 
@@ -148,10 +149,13 @@ int main(int argc, char *argv[]){
     8443
   };
   nq_clconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   conf.insecure = false;
   conf.track_reachability = false;
   conf.idle_timeout = nq_time_sec(60);
   conf.handshake_timeout = nq_time_sec(120);
+  conf.use_batch_write = true;
+  conf.use_shared_socket = true;
 
   for (int i = 0; i < N_CLIENT; i++) {
     //reinitialize closure, with giving client index as arg
@@ -1,4 +1,5 @@
 #include <nq.h>
+#include <memory.h>
 #include <basis/endian.h>
 #include <basis/convert.h>
 
@@ -122,10 +123,13 @@ int main(int argc, char *argv[]){
 
   //connection config
   nq_clconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   conf.insecure = false;
   conf.track_reachability = track_reachability;
   conf.idle_timeout = nq_time_sec(60);
   conf.handshake_timeout = nq_time_sec(120);
+  conf.use_batch_write = false;
+  conf.use_shared_socket = false;
   nq_closure_init(conf.on_open, on_conn_open, &ctx);
   nq_closure_init(conf.on_close, on_conn_close, &ctx);
   nq_closure_init(conf.on_finalize, on_conn_finalize, &ctx)
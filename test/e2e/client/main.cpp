@@ -63,6 +63,15 @@ void test_suites(const nq_addr_t &addr, bool skip = true) {
     Test t(addr, test_timeout);
     if (!t.Run(&o)) { ALERT_AND_EXIT("test_timeout fails"); }
   }//*/
+  TRACE("==================== test_timeout_table_grow ====================");
+  {
+    Test::RunOptions o;
+    o.idle_timeout = nq_time_sec(5);
+    o.handshake_timeout = nq_time_sec(5);
+
+    Test t(addr, test_timeout_table_grow);
+    if (!t.Run(&o)) { ALERT_AND_EXIT("test_timeout_table_grow fails"); }
+  }//*/
   TRACE("==================== test_reconnect_client ====================");
   {
     Test t(addr, test_reconnect_client);
@@ -3,6 +3,7 @@
 #include <map>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <memory.h>
 
 #include <basis/endian.h>
 #include <basis/convert.h>
@@ -203,10 +204,13 @@ int main(int argc, char *argv[]){
     8443
   };
   nq_clconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   conf.insecure = false;
   conf.track_reachability = false;
   conf.idle_timeout = nq_time_sec(60);
   conf.handshake_timeout = nq_time_sec(120);
+  conf.use_batch_write = false;
+  conf.use_shared_socket = false;
 
   for (int i = 0; i < g_client_num; i++) {
     //reinitialize closure, with giving client index as arg
@@ -1,6 +1,8 @@
 #include "resolver.h"
 #include "net/quic/platform/api/quic_ip_address.h"
 
+#include <memory.h>
+
 using namespace nqtest;
 
 struct context {
@@ -38,6 +40,7 @@ void test_resolver(Test::Conn &tc) {
   auto c = new context;
   c->latch = tc.NewLatch();
   nq_clconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   nq_closure_init(conf.on_open, on_conn_open, c);
   nq_closure_init(conf.on_close, on_conn_close, c);
   nq_addr_t addr = { "nosuchhost.nowhere2", nullptr, nullptr, nullptr, 8443};
@@ -1,7 +1,23 @@
 #include "timeout.h"
 
+#include <memory>
+
 using namespace nqtest;
 
+//initial number of request slots of rpc stream (see NqSimpleRPCStreamHandler)
+static const int kInitialRequestSlots = 16;
+
+static void call_sleep(nq_rpc_t rpc, nq_time_t duration, nq_time_t timeout, 
+	std::function<void (nq_error_t, nq_time_t)> cb) {
+	char buffer[sizeof(nq_time_t)];
+	nq::Endian::HostToNetbytes(duration, buffer);
+	auto start = nq_time_now();
+	RPCEX(rpc, RpcType::Sleep, buffer, sizeof(buffer), ([cb, start](
+		nq_rpc_t, nq_error_t r, const void *data, nq_size_t dlen) {
+		cb(r, nq_time_now() - start);
+	}), timeout);
+}
+
 void test_timeout(Test::Conn &conn) {
 	conn.OpenRpc("rpc", [&conn](nq_rpc_t rpc, void **ppctx) {
 		auto done = conn.NewLatch();
@@ -36,3 +52,59 @@ void test_timeout(Test::Conn &conn) {
 		return true;
 	});
 }
+
+//msgid is [generation][slot index]. make every slot 3rd generation with timing out 2nd generation calls, 
+//then grow request table while 3rd generation calls are in-flight. calls after growing should not reuse msgid 
+//of timed out calls, otherwise late replies of them (arrive 1.5sec after) are delivered to the new calls.
+void test_timeout_table_grow(Test::Conn &conn) {
+	auto pconn = &conn;
+	conn.OpenRpc("rpc", [pconn](nq_rpc_t rpc, void **ppctx) {
+		auto setup = pconn->NewLatch();
+		auto n_replied = std::make_shared<int>(0);
+		auto failed = std::make_shared<bool>(false);
+		auto fail = [setup, failed]() {
+			if (!*failed) {
+				*failed = true;
+				setup(false);
+			}
+		};
+		auto gen3 = [pconn, rpc, setup]() {
+			TRACE("test_timeout_table_grow: call 3rd generation and grow table");
+			for (int i = 0; i < kInitialRequestSlots; i++) {
+				call_sleep(rpc, nq_time_sec(3), nq_time_sec(5), [](nq_error_t, nq_time_t) {});
+			}
+			for (int i = 0; i < kInitialRequestSlots; i++) {
+				auto done = pconn->NewLatch();
+				call_sleep(rpc, nq_time_sec(3), nq_time_sec(5), [done](nq_error_t r, nq_time_t elapsed) {
+					TRACE("test_timeout_table_grow: reply after growing %d, takes: %llu", r, elapsed);
+					done(r == 0 && elapsed >= nq_time_sec(3));
+				});
+			}
+			setup(true);
+		};
+		auto gen2 = [rpc, n_replied, fail, gen3]() {
+			TRACE("test_timeout_table_grow: call 2nd generation which times out");
+			*n_replied = 0;
+			for (int i = 0; i < kInitialRequestSlots; i++) {
+				call_sleep(rpc, nq_time_sec(2), nq_time_msec(500), [n_replied, fail, gen3](nq_error_t r, nq_time_t) {
+					if (r != NQ_ETIMEOUT) {
+						fail();
+					} else if (++(*n_replied) == kInitialRequestSlots) {
+						gen3();
+					}
+				});
+			}
+		};
+		TRACE("test_timeout_table_grow: call 1st generation");
+		for (int i = 0; i < kInitialRequestSlots; i++) {
+			call_sleep(rpc, 0, nq_time_sec(5), [n_replied, fail, gen2](nq_error_t r, nq_time_t) {
+				if (r != 0) {
+					fail();
+				} else if (++(*n_replied) == kInitialRequestSlots) {
+					gen2();
+				}
+			});
+		}
+		return true;
+	});
+}
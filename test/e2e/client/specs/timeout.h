@@ -2,4 +2,5 @@
 
 #include "common.h"
 
-extern void test_timeout(nqtest::Test::Conn &conn);
\ No newline at end of file
+extern void test_timeout(nqtest::Test::Conn &conn);
+extern void test_timeout_table_grow(nqtest::Test::Conn &conn);
\ No newline at end of file
@@ -227,10 +227,13 @@ bool Test::Run(const RunOptions *opt) {
   current_client_ = cl;
 
   nq_clconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   conf.insecure = false;
   conf.track_reachability = false;
   conf.handshake_timeout = current_options_.handshake_timeout;
   conf.idle_timeout = current_options_.idle_timeout;
+  conf.use_batch_write = false;
+  conf.use_shared_socket = false;
 
   Conn *conns = new Conn[concurrency_];
   for (int i = 0; i < concurrency_; i++) {
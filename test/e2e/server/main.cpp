@@ -351,14 +351,22 @@ void setup_server(nq_server_t sv, int port, server_config *svconfig) {
   };
 
   nq_svconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   CONFIG_VAL(svconfig, quic_secret, "e336e27898ff1e17ac79e82fa0084999", conf.quic_secret);
   conf.quic_cert_cache_size = 0; //use default
   conf.accept_per_loop = 0; //use default
   conf.max_session_hint = 1024;
   conf.max_stream_hint = 1024 * 4;
+  conf.use_hugepage = false;
+  conf.rebalance_threshold = 0;
   conf.handshake_timeout = nq_time_sec(120);
   conf.idle_timeout = nq_time_sec(60);
   conf.shutdown_timeout = nq_time_sec(5);
+  conf.use_batch_write = false;
+  conf.use_gro = false;
+  conf.recv_batch_size = 0; //use default
+  conf.trace_sample_rate = 0;
+  conf.use_reuseport_steering = true;
   CONFIG_CB(svconfig, on_server_conn_open, on_conn_open, conf.on_open);
   nq_closure_init(conf.on_close, on_conn_close, nullptr);
 
@@ -4,6 +4,8 @@
 #include <basis/convert.h>
 #include <basis/endian.h>
 
+#include <memory.h>
+
 using namespace nqtest;
 
 static const int kThreads = 4;  //4 thread server
@@ -81,14 +83,22 @@ void setup_server(nq_server_t sv, int port) {
   };
 
   nq_svconf_t conf;
+  memset(&conf, 0, sizeof(conf));
   conf.quic_secret = "e336e27898ff1e17ac79e82fa0084999";
   conf.quic_cert_cache_size = 0; //use default
   conf.accept_per_loop = 0; //use default
   conf.max_session_hint = 1024;
   conf.max_stream_hint = 1024 * 4;
+  conf.use_hugepage = false;
+  conf.rebalance_threshold = 0;
   conf.handshake_timeout = nq_time_sec(120);
   conf.idle_timeout = nq_time_sec(60);
   conf.shutdown_timeout = 0; //use default
+  conf.use_batch_write = false;
+  conf.use_gro = false;
+  conf.recv_batch_size = 0; //use default
+  conf.trace_sample_rate = 0;
+  conf.use_reuseport_steering = true;
   nq_closure_init(conf.on_open, on_conn_open, nullptr);
   nq_closure_init(conf.on_close, on_conn_close, nullptr);
 